@@ -0,0 +1,869 @@
+// Offline benchmark of the voxel mesh generators. Builds a few
+// standard single-chunk-group scenes, and for each VoxelLayout (and
+// the greedy mesher) reports the number of records, the triangles and
+// vertex shader invocations needed to draw them, and the generation
+// time. Then renders each scene with the CPU reference raymarcher and
+// reports rays per second per core, and builds their levels of
+// detail. Then times frustum culling of a large grid of chunk group
+// boxes, occlusion culling behind a solid slab, meshing and culling on
+// the job system from 1 to 64 threads, and writing and loading the
+// scenes as a region file. Then compresses the scenes' chunks (last,
+// since the scenes are built once and that changes them), and times
+// device memory suballocation churn. No GPU needed. Exits with status
+// 1 if a correctness check fails (they run first) or the region file
+// doesn't round-trip.
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "buddy.hh"
+#include "chunk.hh"
+#include "cull.hh"
+#include "faces.hh"
+#include "greedy.hh"
+#include "jobs.hh"
+#include "lod.hh"
+#include "occlusion.hh"
+#include "raymarch.hh"
+#include "region.hh"
+
+using namespace myricube;
+
+// Fill the group with a solid slab 64 voxels high.
+static void flat_scene(ChunkGroup* group)
+{
+    Voxel grass = Voxel::from_rgb(0x40, 0xA0, 0x40);
+    for (int z = 0; z < group_size; ++z) {
+        for (int y = 0; y < 64; ++y) {
+            for (int x = 0; x < group_size; ++x) group->set(x, y, z, grass);
+        }
+    }
+}
+
+// Rolling hills: height field, solid below the surface.
+static void hills_scene(ChunkGroup* group)
+{
+    for (int z = 0; z < group_size; ++z) {
+        for (int x = 0; x < group_size; ++x) {
+            int height = int(96 + 40 * sin(x * 0.05) * cos(z * 0.037));
+            for (int y = 0; y < height; ++y) {
+                uint8_t shade = uint8_t(y * 2);
+                group->set(x, y, z, Voxel::from_rgb(shade, 0x80, 0x40));
+            }
+        }
+    }
+}
+
+// Scattered voxels, 1 in 20, mostly isolated.
+static void sparse_scene(ChunkGroup* group)
+{
+    srand(19991231);
+    for (int z = 0; z < group_size; ++z) {
+        for (int y = 0; y < group_size; ++y) {
+            for (int x = 0; x < group_size; ++x) {
+                if (rand() % 20 != 0) continue;
+                group->set(x, y, z, Voxel::from_rgb(rand(), rand(), rand()));
+            }
+        }
+    }
+}
+
+// The whole chunk group filled in.
+static void solid_scene(ChunkGroup* group)
+{
+    Voxel stone = Voxel::from_rgb(0x80, 0x80, 0x80);
+    for (int z = 0; z < group_size; ++z) {
+        for (int y = 0; y < group_size; ++y) {
+            for (int x = 0; x < group_size; ++x) group->set(x, y, z, stone);
+        }
+    }
+}
+
+struct Scene
+{
+    const char* name;
+    void (*build)(ChunkGroup*);
+};
+
+static const Scene scenes[] = {
+    { "flat", flat_scene },
+    { "hills", hills_scene },
+    { "sparse", sparse_scene },
+    { "solid", solid_scene },
+};
+
+static const char* encoding_name(ChunkEncoding encoding)
+{
+    switch (encoding) {
+        case ChunkEncoding::dense: return "dense";
+        case ChunkEncoding::palette: return "palette";
+        case ChunkEncoding::runs: return "runs";
+    }
+    return "?";
+}
+
+// Compress chunks of empty, uniform, random (16 colors, a third
+// empty), layered, 256-color and high-entropy voxels, and check that
+// decode and get return the voxels assigned. Returns false on a
+// mismatch.
+static bool check_compression()
+{
+    static const char* const kinds[] = {
+        "empty", "uniform", "random", "layers", "256 colors", "high entropy",
+    };
+    std::vector<Voxel> voxels(chunk_voxels), decoded(chunk_voxels);
+    bool all_same = true;
+    srand(20200202);
+    for (int kind = 0; kind < 6; ++kind) {
+        for (int i = 0; i < chunk_voxels; ++i) {
+            int z = i / (chunk_size * chunk_size);
+            switch (kind) {
+                case 0: voxels[i] = Voxel{}; break;
+                case 1: voxels[i] = Voxel::from_rgb(0x80, 0x40, 0x20); break;
+                case 2: voxels[i] = rand() % 3 == 0 ? Voxel{} : Voxel::from_rgb(rand() % 16 * 16, 0, 0xFF); break;
+                case 3: voxels[i] = z < 5 ? Voxel{} : Voxel::from_rgb(uint8_t(z / 3 * 40), 0x80, 0); break;
+                case 4: voxels[i] = Voxel::from_rgb(uint8_t(i), uint8_t(i * 7), 0); break;
+                default: voxels[i] = Voxel::from_rgb(rand(), rand(), rand()); break;
+            }
+        }
+        Chunk chunk;
+        chunk.assign(voxels.data());
+        chunk.compress();
+        chunk.decode(decoded.data());
+        bool same = decoded == voxels;
+        for (int i = 0; same && i < chunk_voxels; ++i) {
+            same = chunk.get(i % chunk_size, i / chunk_size % chunk_size, i / (chunk_size * chunk_size)) == voxels[i];
+        }
+        printf("%-12s %-24s %-8s %s\n", "compression", kinds[kind],
+            encoding_name(chunk.encoding), same ? "ok" : "MISMATCH");
+        all_same &= same;
+    }
+    return all_same;
+}
+
+static bool same_instances(const std::vector<VoxelInstance>& a, const std::vector<VoxelInstance>& b)
+{
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i].packed_residue_face_bits != b[i].packed_residue_face_bits) return false;
+        if (a[i].packed_color != b[i].packed_color) return false;
+    }
+    return true;
+}
+
+// Check the face generator on empty, full, checkerboard, chunk border
+// (every voxel with a coordinate of 0 or 15 mod 16, which includes the
+// 64-bit word and group borders) and random (1 in 3) groups: the
+// default kernel (AVX2, if the CPU has it) must match the scalar one
+// record for record in both layouts, and the box records must match a
+// per-voxel walk with voxel_face_bits. Returns false on a mismatch.
+static bool check_face_bits(OccupancyGrid* scratch)
+{
+    static const char* const kinds[] = {
+        "empty", "full", "checkerboard", "chunk borders", "random",
+    };
+#if defined(__x86_64__) || defined(__i386__)
+    const char* kernel = __builtin_cpu_supports("avx2") ? "avx2" : "scalar";
+#else
+    const char* kernel = "scalar";
+#endif
+    bool all_same = true;
+    srand(20240229);
+    for (int kind = 0; kind < 5; ++kind) {
+        ChunkGroup group{ GroupCoord{} };
+        if (kind == 1) solid_scene(&group);
+        for (int z = 0; kind >= 2 && z < group_size; ++z) {
+            for (int y = 0; y < group_size; ++y) {
+                for (int x = 0; x < group_size; ++x) {
+                    bool border = (x + 1) % 16 < 2 || (y + 1) % 16 < 2 || (z + 1) % 16 < 2;
+                    bool visible = kind == 2 ? ((x + y + z) & 1) != 0
+                                 : kind == 3 ? border : rand() % 3 == 0;
+                    if (visible) group.set(x, y, z, Voxel::from_rgb(uint8_t(x), uint8_t(y), uint8_t(z)));
+                }
+            }
+        }
+
+        // Expected box records, in make_voxel_instances' z, y, x order.
+        std::vector<VoxelInstance> expected, fast, scalar;
+        for (int z = 0; z < group_size; ++z) {
+            for (int y = 0; y < group_size; ++y) {
+                for (int x = 0; x < group_size; ++x) {
+                    if (group.get_chunk(x / chunk_size, y / chunk_size, z / chunk_size) == nullptr) {
+                        x += chunk_size - 1;
+                        continue;
+                    }
+                    uint32_t face_bits = voxel_face_bits(group, x, y, z);
+                    if (face_bits == 0) continue;
+                    uint32_t residue = uint32_t(x) << X_SHIFT | uint32_t(y) << Y_SHIFT | uint32_t(z) << Z_SHIFT;
+                    expected.push_back({ residue | face_bits, group.get(x, y, z).packed_color });
+                }
+            }
+        }
+
+        bool same = true;
+        for (VoxelLayout layout : { VoxelLayout::box, VoxelLayout::face }) {
+            make_voxel_instances(group, scratch, &fast, layout);
+            make_voxel_instances_scalar(group, scratch, &scalar, layout);
+            same &= same_instances(fast, scalar);
+            if (layout == VoxelLayout::box) same &= same_instances(scalar, expected);
+        }
+        printf("%-12s %-24s %-8s %s\n", "face bits", kinds[kind], kernel, same ? "ok" : "MISMATCH");
+        all_same &= same;
+    }
+    return all_same;
+}
+
+// Apply random edits (sets and clears, in two 32-voxel corners of the
+// group so that they touch each other and the group's faces) to a
+// random group, patching an InstanceList with update_voxel after each,
+// and check every 500 edits that it holds the same records as a full
+// make_voxel_instances, in both layouts. Returns false on a mismatch.
+static bool check_update_voxel(OccupancyGrid* scratch)
+{
+    auto by_value = [] (VoxelInstance a, VoxelInstance b) {
+        if (a.packed_residue_face_bits != b.packed_residue_face_bits) {
+            return a.packed_residue_face_bits < b.packed_residue_face_bits;
+        }
+        return a.packed_color < b.packed_color;
+    };
+    bool all_same = true;
+    for (VoxelLayout layout : { VoxelLayout::box, VoxelLayout::face }) {
+        srand(20201231);
+        auto corner_coord = [] (int corner) {
+            return corner == 0 ? rand() % 32 : group_size - 32 + rand() % 32;
+        };
+        ChunkGroup group{ GroupCoord{} };
+        for (int i = 0; i < 20000; ++i) {
+            int corner = rand() % 2;
+            int x = corner_coord(corner), y = corner_coord(corner), z = corner_coord(corner);
+            group.set(x, y, z, Voxel::from_rgb(rand(), rand(), rand()));
+        }
+
+        InstanceList list(layout);
+        list.rebuild(group, scratch);
+        std::vector<VoxelInstance> patched, rebuilt;
+        bool same = true;
+        for (int i = 1; same && i <= 5000; ++i) {
+            int corner = rand() % 2;
+            int x = corner_coord(corner), y = corner_coord(corner), z = corner_coord(corner);
+            Voxel v = rand() % 2 ? Voxel::from_rgb(rand(), rand(), rand()) : Voxel{};
+            group.set(x, y, z, v);
+            list.update_voxel(&group, x, y, z);
+            if (i % 500 != 0) continue;
+
+            patched = list.get_instances();
+            make_voxel_instances(group, scratch, &rebuilt, layout);
+            std::sort(patched.begin(), patched.end(), by_value);
+            std::sort(rebuilt.begin(), rebuilt.end(), by_value);
+            same = same_instances(patched, rebuilt);
+        }
+        printf("%-12s %-24s %-8s %s\n", "update", "random edits",
+            layout == VoxelLayout::box ? "box" : "face", same ? "ok" : "MISMATCH");
+        all_same &= same;
+    }
+    return all_same;
+}
+
+// Check that the greedy quads of hills, chunk border and random (1 in
+// 2, 3 colors, in a 64-voxel corner) groups cover exactly the face
+// records of the group, each once and in its voxel's color: every quad
+// is split into unit faces, which must match the face layout's records
+// with no duplicates (overlaps) or missing ones (gaps). Returns false
+// on a mismatch.
+static bool check_greedy(OccupancyGrid* scratch)
+{
+    static const char* const kinds[] = { "hills", "chunk borders", "random" };
+    auto by_value = [] (VoxelInstance a, VoxelInstance b) {
+        if (a.packed_residue_face_bits != b.packed_residue_face_bits) {
+            return a.packed_residue_face_bits < b.packed_residue_face_bits;
+        }
+        return a.packed_color < b.packed_color;
+    };
+    const Voxel colors[3] = {
+        Voxel::from_rgb(0xFF, 0, 0), Voxel::from_rgb(0, 0xFF, 0), Voxel::from_rgb(0, 0, 0xFF),
+    };
+    bool all_same = true;
+    srand(20190704);
+    for (int kind = 0; kind < 3; ++kind) {
+        ChunkGroup group{ GroupCoord{} };
+        if (kind == 0) hills_scene(&group);
+        for (int z = 0; kind == 1 && z < group_size; ++z) {
+            for (int y = 0; y < group_size; ++y) {
+                for (int x = 0; x < group_size; ++x) {
+                    if ((x + 1) % 16 < 2 || (y + 1) % 16 < 2 || (z + 1) % 16 < 2) {
+                        group.set(x, y, z, colors[(x / 16 + y / 16 + z / 16) % 2]);
+                    }
+                }
+            }
+        }
+        for (int z = 0; kind == 2 && z < 64; ++z) {
+            for (int y = 0; y < 64; ++y) {
+                for (int x = 0; x < 64; ++x) {
+                    if (rand() % 2 == 0) group.set(x, y, z, colors[rand() % 3]);
+                }
+            }
+        }
+
+        GreedyMesh mesh;
+        make_greedy_mesh(group, scratch, &mesh);
+        std::vector<VoxelInstance> covered, faces;
+        bool same = mesh.indices.size() == mesh.quad_count() * 6;
+        for (size_t q = 0; same && q < mesh.quad_count(); ++q) {
+            const MeshVertex* corners = &mesh.vertices[q * 4];
+            int lo[3] = { group_size, group_size, group_size }, hi[3] = { 0, 0, 0 };
+            uint32_t face = corners[0].packed_position >> MESH_FACE_SHIFT;
+            for (int i = 0; i < 4; ++i) {
+                uint32_t p = corners[i].packed_position;
+                int xyz[3] = { int(p >> MESH_X_SHIFT & 511), int(p >> MESH_Y_SHIFT & 511), int(p >> MESH_Z_SHIFT & 511) };
+                for (int a = 0; a < 3; ++a) {
+                    lo[a] = std::min(lo[a], xyz[a]);
+                    hi[a] = std::max(hi[a], xyz[a]);
+                }
+                same &= p >> MESH_FACE_SHIFT == face && corners[i].packed_color == corners[0].packed_color;
+            }
+            // The quad's plane is the far side of its voxels for
+            // positive faces.
+            int axis = int(face / 2);
+            lo[axis] -= face & 1;
+            hi[axis] = lo[axis] + 1;
+            for (int z = lo[2]; z < hi[2]; ++z) {
+                for (int y = lo[1]; y < hi[1]; ++y) {
+                    for (int x = lo[0]; x < hi[0]; ++x) {
+                        uint32_t residue = uint32_t(x) << X_SHIFT | uint32_t(y) << Y_SHIFT | uint32_t(z) << Z_SHIFT;
+                        covered.push_back({ residue | face << FACE_INDEX_SHIFT, corners[0].packed_color });
+                    }
+                }
+            }
+        }
+        make_voxel_instances(group, scratch, &faces, VoxelLayout::face);
+        std::sort(covered.begin(), covered.end(), by_value);
+        std::sort(faces.begin(), faces.end(), by_value);
+        same = same && same_instances(covered, faces);
+        printf("%-12s %-24s %-8s %s\n", "greedy", kinds[kind], "", same ? "ok" : "MISMATCH");
+        all_same &= same;
+    }
+    return all_same;
+}
+
+// Trace a 96x64 pinhole view of a small random scene (1 in 6 voxels
+// of a 40-voxel cube straddling chunk borders, random colors) with
+// CpuRaymarcher::trace, and check each ray against a brute-force walk
+// intersecting it with the box of every visible voxel: both must hit
+// or miss, at the same distance (to within 1e-3), and the raymarcher's
+// color must be that of the nearest voxel (or of one entered within
+// 1e-3 of it, for rays through edges). Returns false on a mismatch.
+static bool check_raymarch()
+{
+    struct Box
+    {
+        int xyz[3];
+        uint32_t packed_color;
+    };
+    std::vector<Box> boxes;
+    ChunkGroup group{ GroupCoord{} };
+    srand(20170101);
+    for (int z = 8; z < 48; ++z) {
+        for (int y = 8; y < 48; ++y) {
+            for (int x = 8; x < 48; ++x) {
+                if (rand() % 6 != 0) continue;
+                Voxel v = Voxel::from_rgb(rand(), rand(), rand());
+                group.set(x, y, z, v);
+                boxes.push_back({ { x, y, z }, v.packed_color });
+            }
+        }
+    }
+    CpuRaymarcher raymarcher;
+    raymarcher.add_group(group);
+
+    const int width = 96, height = 64;
+    const glm::dvec3 eye(-30.3, 70.7, -20.1);
+    const glm::vec3 forward = glm::normalize(glm::vec3(28, 28, 28) - glm::vec3(eye));
+    const glm::vec3 right = glm::normalize(glm::cross(forward, glm::vec3(0, 1, 0)));
+    const glm::vec3 up = glm::cross(right, forward);
+    const double max_distance = 1000;
+    const double epsilon = 1e-3;
+
+    int mismatches = 0;
+    for (int py = 0; py < height; ++py) {
+        for (int px = 0; px < width; ++px) {
+            float ndc_x = 2.0f * (px + 0.5f) / width - 1.0f;
+            float ndc_y = 1.0f - 2.0f * (py + 0.5f) / height;
+            glm::vec3 dir = glm::normalize(forward + right * (ndc_x * 0.75f) + up * (ndc_y * 0.5f));
+
+            RayHit hit;
+            bool marched = raymarcher.trace(eye, dir, max_distance, &hit);
+
+            // Entry distance of the ray into each box (slab test).
+            const double origin[3] = { eye.x, eye.y, eye.z };
+            const double d[3] = { dir.x, dir.y, dir.z };
+            auto entry = [&origin, &d] (const Box& box) -> double
+            {
+                double t_enter = 0, t_exit = INFINITY;
+                for (int a = 0; a < 3; ++a) {
+                    double lo = box.xyz[a], hi = box.xyz[a] + 1;
+                    if (d[a] == 0) {
+                        if (origin[a] < lo || origin[a] > hi) return INFINITY;
+                        continue;
+                    }
+                    double t0 = (lo - origin[a]) / d[a], t1 = (hi - origin[a]) / d[a];
+                    t_enter = std::max(t_enter, std::min(t0, t1));
+                    t_exit = std::min(t_exit, std::max(t0, t1));
+                }
+                return t_enter <= t_exit ? t_enter : INFINITY;
+            };
+            double nearest = INFINITY;
+            for (const Box& box : boxes) nearest = std::min(nearest, entry(box));
+            bool walked = nearest <= max_distance;
+
+            bool same = marched == walked;
+            if (same && marched) {
+                same = fabs(hit.t - nearest) < epsilon;
+                bool color_found = false;
+                for (const Box& box : boxes) {
+                    if (box.packed_color == hit.packed_color && entry(box) < nearest + epsilon) {
+                        color_found = true;
+                    }
+                }
+                same &= color_found;
+            }
+            mismatches += !same;
+        }
+    }
+    printf("%-12s %-24s %-8s %s\n", "raymarch", "brute-force walk", "",
+        mismatches == 0 ? "ok" : "MISMATCH");
+    if (mismatches != 0) printf("%d of %d rays differ\n", mismatches, width * height);
+    return mismatches == 0;
+}
+
+// Render the scene from outside the chunk group, looking at its
+// center from above, and report raymarching speed.
+static void bench_raymarch(const char* name, const ChunkGroup& group, JobSystem* jobs)
+{
+    const int width = 640, height = 360;
+    const int threads = jobs->thread_count();
+
+    CpuRaymarcher raymarcher;
+    raymarcher.add_group(group);
+
+    Camera camera;
+    glm::dvec3 eye(-60, 200, -60);
+    glm::dvec3 dir = glm::normalize(glm::dvec3(128, 64, 128) - eye);
+    camera.set_eye(eye);
+    camera.set_phi(float(acos(dir.y)));
+    camera.set_theta(float(atan2(dir.z, dir.x)));
+
+    std::vector<uint32_t> rgba(size_t(width) * height);
+    const int repetitions = 3;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repetitions; ++i) {
+        raymarcher.render(camera, width, height, rgba.data(), jobs);
+    }
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count() / repetitions;
+
+    double rays_per_second = width * height / seconds;
+    printf("%-8s %3d threads %10.2f Mrays/s %10.2f Mrays/s/core\n",
+        name, threads, rays_per_second * 1e-6, rays_per_second * 1e-6 / threads);
+}
+
+// Cull a flat 256 x 256 grid of chunk group boxes (4 groups high),
+// 65536 boxes, from a camera in the middle with a far plane covering
+// a good part of the grid.
+static void bench_cull()
+{
+    CullBoxes boxes;
+    for (int z = -128; z < 128; ++z) {
+        for (int x = -128; x < 128; ++x) {
+            glm::dvec3 lo = glm::dvec3(x, (x ^ z) & 3, z) * double(group_size);
+            boxes.push_back(lo, lo + glm::dvec3(group_size));
+        }
+    }
+
+    Camera camera;
+    camera.set_eye(glm::dvec3(0, 300, 0));
+    camera.set_far_plane(16384);
+    camera.set_window_size(1280, 720);
+    CullFrustum frustum = make_cull_frustum(camera.get_projection(), camera.get_view(), camera.get_eye(), float(camera.get_far_plane()));
+
+    std::vector<uint32_t> visible;
+    const int repetitions = 100;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repetitions; ++i) cull_boxes(boxes, frustum, &visible);
+    auto end = std::chrono::steady_clock::now();
+    double ms = std::chrono::duration<double, std::milli>(end - start).count() / repetitions;
+
+    printf("%zu boxes %10zu visible %10.3f ms\n", boxes.size(), visible.size(), ms);
+}
+
+// Mesh 16 chunk groups (each scene 4 times) and frustum cull a grid
+// of 65536 boxes in ranges, as one job graph on thread_counts threads,
+// and report the wall time, the speedup over 1 thread, and the total
+// time of each kind of job (which grows with contention).
+static void bench_jobs(const std::vector<std::unique_ptr<ChunkGroup>>& groups)
+{
+    CullBoxes boxes;
+    for (int z = -128; z < 128; ++z) {
+        for (int x = -128; x < 128; ++x) {
+            glm::dvec3 lo = glm::dvec3(x, (x ^ z) & 3, z) * double(group_size);
+            boxes.push_back(lo, lo + glm::dvec3(group_size));
+        }
+    }
+    Camera camera;
+    camera.set_eye(glm::dvec3(0, 300, 0));
+    camera.set_far_plane(16384);
+    camera.set_window_size(1280, 720);
+    CullFrustum frustum = make_cull_frustum(camera.get_projection(), camera.get_view(), camera.get_eye(), float(camera.get_far_plane()));
+
+    const size_t mesh_count = 16, cull_range = 1024;
+    std::vector<std::vector<VoxelInstance>> instances(mesh_count);
+    std::vector<std::vector<uint32_t>> visible((boxes.size() + cull_range - 1) / cull_range);
+
+    printf("%-8s %10s %8s %12s %12s\n", "threads", "wall ms", "speedup", "mesh ms", "cull ms");
+    double single_ms = 0;
+    for (int threads : { 1, 2, 4, 8, 16, 32, 64 }) {
+        JobSystem jobs(threads);
+        std::vector<std::unique_ptr<OccupancyGrid>> scratch(threads);
+        JobGraph graph;
+        for (size_t i = 0; i < mesh_count; ++i) {
+            graph.add("mesh", [&, i] (int worker) {
+                if (scratch[worker] == nullptr) scratch[worker] = std::make_unique<OccupancyGrid>();
+                make_voxel_instances(*groups[i % groups.size()], scratch[worker].get(), &instances[i], VoxelLayout::face);
+            });
+        }
+        graph.add_range("cull", boxes.size(), cull_range, [&] (size_t begin, size_t end, int) {
+            cull_boxes(boxes, frustum, begin, end, &visible[begin / cull_range]);
+        });
+
+        jobs.run(graph);    // Warm up (and allocate scratch).
+        auto start = std::chrono::steady_clock::now();
+        jobs.run(graph);
+        auto end = std::chrono::steady_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(end - start).count();
+        if (threads == 1) single_ms = ms;
+
+        double mesh_ms = 0, cull_ms = 0;
+        for (const JobTiming& timing : graph.timings()) {
+            double job_ms = timing.end_ms - timing.start_ms;
+            if (strcmp(timing.name, "mesh") == 0) mesh_ms += job_ms;
+            if (strcmp(timing.name, "cull") == 0) cull_ms += job_ms;
+        }
+        printf("%-8i %10.2f %7.2fx %12.2f %12.2f\n", threads, ms, single_ms / ms, mesh_ms, cull_ms);
+    }
+}
+
+// Rasterize the occluders of the flat scene's group (a solid slab 64
+// voxels high) seen edge-on from just in front of it, then test a
+// 64 x 64 grid of chunk-sized boxes on the ground behind it.
+static void bench_occlusion(const ChunkGroup& flat)
+{
+    std::vector<OccluderBox> occluders;
+    find_occluders(flat, &occluders);
+
+    std::vector<glm::dvec3> box_lo;
+    for (int z = 0; z < 64; ++z) {
+        for (int x = -32; x < 32; ++x) {
+            box_lo.push_back(glm::dvec3(128 + x * chunk_size, 0, group_size + z * chunk_size));
+        }
+    }
+
+    glm::dvec3 eye(128, 48, -32);
+    glm::mat4 view = glm::lookAt(glm::vec3(eye), glm::vec3(eye) + glm::vec3(0, 0, 1), glm::vec3(0, 1, 0));
+    glm::mat4 projection = glm::perspective(1.0f, 16.0f / 9.0f, 0.1f, 4096.0f);
+
+    auto buffer = std::make_unique<OcclusionBuffer>();
+    size_t occluded = 0;
+    const int repetitions = 100;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repetitions; ++i) {
+        buffer->begin(view, projection, eye);
+        for (const OccluderBox& box : occluders) {
+            buffer->add_occluder(
+                glm::dvec3(box.lo[0], box.lo[1], box.lo[2]),
+                glm::dvec3(box.hi[0], box.hi[1], box.hi[2]));
+        }
+        occluded = 0;
+        for (glm::dvec3 lo : box_lo) {
+            occluded += buffer->occluded(lo, lo + glm::dvec3(chunk_size));
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ms = std::chrono::duration<double, std::milli>(end - start).count() / repetitions;
+
+    printf("%zu occluders %zu boxes %10zu occluded %10.3f ms\n", occluders.size(), box_lo.size(), occluded, ms);
+}
+
+// Compress all chunks of the group, and report the memory used
+// before and after, the compression time, and the face generator's
+// time on the compressed chunks.
+static void bench_compression(const char* name, ChunkGroup* group, OccupancyGrid* scratch)
+{
+    size_t dense_bytes = group->memory_bytes();
+    int budget = edge_chunks * edge_chunks * edge_chunks;
+    auto start = std::chrono::steady_clock::now();
+    group->compress_chunks(0, &budget);
+    auto end = std::chrono::steady_clock::now();
+    double compress_ms = std::chrono::duration<double, std::milli>(end - start).count();
+    size_t compressed_bytes = group->memory_bytes();
+
+    std::vector<VoxelInstance> instances;
+    const int repetitions = 5;
+    start = std::chrono::steady_clock::now();
+    for (int i = 0; i < repetitions; ++i) {
+        make_voxel_instances(*group, scratch, &instances, VoxelLayout::face);
+    }
+    end = std::chrono::steady_clock::now();
+    double faces_ms = std::chrono::duration<double, std::milli>(end - start).count() / repetitions;
+
+    printf("%-8s %12zu %12zu %8.1fx %10.2f %10.2f\n", name,
+        dense_bytes / 1024, compressed_bytes / 1024,
+        double(dense_bytes) / double(compressed_bytes), compress_ms, faces_ms);
+}
+
+// Build the group's levels of detail, and report the face records of
+// each level, the build time, and the time to regenerate the levels
+// after a few scattered edits (which are undone after).
+static void bench_lod(const char* name, ChunkGroup* group, OccupancyGrid* scratch)
+{
+    std::vector<VoxelInstance> instances;
+    size_t records[max_lod_level + 1];
+    make_voxel_instances(*group, scratch, &instances, VoxelLayout::face);
+    records[0] = instances.size();
+
+    GroupLod lod(group->get_coord());
+    auto start = std::chrono::steady_clock::now();
+    lod.update(*group);
+    auto end = std::chrono::steady_clock::now();
+    double build_ms = std::chrono::duration<double, std::milli>(end - start).count();
+    for (int level = 1; level <= max_lod_level; ++level) {
+        make_voxel_instances(lod.get_level(level), scratch, &instances, VoxelLayout::face);
+        records[level] = instances.size();
+    }
+
+    srand(20000101);
+    const int edits = 100;
+    struct Edit { int x, y, z; Voxel old; };
+    std::vector<Edit> undo;
+    for (int i = 0; i < edits; ++i) {
+        int x = rand() % group_size, y = rand() % group_size, z = rand() % group_size;
+        undo.push_back(Edit{ x, y, z, group->get(x, y, z) });
+        group->set(x, y, z, Voxel::from_rgb(0xFF, 0, 0));
+        lod.mark_dirty(x, y, z);
+    }
+    start = std::chrono::steady_clock::now();
+    int chunks = lod.update(*group);
+    end = std::chrono::steady_clock::now();
+    double update_ms = std::chrono::duration<double, std::milli>(end - start).count();
+
+    for (auto it = undo.rbegin(); it != undo.rend(); ++it) group->set(it->x, it->y, it->z, it->old);
+
+    printf("%-8s %10zu %10zu %10zu %10.2f %10.2f %8i\n", name,
+        records[0], records[1], records[2], build_ms, update_ms, chunks);
+}
+
+// Churn a 64 MiB block like chunk group buffers do: fill it with
+// allocations of 4 KiB to 2 MiB (log-uniform, 256 byte aligned), then
+// repeatedly free a random one and allocate a new one. Reports the
+// time per operation, and the fill, rounding waste and fragmentation
+// the block settles at.
+static void bench_buddy()
+{
+    const uint64_t block_size = uint64_t(64) << 20;
+    BuddyAllocator allocator(block_size, 256);
+    std::vector<uint64_t> offsets;
+    srand(20000229);
+    auto random_size = [] () -> uint64_t
+    {
+        return uint64_t(4096 * pow(512.0, rand() / (RAND_MAX + 1.0)));
+    };
+
+    uint64_t offset;
+    while (allocator.allocate(random_size(), 256, &offset)) offsets.push_back(offset);
+
+    const int operations = 200000;
+    int failed = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < operations; ++i) {
+        size_t victim = rand() % offsets.size();
+        allocator.free(offsets[victim]);
+        offsets[victim] = offsets.back();
+        offsets.pop_back();
+        if (allocator.allocate(random_size(), 256, &offset)) offsets.push_back(offset);
+        else ++failed;
+        // Keep the block about as full as it started.
+        if (offsets.size() < 16) {
+            while (allocator.allocate(random_size(), 256, &offset)) offsets.push_back(offset);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count() / operations;
+
+    uint64_t free_bytes = block_size - allocator.get_used_bytes();
+    double fragmentation = free_bytes == 0 ? 0.0 : 1.0 - double(allocator.largest_free()) / free_bytes;
+    printf("%zu allocations %6.1f%% used %6.1f%% rounding waste %6.1f%% fragmented %6i failed %8.1f ns/op\n",
+        allocator.allocation_count(), 100.0 * allocator.get_used_bytes() / block_size,
+        100.0 - 100.0 * allocator.get_requested_bytes() / allocator.get_used_bytes(),
+        100.0 * fragmentation, failed, ns);
+}
+
+// Write a world of the scenes (one chunk group each) to a region
+// file, map it, and load each group back from it, checking that it
+// round-trips. Returns false if it doesn't (or the file can't be
+// written or mapped).
+static bool bench_region(const std::vector<std::unique_ptr<ChunkGroup>>& groups)
+{
+    const char filename[] = "spinny-bench.region";
+    VoxelWorld world;
+    int32_t scene_count = 0;
+    for (const auto& group : groups) {
+        for (int z = 0; z < group_size; ++z) {
+            for (int y = 0; y < group_size; ++y) {
+                for (int x = 0; x < group_size; ++x) {
+                    world.set(scene_count * group_size + x, y, z, group->get(x, y, z));
+                }
+            }
+        }
+        ++scene_count;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    if (!write_region(filename, world)) {
+        printf("Could not write %s: %s\n", filename, strerror(errno));
+        return false;
+    }
+    auto end = std::chrono::steady_clock::now();
+    printf("%-8s %10.2f ms\n", "write", std::chrono::duration<double, std::milli>(end - start).count());
+
+    RegionFile region;
+    if (!region.open(filename)) {
+        printf("Could not open %s: %s\n", filename, strerror(errno));
+        remove(filename);
+        return false;
+    }
+    bool all_same = true;
+    for (int32_t i = 0; i < scene_count; ++i) {
+        GroupCoord coord{ i, 0, 0 };
+        start = std::chrono::steady_clock::now();
+        std::unique_ptr<ChunkGroup> loaded = region.load_group(coord);
+        end = std::chrono::steady_clock::now();
+
+        const ChunkGroup* original = world.get_group(coord);
+        bool same = loaded != nullptr && original != nullptr;
+        for (int z = 0; same && z < group_size; ++z) {
+            for (int y = 0; same && y < group_size; ++y) {
+                for (int x = 0; same && x < group_size; ++x) {
+                    same = loaded->get(x, y, z) == original->get(x, y, z);
+                }
+            }
+        }
+        printf("%-8s %10.2f ms %s\n", scenes[i].name,
+            std::chrono::duration<double, std::milli>(end - start).count(),
+            same ? "" : "MISMATCH");
+        all_same &= same;
+    }
+    remove(filename);
+    return all_same;
+}
+
+int main()
+{
+    auto scratch = std::make_unique<OccupancyGrid>();
+    std::vector<VoxelInstance> instances;
+    GreedyMesh mesh;
+    const int repetitions = 5;
+
+    printf("Correctness checks\n");
+    bool ok = true;
+    ok &= check_face_bits(scratch.get());
+    ok &= check_update_voxel(scratch.get());
+    ok &= check_greedy(scratch.get());
+    ok &= check_raymarch();
+    ok &= check_compression();
+
+    std::vector<std::unique_ptr<ChunkGroup>> groups;
+    for (const Scene& scene : scenes) {
+        groups.push_back(std::make_unique<ChunkGroup>(GroupCoord{}));
+        scene.build(groups.back().get());
+    }
+
+    printf("\n%-8s %-6s %12s %12s %14s %10s\n",
+        "scene", "layout", "records", "triangles", "vs invocations", "ms");
+
+    for (size_t s = 0; s < groups.size(); ++s) {
+        const ChunkGroup& group = *groups[s];
+        const char* name = scenes[s].name;
+
+        for (VoxelLayout layout : { VoxelLayout::box, VoxelLayout::face }) {
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < repetitions; ++i) {
+                make_voxel_instances(group, scratch.get(), &instances, layout);
+            }
+            auto end = std::chrono::steady_clock::now();
+            double ms = std::chrono::duration<double, std::milli>(end - start).count() / repetitions;
+
+            uint64_t invocations = uint64_t(instances.size()) * vertices_per_record(layout);
+            printf("%-8s %-6s %12zu %12llu %14llu %10.2f\n",
+                name, layout == VoxelLayout::box ? "box" : "face",
+                instances.size(), (unsigned long long) invocations / 3,
+                (unsigned long long) invocations, ms);
+        }
+
+        // Indexed, so vertex invocations are somewhere between the
+        // vertex and index counts; report the index count.
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < repetitions; ++i) {
+            make_greedy_mesh(group, scratch.get(), &mesh);
+        }
+        auto end = std::chrono::steady_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(end - start).count() / repetitions;
+        printf("%-8s %-6s %12zu %12zu %14zu %10.2f\n",
+            name, "greedy", mesh.quad_count(), mesh.indices.size() / 3,
+            mesh.indices.size(), ms);
+    }
+
+    printf("\nCPU raymarcher, 640x360\n");
+    JobSystem raymarch_jobs;
+    for (size_t s = 0; s < groups.size(); ++s) {
+        bench_raymarch(scenes[s].name, *groups[s], &raymarch_jobs);
+    }
+
+    static_assert(max_lod_level == 2, "bench_lod prints levels 0 to 2");
+    printf("\nLevels of detail (face records per level)\n");
+    printf("%-8s %10s %10s %10s %10s %10s %8s\n",
+        "scene", "level 0", "level 1", "level 2", "build ms", "edit ms", "chunks");
+    for (size_t s = 0; s < groups.size(); ++s) {
+        bench_lod(scenes[s].name, groups[s].get(), scratch.get());
+    }
+
+    printf("\nFrustum culling\n");
+    bench_cull();
+
+    printf("\nOcclusion culling\n");
+    bench_occlusion(*groups[0]);
+
+    printf("\nJob system, %u hardware threads\n", std::thread::hardware_concurrency());
+    bench_jobs(groups);
+
+    printf("\nRegion file\n");
+    ok &= bench_region(groups);
+
+    // Last, since the later face generator runs would see compressed
+    // chunks.
+    printf("\nChunk compression\n");
+    printf("%-8s %12s %12s %9s %10s %10s\n",
+        "scene", "dense KiB", "packed KiB", "ratio", "ms", "face ms");
+    for (size_t s = 0; s < groups.size(); ++s) {
+        bench_compression(scenes[s].name, groups[s].get(), scratch.get());
+    }
+
+    printf("\nDevice memory suballocation\n");
+    bench_buddy();
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,74 @@
+#include "buddy.hh"
+
+#include <assert.h>
+#include <algorithm>
+
+namespace myricube {
+
+BuddyAllocator::BuddyAllocator(uint64_t size_, uint64_t min_size_) : size(size_), min_size(min_size_)
+{
+    assert(size != 0 && (size & (size - 1)) == 0);
+    assert(min_size != 0 && (min_size & (min_size - 1)) == 0 && min_size <= size);
+    max_order = 0;
+    while ((min_size << max_order) < size) ++max_order;
+    free_lists.resize(max_order + 1);
+    free_lists[max_order].insert(0);
+}
+
+bool BuddyAllocator::allocate(uint64_t bytes, uint64_t alignment, uint64_t* offset)
+{
+    assert(alignment != 0 && (alignment & (alignment - 1)) == 0);
+    uint64_t needed = std::max({ bytes, alignment, min_size });
+    if (needed > size) return false;
+    int order = 0;
+    while ((min_size << order) < needed) ++order;
+
+    // Take the lowest free sub-block of the smallest sufficient order,
+    // splitting it down to the order needed; the upper halves go free.
+    int from = order;
+    while (from <= max_order && free_lists[from].empty()) ++from;
+    if (from > max_order) return false;
+    uint64_t block = *free_lists[from].begin();
+    free_lists[from].erase(free_lists[from].begin());
+    while (from > order) {
+        --from;
+        free_lists[from].insert(block + (min_size << from));
+    }
+
+    allocated.emplace(block, Allocation{ order, bytes });
+    used_bytes += min_size << order;
+    requested_bytes += bytes;
+    *offset = block;
+    return true;
+}
+
+void BuddyAllocator::free(uint64_t offset)
+{
+    auto it = allocated.find(offset);
+    assert(it != allocated.end());
+    int order = it->second.order;
+    requested_bytes -= it->second.bytes;
+    used_bytes -= min_size << order;
+    allocated.erase(it);
+
+    // Merge with the buddy for as long as it is free too.
+    while (order < max_order) {
+        uint64_t buddy = offset ^ (min_size << order);
+        auto buddy_it = free_lists[order].find(buddy);
+        if (buddy_it == free_lists[order].end()) break;
+        free_lists[order].erase(buddy_it);
+        offset = std::min(offset, buddy);
+        ++order;
+    }
+    free_lists[order].insert(offset);
+}
+
+uint64_t BuddyAllocator::largest_free() const
+{
+    for (int order = max_order; order >= 0; --order) {
+        if (!free_lists[order].empty()) return min_size << order;
+    }
+    return 0;
+}
+
+} // end namespace
@@ -0,0 +1,85 @@
+// Buddy allocator of ranges within a block of memory, used to
+// suballocate large VkDeviceMemory blocks among many buffers and images
+// (see allocateMemory in render.cc). It only hands out offsets; it
+// never touches the memory itself. The block is a power of two bytes;
+// each allocation gets the smallest power-of-two sub-block (of at least
+// min_size bytes) that holds it, which is also aligned to its own size.
+// Freed sub-blocks merge with their free buddy, so the free space stays
+// in as few, as large, ranges as possible.
+#ifndef MYRICUBE_BUDDY_HH_
+#define MYRICUBE_BUDDY_HH_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+namespace myricube {
+
+class BuddyAllocator
+{
+    uint64_t size;
+    uint64_t min_size;
+    int max_order;
+
+    // Offsets of the free sub-blocks of min_size << order bytes.
+    std::vector<std::set<uint64_t>> free_lists;
+
+    // Order of each allocated sub-block and bytes requested, by offset.
+    struct Allocation
+    {
+        int order;
+        uint64_t bytes;
+    };
+    std::unordered_map<uint64_t, Allocation> allocated;
+
+    uint64_t used_bytes = 0;
+    uint64_t requested_bytes = 0;
+
+  public:
+    // size and min_size must be powers of two, min_size <= size.
+    BuddyAllocator(uint64_t size, uint64_t min_size);
+    BuddyAllocator(BuddyAllocator&&) = delete;
+
+    // Allocate bytes at an offset that is a multiple of alignment (a
+    // power of two). Returns false if no free sub-block is big enough.
+    bool allocate(uint64_t bytes, uint64_t alignment, uint64_t* offset);
+
+    // Free the allocation at the given offset.
+    void free(uint64_t offset);
+
+    uint64_t get_size() const
+    {
+        return size;
+    }
+
+    bool empty() const
+    {
+        return allocated.empty();
+    }
+
+    size_t allocation_count() const
+    {
+        return allocated.size();
+    }
+
+    // Bytes of the allocated sub-blocks, and of the allocations
+    // themselves (the difference is lost to rounding up).
+    uint64_t get_used_bytes() const
+    {
+        return used_bytes;
+    }
+
+    uint64_t get_requested_bytes() const
+    {
+        return requested_bytes;
+    }
+
+    // Size of the largest free sub-block (the largest allocation that
+    // would succeed), 0 if full.
+    uint64_t largest_free() const;
+};
+
+} // end namespace
+#endif /* !MYRICUBE_BUDDY_HH_ */
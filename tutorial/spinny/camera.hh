@@ -25,6 +25,10 @@ class Camera
     // Keep as int to avoid rounding errors in distance culling.
     int raycast_threshold = 120;
 
+    // Minimum distance from the camera of chunk groups drawn at level
+    // of detail 1 (see lod.hh); level 2 starts at twice this, and so on.
+    int lod_distance = 192;
+
     // Horizontal and vertical angle camera is pointed in.
     float theta = -1.5707f, phi = 1.5707f;
 
@@ -128,6 +132,16 @@ class Camera
         dirty = true;
     }
 
+    int get_lod_distance() const
+    {
+        return lod_distance;
+    }
+
+    void set_lod_distance(int in)
+    {
+        lod_distance = in;
+    }
+
     void set_eye(glm::dvec3 in)
     {
         assert(is_real(in));
@@ -0,0 +1,193 @@
+#include "chunk.hh"
+
+#include <string.h>
+
+namespace myricube {
+
+void Chunk::decode(Voxel* out) const
+{
+    switch (encoding) {
+      case ChunkEncoding::dense:
+        memcpy(out, &voxels[0][0][0], sizeof(Voxel) * chunk_voxels);
+        break;
+
+      case ChunkEncoding::palette:
+        if (index_bits == 0) {
+            std::fill(out, out + chunk_voxels, palette[0]);
+            break;
+        }
+        for (int i = 0; i < chunk_voxels; ++i) {
+            int bit = i * index_bits;
+            out[i] = palette[packed[bit / 32] >> (bit % 32) & ((1u << index_bits) - 1)];
+        }
+        break;
+
+      case ChunkEncoding::runs: {
+        uint32_t begin = 0;
+        for (uint32_t run : packed) {
+            std::fill(out + begin, out + (run >> 8), palette[run & 255]);
+            begin = run >> 8;
+        }
+        break;
+      }
+    }
+}
+
+bool Chunk::compress()
+{
+    if (encoding != ChunkEncoding::dense) return false;
+    const Voxel* src = &voxels[0][0][0];
+
+    // Palette index of each voxel. Palette entries are found through a
+    // small open-addressed hash table of (index + 1), 0 if free; most
+    // voxels match the one before them, so check that first.
+    uint8_t indices[chunk_voxels];
+    uint16_t slots[512] = {};
+    std::vector<Voxel> new_palette;
+    int runs = 0;
+    for (int i = 0; i < chunk_voxels; ++i) {
+        Voxel v = src[i];
+        if (i > 0 && v == src[i - 1]) {
+            indices[i] = indices[i - 1];
+            continue;
+        }
+        uint32_t h = v.packed_color * 0x9E3779B1u >> 23;
+        while (slots[h] != 0 && new_palette[slots[h] - 1] != v) h = (h + 1) & 511;
+        if (slots[h] == 0) {
+            if (new_palette.size() == 256) return false;
+            new_palette.push_back(v);
+            slots[h] = uint16_t(new_palette.size());
+        }
+        indices[i] = uint8_t(slots[h] - 1);
+        runs += i == 0 || indices[i] != indices[i - 1];
+    }
+
+    size_t n = new_palette.size();
+    int bits = n <= 1 ? 0 : n <= 2 ? 1 : n <= 4 ? 2 : n <= 16 ? 4 : 8;
+    int packed_words = chunk_voxels * bits / 32;
+
+    // Freshly sized, so no capacity is wasted.
+    std::vector<uint32_t> new_packed;
+    if (runs < packed_words) {
+        new_packed.reserve(runs);
+        for (int i = 1; i <= chunk_voxels; ++i) {
+            if (i < chunk_voxels && indices[i] == indices[i - 1]) continue;
+            new_packed.push_back(uint32_t(i) << 8 | indices[i - 1]);
+        }
+        encoding = ChunkEncoding::runs;
+        index_bits = 0;
+    }
+    else {
+        new_packed.resize(packed_words);
+        for (int i = 0; bits != 0 && i < chunk_voxels; ++i) {
+            int bit = i * bits;
+            new_packed[bit / 32] |= uint32_t(indices[i]) << (bit % 32);
+        }
+        encoding = ChunkEncoding::palette;
+        index_bits = uint8_t(bits);
+    }
+
+    palette.assign(new_palette.begin(), new_palette.end());
+    packed = std::move(new_packed);
+    voxels.reset();
+    return true;
+}
+
+void Chunk::decompress()
+{
+    if (encoding == ChunkEncoding::dense) return;
+    std::unique_ptr<Voxel[][chunk_size][chunk_size]> dense(new Voxel[chunk_size][chunk_size][chunk_size]);
+    decode(&dense[0][0][0]);
+    voxels = std::move(dense);
+    std::vector<Voxel>().swap(palette);
+    std::vector<uint32_t>().swap(packed);
+    encoding = ChunkEncoding::dense;
+    index_bits = 0;
+    idle_sweeps = 0;
+}
+
+size_t Chunk::memory_bytes() const
+{
+    size_t bytes = sizeof(Chunk);
+    if (voxels != nullptr) bytes += sizeof(Voxel) * chunk_voxels;
+    bytes += palette.capacity() * sizeof(Voxel);
+    bytes += packed.capacity() * sizeof(uint32_t);
+    return bytes;
+}
+
+int ChunkGroup::compress_chunks(int min_idle_sweeps, int* budget)
+{
+    int compressed = 0;
+    for (int cz = 0; cz < edge_chunks; ++cz) {
+        for (int cy = 0; cy < edge_chunks; ++cy) {
+            for (int cx = 0; cx < edge_chunks; ++cx) {
+                Chunk* chunk = chunks[cz][cy][cx].get();
+                if (chunk == nullptr || chunk->encoding != ChunkEncoding::dense) continue;
+                if (chunk->idle_sweeps < 255) ++chunk->idle_sweeps;
+                if (*budget <= 0 || chunk->idle_sweeps < min_idle_sweeps) continue;
+
+                // Too colorful chunks are retried only after another
+                // min_idle_sweeps.
+                --*budget;
+                if (!chunk->compress()) {
+                    chunk->idle_sweeps = 0;
+                    continue;
+                }
+                --dense_count;
+                ++compressed;
+            }
+        }
+    }
+    return compressed;
+}
+
+size_t ChunkGroup::memory_bytes() const
+{
+    size_t bytes = sizeof(ChunkGroup);
+    for (int cz = 0; cz < edge_chunks; ++cz) {
+        for (int cy = 0; cy < edge_chunks; ++cy) {
+            for (int cx = 0; cx < edge_chunks; ++cx) {
+                const Chunk* chunk = chunks[cz][cy][cx].get();
+                if (chunk != nullptr) bytes += chunk->memory_bytes();
+            }
+        }
+    }
+    return bytes;
+}
+
+VoxelWorld::GroupMap::iterator VoxelWorld::find_group(GroupCoord c) const
+{
+    auto it = group_map.find(c);
+    if (it != group_map.end() || region == nullptr) return it;
+
+    std::unique_ptr<ChunkGroup> group = load_region_group(region, c);
+    if (group == nullptr) return group_map.end();
+    return group_map.emplace(c, std::move(group)).first;
+}
+
+int VoxelWorld::compress_idle_chunks(int max_attempts)
+{
+    // Go round group_map from compress_cursor (or the beginning, if
+    // that group is gone), so groups late in its order aren't starved.
+    auto start = group_map.find(compress_cursor);
+    if (start == group_map.end()) start = group_map.begin();
+    if (start == group_map.end()) return 0;
+
+    int compressed = 0, budget = max_attempts;
+    bool exhausted = false;
+    auto it = start;
+    do {
+        ChunkGroup& group = *it->second;
+        if (group.get_dense_count() != 0) {
+            compressed += group.compress_chunks(chunk_idle_sweeps, &budget);
+            if (budget <= 0 && !exhausted) {
+                compress_cursor = it->first;
+                exhausted = true;
+            }
+        }
+        if (++it == group_map.end()) it = group_map.begin();
+    } while (it != start);
+    return compressed;
+}
+
+} // end namespace
@@ -0,0 +1,477 @@
+// Voxel world storage. The world is a sparse hash of chunk groups,
+// addressed by the high bits of world coordinates. Each chunk group
+// is 256x256x256 voxels, addressed by the 8-bit residue coordinates
+// that voxel.vert unpacks. A chunk group is itself subdivided into
+// chunks, which are only allocated when they contain a visible voxel,
+// and compressed while they aren't being edited. A world may be backed
+// by a region file on disk (see region.hh), from which chunk groups are
+// loaded on first access.
+#ifndef MYRICUBE_CHUNK_HH_
+#define MYRICUBE_CHUNK_HH_
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// Layout of VoxelVertex::packed_residue_face_bits and
+// VoxelVertex::packed_color. Keep in sync with voxel.vert.
+#define NEG_X_FACE_BIT (1 << 24)
+#define POS_X_FACE_BIT (1 << 25)
+#define NEG_Y_FACE_BIT (1 << 26)
+#define POS_Y_FACE_BIT (1 << 27)
+#define NEG_Z_FACE_BIT (1 << 28)
+#define POS_Z_FACE_BIT (1 << 29)
+
+// Face records (VoxelLayout::face) store the face index (0 to 5 for
+// -x, +x, -y, +y, -z, +z) here instead of the face bits.
+#define FACE_INDEX_SHIFT 24
+
+#define X_SHIFT 0
+#define Y_SHIFT 8
+#define Z_SHIFT 16
+
+#define RED_SHIFT 24
+#define GREEN_SHIFT 16
+#define BLUE_SHIFT 8
+
+namespace myricube {
+
+// Size of a chunk (in voxels) and of a chunk group (in chunks).
+constexpr int chunk_size = 16;
+constexpr int edge_chunks = 16;
+
+// Size of a chunk group in voxels. This must match the 8-bit residue
+// coordinates packed into VoxelVertex.
+constexpr int group_shift = 8;
+constexpr int group_size = chunk_size * edge_chunks;
+static_assert(group_size == 1 << group_shift, "residues must be 8 bits");
+static_assert(chunk_size == 16, "Chunk::row_bits is 16 bits wide");
+
+// A voxel is just its color, packed the same way as
+// VoxelVertex::packed_color (0xRRGGBB00) so that it can be copied
+// straight into an instance. The otherwise unused low bit marks the
+// voxel as visible (occupied); all-zero is empty space.
+struct Voxel
+{
+    static constexpr uint32_t visible_bit = 1;
+
+    uint32_t packed_color = 0;
+
+    Voxel() = default;
+
+    explicit Voxel(uint32_t packed_color_) : packed_color(packed_color_)
+    {
+
+    }
+
+    static Voxel from_rgb(uint8_t red, uint8_t green, uint8_t blue)
+    {
+        return Voxel(uint32_t(red) << RED_SHIFT
+                   | uint32_t(green) << GREEN_SHIFT
+                   | uint32_t(blue) << BLUE_SHIFT
+                   | visible_bit);
+    }
+
+    bool visible() const
+    {
+        return packed_color & visible_bit;
+    }
+
+    bool operator==(Voxel other) const
+    {
+        return packed_color == other.packed_color;
+    }
+
+    bool operator!=(Voxel other) const
+    {
+        return packed_color != other.packed_color;
+    }
+};
+
+constexpr int chunk_voxels = chunk_size * chunk_size * chunk_size;
+
+// Dense chunks not edited for this many calls of
+// VoxelWorld::compress_idle_chunks get compressed.
+constexpr int chunk_idle_sweeps = 60;
+
+// How a chunk stores its voxels. The compressed encodings index a
+// palette of the chunk's (up to 256) distinct voxels.
+enum class ChunkEncoding : uint8_t
+{
+    dense,      // Chunk::voxels.
+    palette,    // index_bits wide indices, packed into 32-bit words.
+    runs,       // Words of (end of run << 8 | index), in [z][y][x] order.
+};
+
+// 16x16x16 block of voxels, indexed [z][y][x] by the low 4 bits of the
+// residue coordinates. Dense while being edited, compressed when idle.
+struct Chunk
+{
+    // Dense voxels; null unless encoding is dense.
+    std::unique_ptr<Voxel[][chunk_size][chunk_size]> voxels;
+
+    // Compressed voxels; empty if encoding is dense.
+    std::vector<Voxel> palette;
+    std::vector<uint32_t> packed;
+
+    ChunkEncoding encoding = ChunkEncoding::dense;
+    uint8_t index_bits = 0;
+
+    // Calls of ChunkGroup::compress_chunks since the last edit.
+    uint8_t idle_sweeps = 0;
+
+    // Bit-packed copy of the visible bits, indexed [z][y]; bit x is set
+    // iff voxel (x, y, z) is visible. Used by the face generator.
+    uint16_t row_bits[chunk_size][chunk_size] = {};
+
+    // Number of visible voxels in this chunk.
+    int visible_count = 0;
+
+    Chunk() : voxels(new Voxel[chunk_size][chunk_size][chunk_size])
+    {
+
+    }
+
+    Chunk(Chunk&&) = delete;
+
+    Voxel get(int x, int y, int z) const
+    {
+        assert(unsigned(x) < chunk_size);
+        assert(unsigned(y) < chunk_size);
+        assert(unsigned(z) < chunk_size);
+        if (encoding == ChunkEncoding::dense) return voxels[z][y][x];
+
+        int i = (z * chunk_size + y) * chunk_size + x;
+        if (encoding == ChunkEncoding::palette) {
+            if (index_bits == 0) return palette[0];
+            int bit = i * index_bits;
+            return palette[packed[bit / 32] >> (bit % 32) & ((1u << index_bits) - 1)];
+        }
+        // The first run ending after i.
+        auto run = std::upper_bound(packed.begin(), packed.end(), uint32_t(i) << 8 | 255);
+        return palette[*run & 255];
+    }
+
+    // Set the voxel, keeping visible_count up-to-date.
+    void set(int x, int y, int z, Voxel v)
+    {
+        assert(unsigned(x) < chunk_size);
+        assert(unsigned(y) < chunk_size);
+        assert(unsigned(z) < chunk_size);
+        if (encoding != ChunkEncoding::dense) decompress();
+        idle_sweeps = 0;
+        Voxel& old = voxels[z][y][x];
+        visible_count += int(v.visible()) - int(old.visible());
+        old = v;
+        row_bits[z][y] = uint16_t((row_bits[z][y] & ~(1u << x)) | uint32_t(v.visible()) << x);
+    }
+
+    // Replace all voxels with a copy of the [z][y][x] array, and
+    // recompute row_bits and visible_count.
+    void assign(const Voxel* src)
+    {
+        if (encoding != ChunkEncoding::dense) decompress();
+        visible_count = 0;
+        for (int z = 0; z < chunk_size; ++z) {
+            for (int y = 0; y < chunk_size; ++y) {
+                uint32_t bits = 0;
+                for (int x = 0; x < chunk_size; ++x) {
+                    Voxel v = *src++;
+                    if (!v.visible()) v = Voxel{};
+                    voxels[z][y][x] = v;
+                    bits |= uint32_t(v.visible()) << x;
+                }
+                row_bits[z][y] = uint16_t(bits);
+                visible_count += __builtin_popcount(bits);
+            }
+        }
+    }
+
+    // Write all chunk_voxels voxels, in [z][y][x] order, to out.
+    void decode(Voxel* out) const;
+
+    // Switch to the smallest compressed encoding. Returns false (and
+    // stays dense) if the chunk is already compressed or has more than
+    // 256 distinct voxels.
+    bool compress();
+
+    // Switch back to the dense encoding.
+    void decompress();
+
+    // Bytes of memory used, including the Chunk itself.
+    size_t memory_bytes() const;
+};
+
+// Coordinate of a chunk group: world coordinate >> group_shift.
+struct GroupCoord
+{
+    int32_t x = 0, y = 0, z = 0;
+
+    bool operator==(GroupCoord other) const
+    {
+        return x == other.x && y == other.y && z == other.z;
+    }
+
+    bool operator!=(GroupCoord other) const
+    {
+        return !(*this == other);
+    }
+
+    static GroupCoord from_world(int32_t x, int32_t y, int32_t z)
+    {
+        // Arithmetic shift, so negative coordinates round down.
+        return GroupCoord{ x >> group_shift, y >> group_shift, z >> group_shift };
+    }
+};
+
+struct GroupCoordHash
+{
+    size_t operator()(GroupCoord c) const
+    {
+        uint64_t h = uint32_t(c.x);
+        h = h * 0x9E3779B97F4A7C15u ^ uint32_t(c.y);
+        h = h * 0x9E3779B97F4A7C15u ^ uint32_t(c.z);
+        return size_t(h ^ h >> 29);
+    }
+};
+
+// 256x256x256 voxels, stored as a fixed array of pointers to chunks
+// that are null when the chunk is empty. Voxels are addressed by
+// residue coordinates in [0, 255].
+class ChunkGroup
+{
+    GroupCoord coord;
+
+    std::unique_ptr<Chunk> chunks[edge_chunks][edge_chunks][edge_chunks];
+
+    // Total visible voxels in all chunks.
+    int64_t visible_count = 0;
+
+    // Number of chunks with the dense encoding.
+    int dense_count = 0;
+
+  public:
+    explicit ChunkGroup(GroupCoord coord_) : coord(coord_)
+    {
+
+    }
+
+    ChunkGroup(ChunkGroup&&) = delete;
+
+    GroupCoord get_coord() const
+    {
+        return coord;
+    }
+
+    bool empty() const
+    {
+        return visible_count == 0;
+    }
+
+    int64_t get_visible_count() const
+    {
+        return visible_count;
+    }
+
+    // Return the chunk with the given chunk coordinates [0, 15], or
+    // nullptr if it is empty.
+    const Chunk* get_chunk(int cx, int cy, int cz) const
+    {
+        assert(unsigned(cx) < edge_chunks);
+        assert(unsigned(cy) < edge_chunks);
+        assert(unsigned(cz) < edge_chunks);
+        return chunks[cz][cy][cx].get();
+    }
+
+    Voxel get(int x, int y, int z) const
+    {
+        assert(unsigned(x) < group_size);
+        assert(unsigned(y) < group_size);
+        assert(unsigned(z) < group_size);
+        const Chunk* chunk = chunks[z / chunk_size][y / chunk_size][x / chunk_size].get();
+        if (chunk == nullptr) return Voxel{};
+        return chunk->get(x % chunk_size, y % chunk_size, z % chunk_size);
+    }
+
+    // Set the voxel at the given residue coordinates. Allocates the
+    // chunk if needed, and frees it if it becomes empty. Returns true
+    // iff the stored voxel actually changed.
+    bool set(int x, int y, int z, Voxel v)
+    {
+        assert(unsigned(x) < group_size);
+        assert(unsigned(y) < group_size);
+        assert(unsigned(z) < group_size);
+        if (!v.visible()) v = Voxel{};
+        auto& chunk_ptr = chunks[z / chunk_size][y / chunk_size][x / chunk_size];
+        if (chunk_ptr == nullptr) {
+            if (!v.visible()) return false;
+            chunk_ptr.reset(new Chunk);
+            ++dense_count;
+        }
+
+        int old_count = chunk_ptr->visible_count;
+        if (chunk_ptr->get(x % chunk_size, y % chunk_size, z % chunk_size) == v) {
+            return false;
+        }
+        // Setting decompresses the chunk.
+        if (chunk_ptr->encoding != ChunkEncoding::dense) ++dense_count;
+        chunk_ptr->set(x % chunk_size, y % chunk_size, z % chunk_size, v);
+        visible_count += chunk_ptr->visible_count - old_count;
+
+        if (chunk_ptr->visible_count == 0) {
+            chunk_ptr.reset();
+            --dense_count;
+        }
+        return true;
+    }
+
+    // Replace the chunk with the given chunk coordinates (which may be
+    // null, or empty, to clear it).
+    void set_chunk(int cx, int cy, int cz, std::unique_ptr<Chunk> chunk)
+    {
+        assert(unsigned(cx) < edge_chunks);
+        assert(unsigned(cy) < edge_chunks);
+        assert(unsigned(cz) < edge_chunks);
+        auto& chunk_ptr = chunks[cz][cy][cx];
+        if (chunk_ptr != nullptr) {
+            visible_count -= chunk_ptr->visible_count;
+            dense_count -= chunk_ptr->encoding == ChunkEncoding::dense;
+        }
+        if (chunk != nullptr && chunk->visible_count == 0) chunk.reset();
+        if (chunk != nullptr) {
+            visible_count += chunk->visible_count;
+            dense_count += chunk->encoding == ChunkEncoding::dense;
+        }
+        chunk_ptr = std::move(chunk);
+    }
+
+    int get_dense_count() const
+    {
+        return dense_count;
+    }
+
+    // Count one more sweep for every dense chunk since its last edit,
+    // and try to compress those idle for at least min_idle_sweeps,
+    // taking one from *budget per attempt (failed ones included) and
+    // stopping at zero. Returns the number of chunks compressed.
+    int compress_chunks(int min_idle_sweeps, int* budget);
+
+    // Bytes of memory used by the chunks.
+    size_t memory_bytes() const;
+};
+
+class RegionFile;
+
+// Sparse world of chunk groups. Voxels are addressed by (signed)
+// world coordinates; groups containing no visible voxels are not stored.
+//
+// With a region file, the groups stored in it are loaded into memory
+// on first access (get_group, get, set), and edits only change the
+// loaded copy. Groups emptied by edits are then kept (empty), so that
+// stored ones aren't loaded again.
+class VoxelWorld
+{
+  public:
+    using GroupMap = std::unordered_map<GroupCoord, std::unique_ptr<ChunkGroup>, GroupCoordHash>;
+
+  private:
+    // Loaded on demand, hence mutable.
+    mutable GroupMap group_map;
+    const RegionFile* region = nullptr;
+
+    // RegionFile::load_group, reached through this pointer (set by
+    // set_region) so that chunk.o links without region.o.
+    std::unique_ptr<ChunkGroup> (*load_region_group)(const RegionFile*, GroupCoord) = nullptr;
+
+    // Find the group in group_map, loading it from the region file
+    // first if it is stored there.
+    GroupMap::iterator find_group(GroupCoord c) const;
+
+    // Group that compress_idle_chunks starts at.
+    GroupCoord compress_cursor;
+
+  public:
+    VoxelWorld() = default;
+    VoxelWorld(VoxelWorld&&) = delete;
+
+    // Back the world with the region file, which must outlive it
+    // (defined in region.cc).
+    void set_region(const RegionFile* region_);
+
+    const RegionFile* get_region() const
+    {
+        return region;
+    }
+
+    // The chunk groups in memory (with a region file, only those
+    // accessed so far; some may be empty).
+    const GroupMap& get_groups() const
+    {
+        return group_map;
+    }
+
+    // Return the chunk group with the given group coordinate, or
+    // nullptr if it is empty.
+    const ChunkGroup* get_group(GroupCoord c) const
+    {
+        auto it = find_group(c);
+        return it == group_map.end() || it->second->empty() ? nullptr : it->second.get();
+    }
+
+    // Add a chunk group of the region file loaded elsewhere (with
+    // RegionFile::load_group, which unlike get_group is safe to call
+    // from any thread), unless it is in memory already. Returns the
+    // group in memory, or nullptr if it is empty.
+    const ChunkGroup* add_loaded_group(std::unique_ptr<ChunkGroup> group)
+    {
+        GroupCoord c = group->get_coord();
+        auto it = group_map.find(c);
+        if (it == group_map.end()) it = group_map.emplace(c, std::move(group)).first;
+        return it->second->empty() ? nullptr : it->second.get();
+    }
+
+    Voxel get(int32_t x, int32_t y, int32_t z) const
+    {
+        const ChunkGroup* group = get_group(GroupCoord::from_world(x, y, z));
+        if (group == nullptr) return Voxel{};
+        return group->get(x & (group_size-1), y & (group_size-1), z & (group_size-1));
+    }
+
+    // Set the voxel at the given world coordinate; returns true iff
+    // it changed.
+    bool set(int32_t x, int32_t y, int32_t z, Voxel v)
+    {
+        GroupCoord c = GroupCoord::from_world(x, y, z);
+        auto it = find_group(c);
+        if (it == group_map.end()) {
+            if (!v.visible()) return false;
+            it = group_map.emplace(c, std::make_unique<ChunkGroup>(c)).first;
+        }
+        ChunkGroup& group = *it->second;
+        bool changed = group.set(x & (group_size-1), y & (group_size-1), z & (group_size-1), v);
+        if (group.empty() && region == nullptr) group_map.erase(it);
+        return changed;
+    }
+
+    // Make up to max_attempts attempts, across all groups, to compress
+    // chunks not edited for chunk_idle_sweeps calls (so call this
+    // regularly, e.g. once per frame). Each call resumes at the group
+    // where the previous one ran out of attempts. Returns the number
+    // of chunks compressed.
+    int compress_idle_chunks(int max_attempts);
+
+    // Bytes of memory used by the chunk groups in memory.
+    size_t memory_bytes() const
+    {
+        size_t bytes = 0;
+        for (const auto& pair : group_map) bytes += pair.second->memory_bytes();
+        return bytes;
+    }
+};
+
+} // end namespace
+#endif /* !MYRICUBE_CHUNK_HH_ */
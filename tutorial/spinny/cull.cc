@@ -0,0 +1,154 @@
+#include "cull.hh"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MYRICUBE_X86 1
+#endif
+
+namespace myricube {
+
+void CullBoxes::rebase(glm::dvec3 new_origin)
+{
+    const glm::dvec3 offset = origin - new_origin;
+    for (size_t i = 0; i < size(); ++i) {
+        min_x[i] = float(min_x[i] + offset.x);
+        min_y[i] = float(min_y[i] + offset.y);
+        min_z[i] = float(min_z[i] + offset.z);
+        max_x[i] = float(max_x[i] + offset.x);
+        max_y[i] = float(max_y[i] + offset.y);
+        max_z[i] = float(max_z[i] + offset.z);
+    }
+    origin = new_origin;
+}
+
+CullFrustum make_cull_frustum(const glm::mat4& projection, const glm::mat4& view, glm::dvec3 eye, float far_plane)
+{
+    CullFrustum frustum;
+    frustum.eye = eye;
+    frustum.far_squared = far_plane * far_plane;
+
+    // Gribb-Hartmann plane extraction from the rows of the eye-relative
+    // view-projection (the view without its translation). With 0-to-1
+    // depth, the near plane is z >= 0 rather than z >= -w.
+    const glm::mat4 vp = projection * glm::mat4(glm::mat3(view));
+    auto row = [&vp] (int i)
+    {
+        return glm::dvec4(vp[0][i], vp[1][i], vp[2][i], vp[3][i]);
+    };
+    const glm::dvec4 planes[6] = {
+        row(3) + row(0), row(3) - row(0),
+        row(3) + row(1), row(3) - row(1),
+        row(2), row(3) - row(2),
+    };
+    for (int i = 0; i < 6; ++i) {
+        const glm::dvec4& p = planes[i];
+        frustum.planes[i][0] = float(p.x);
+        frustum.planes[i][1] = float(p.y);
+        frustum.planes[i][2] = float(p.z);
+        frustum.planes[i][3] = float(p.w);
+    }
+    return frustum;
+}
+
+// eye is relative to the boxes' origin.
+static inline bool box_visible(const CullBoxes& boxes, const CullFrustum& frustum, glm::vec3 eye, size_t i)
+{
+    const float lo[3] = {
+        boxes.min_x[i] - eye.x, boxes.min_y[i] - eye.y, boxes.min_z[i] - eye.z };
+    const float hi[3] = {
+        boxes.max_x[i] - eye.x, boxes.max_y[i] - eye.y, boxes.max_z[i] - eye.z };
+
+    // Distance from the eye to the nearest point of the box.
+    float distance_squared = 0;
+    for (int a = 0; a < 3; ++a) {
+        float d = lo[a] > 0 ? lo[a] : hi[a] < 0 ? -hi[a] : 0.0f;
+        distance_squared += d * d;
+    }
+    if (distance_squared > frustum.far_squared) return false;
+
+    // Outside if the corner furthest along the plane normal is outside.
+    for (const auto& p : frustum.planes) {
+        float x = p[0] > 0 ? hi[0] : lo[0];
+        float y = p[1] > 0 ? hi[1] : lo[1];
+        float z = p[2] > 0 ? hi[2] : lo[2];
+        if (p[0] * x + p[1] * y + p[2] * z + p[3] < 0) return false;
+    }
+    return true;
+}
+
+#ifdef MYRICUBE_X86
+// AVX version: the same tests on 8 boxes at a time. Returns the end
+// of the boxes handled (a multiple of 8 after begin).
+__attribute__((target("avx")))
+static size_t cull_boxes_avx(const CullBoxes& boxes, const CullFrustum& frustum, glm::vec3 eye, size_t begin, size_t end, std::vector<uint32_t>* visible)
+{
+    const size_t count = begin + ((end - begin) & ~size_t(7));
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 eye_x = _mm256_set1_ps(eye.x);
+    const __m256 eye_y = _mm256_set1_ps(eye.y);
+    const __m256 eye_z = _mm256_set1_ps(eye.z);
+    const __m256 far_squared = _mm256_set1_ps(frustum.far_squared);
+
+    for (size_t i = begin; i < count; i += 8) {
+        const __m256 lo[3] = {
+            _mm256_sub_ps(_mm256_loadu_ps(&boxes.min_x[i]), eye_x),
+            _mm256_sub_ps(_mm256_loadu_ps(&boxes.min_y[i]), eye_y),
+            _mm256_sub_ps(_mm256_loadu_ps(&boxes.min_z[i]), eye_z) };
+        const __m256 hi[3] = {
+            _mm256_sub_ps(_mm256_loadu_ps(&boxes.max_x[i]), eye_x),
+            _mm256_sub_ps(_mm256_loadu_ps(&boxes.max_y[i]), eye_y),
+            _mm256_sub_ps(_mm256_loadu_ps(&boxes.max_z[i]), eye_z) };
+
+        // max(lo, -hi, 0) is the per-axis distance to the box.
+        __m256 distance_squared = zero;
+        for (int a = 0; a < 3; ++a) {
+            __m256 d = _mm256_max_ps(_mm256_max_ps(lo[a], _mm256_sub_ps(zero, hi[a])), zero);
+            distance_squared = _mm256_add_ps(distance_squared, _mm256_mul_ps(d, d));
+        }
+        __m256 inside = _mm256_cmp_ps(distance_squared, far_squared, _CMP_LE_OQ);
+
+        // The corner choice depends only on the plane, not the box.
+        for (const auto& p : frustum.planes) {
+            __m256 x = p[0] > 0 ? hi[0] : lo[0];
+            __m256 y = p[1] > 0 ? hi[1] : lo[1];
+            __m256 z = p[2] > 0 ? hi[2] : lo[2];
+            __m256 dot = _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(x, _mm256_set1_ps(p[0])), _mm256_mul_ps(y, _mm256_set1_ps(p[1]))),
+                _mm256_add_ps(_mm256_mul_ps(z, _mm256_set1_ps(p[2])), _mm256_set1_ps(p[3])));
+            inside = _mm256_and_ps(inside, _mm256_cmp_ps(dot, zero, _CMP_GE_OQ));
+        }
+
+        for (int bits = _mm256_movemask_ps(inside); bits != 0; bits &= bits - 1) {
+            visible->push_back(uint32_t(i + __builtin_ctz(bits)));
+        }
+    }
+    return count;
+}
+
+static bool cpu_has_avx()
+{
+    static const bool result = __builtin_cpu_supports("avx");
+    return result;
+}
+#endif
+
+void cull_boxes(const CullBoxes& boxes, const CullFrustum& frustum, std::vector<uint32_t>* visible)
+{
+    cull_boxes(boxes, frustum, 0, boxes.size(), visible);
+}
+
+void cull_boxes(const CullBoxes& boxes, const CullFrustum& frustum, size_t begin, size_t end, std::vector<uint32_t>* visible)
+{
+    visible->clear();
+    size_t i = begin;
+    const glm::vec3 eye = glm::vec3(frustum.eye - boxes.origin);
+
+#ifdef MYRICUBE_X86
+    if (cpu_has_avx()) i = cull_boxes_avx(boxes, frustum, eye, begin, end, visible);
+#endif
+    for (; i < end; ++i) {
+        if (box_visible(boxes, frustum, eye, i)) visible->push_back(uint32_t(i));
+    }
+}
+
+} // end namespace
@@ -0,0 +1,99 @@
+// Frustum and far-plane culling of chunk group bounding boxes. Boxes
+// are kept in structure-of-arrays form so that 8 of them (AVX, when
+// the CPU has it) are tested against each plane at once.
+#ifndef MYRICUBE_CULL_HH_
+#define MYRICUBE_CULL_HH_
+
+#include <stdint.h>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+namespace myricube {
+
+// Axis-aligned boxes, one per array element, stored relative to
+// origin. The owner keeps origin near the eye (see rebase), so that
+// nearby boxes keep their precision however far from the world's
+// origin they are.
+struct CullBoxes
+{
+    glm::dvec3 origin = glm::dvec3(0);
+    std::vector<float> min_x, min_y, min_z;
+    std::vector<float> max_x, max_y, max_z;
+
+    size_t size() const
+    {
+        return min_x.size();
+    }
+
+    void clear()
+    {
+        min_x.clear(); min_y.clear(); min_z.clear();
+        max_x.clear(); max_y.clear(); max_z.clear();
+    }
+
+    // Add the box with the given world coordinates.
+    void push_back(glm::dvec3 lo, glm::dvec3 hi)
+    {
+        lo -= origin;
+        hi -= origin;
+        min_x.push_back(float(lo.x)); min_y.push_back(float(lo.y)); min_z.push_back(float(lo.z));
+        max_x.push_back(float(hi.x)); max_y.push_back(float(hi.y)); max_z.push_back(float(hi.z));
+    }
+
+    // Remove box i, moving the last box into its place.
+    void remove(size_t i)
+    {
+        min_x[i] = min_x.back(); min_x.pop_back();
+        min_y[i] = min_y.back(); min_y.pop_back();
+        min_z[i] = min_z.back(); min_z.pop_back();
+        max_x[i] = max_x.back(); max_x.pop_back();
+        max_y[i] = max_y.back(); max_y.pop_back();
+        max_z[i] = max_z.back(); max_z.pop_back();
+    }
+
+    // World coordinates of box i.
+    glm::dvec3 get_min(size_t i) const
+    {
+        return origin + glm::dvec3(min_x[i], min_y[i], min_z[i]);
+    }
+
+    glm::dvec3 get_max(size_t i) const
+    {
+        return origin + glm::dvec3(max_x[i], max_y[i], max_z[i]);
+    }
+
+    // Move origin, keeping the boxes where they are. Boxes and origins
+    // on a whole number grid (such as chunk group boxes) stay exact.
+    void rebase(glm::dvec3 new_origin);
+};
+
+// Culling volume: the six planes of a camera's projection and view
+// (0-to-1 depth), and a sphere of radius far_plane around the eye.
+// The planes are taken from the view's rotation only, so they are
+// eye-relative without an eye-sized translation to lose precision in.
+struct CullFrustum
+{
+    glm::dvec3 eye;
+
+    // a, b, c, d of a*x + b*y + c*z + d >= 0 for points (relative to
+    // eye) inside. Left, right, bottom, top, near, far.
+    float planes[6][4];
+
+    float far_squared;
+};
+
+CullFrustum make_cull_frustum(const glm::mat4& projection, const glm::mat4& view, glm::dvec3 eye, float far_plane);
+
+// Replace *visible with the (increasing) indices of the boxes that are
+// not entirely outside one of the frustum's planes or beyond its far
+// distance. Conservative: a few boxes near the frustum corners are
+// kept though not visible.
+void cull_boxes(const CullBoxes& boxes, const CullFrustum& frustum, std::vector<uint32_t>* visible);
+
+// Same, for the boxes [begin, end) only, so that ranges of boxes can
+// be culled in parallel.
+void cull_boxes(const CullBoxes& boxes, const CullFrustum& frustum, size_t begin, size_t end, std::vector<uint32_t>* visible);
+
+} // end namespace
+#endif /* !MYRICUBE_CULL_HH_ */
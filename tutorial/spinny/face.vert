@@ -0,0 +1,153 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#ifdef INDIRECT
+#extension GL_ARB_shader_draw_parameters : require
+#extension GL_EXT_buffer_reference : require
+#extension GL_EXT_buffer_reference_uvec2 : require
+#endif
+
+#define FACE_INDEX_SHIFT 24
+
+#define X_SHIFT 0
+#define Y_SHIFT 8
+#define Z_SHIFT 16
+
+#define RED_SHIFT 24
+#define GREEN_SHIFT 16
+#define BLUE_SHIFT 8
+
+#define GROUP_SIZE 256
+
+// Camera of the frame (CameraUniform in render.cc), shared by all the
+// chunk groups' draws, which are recorded once and reused.
+layout(set=0, binding=0) uniform CameraBlock {
+    mat4 view_projection;   // Eye-relative (the view without translation).
+    ivec4 eye_group;        // Chunk group the eye is in,
+    vec4 eye_residue;       // and the eye's position within it.
+} camera;
+
+// Eye-relative position of a point in residue coordinates of the level
+// of detail the group (coordinate, and level in w) is drawn at.
+vec3 eye_relative(ivec4 group, vec3 residue) {
+    return vec3(group.xyz - camera.eye_group.xyz) * GROUP_SIZE
+         + residue * float(1 << group.w) - camera.eye_residue.xyz;
+}
+
+#ifdef INDIRECT
+// GPU culled variant (face-indirect.vert.spv): drawn by one
+// vkCmdDrawIndirectCount, with the draws written by cull.comp. Each
+// draw holds the chunk group's coordinate and level of detail, and the
+// address of its instance buffer, which the instances are read from.
+struct GpuDraw {
+    uint vertex_count;
+    uint instance_count;
+    uint first_vertex;
+    uint first_instance;
+    ivec4 group;
+    uvec2 instance_address;
+    uvec2 padding;
+};
+
+layout(set=1, binding=1, std430) readonly buffer DrawBuffer {
+    GpuDraw draws[];
+};
+
+// (packed_residue_face, packed_color) pairs, as below.
+layout(buffer_reference, std430, buffer_reference_align=8) readonly buffer InstanceBuffer {
+    uvec2 instances[];
+};
+#else
+layout(push_constant) uniform GroupPushConstantBlock {
+    ivec4 group;            // Chunk group coordinate; w is its level of detail.
+} push;
+
+// Instanced inputs (one per visible face, see VoxelLayout::face):
+// Residue coordinates and index of the face (-x, +x, -y, +y, -z, +z).
+layout(location=0) in uint packed_residue_face;
+// Color of the voxel
+layout(location=1) in uint packed_color;
+#endif
+
+layout(location=0) out vec3 v_color;
+layout(location=1) out vec3 v_residue_coord;
+layout(location=2) out vec2 v_uv;
+
+// Non-instanced inputs: the 6 faces of the unit box, same as in
+// voxel.vert. Draw as triangles with 6 vertices per instance; the
+// face index selects which 6 entries of the arrays to use.
+vec3 unit_box_verts[36] = vec3[] (
+    vec3(0, 1, 1),    vec3(0, 1, 0),    vec3(0, 0, 1),
+    vec3(0, 1, 0),    vec3(0, 0, 0),    vec3(0, 0, 1), // -x face
+
+    vec3(1, 0, 0),    vec3(1, 1, 0),    vec3(1, 0, 1),
+    vec3(1, 1, 0),    vec3(1, 1, 1),    vec3(1, 0, 1), // +x face
+
+    vec3(0, 0, 0),    vec3(1, 0, 1),    vec3(0, 0, 1),
+    vec3(0, 0, 0),    vec3(1, 0, 0),    vec3(1, 0, 1), // -y face
+
+    vec3(1, 1, 1),    vec3(1, 1, 0),    vec3(0, 1, 0),
+    vec3(0, 1, 1),    vec3(1, 1, 1),    vec3(0, 1, 0), // +y face
+
+    vec3(0, 0, 0),    vec3(0, 1, 0),    vec3(1, 0, 0),
+    vec3(1, 1, 0),    vec3(1, 0, 0),    vec3(0, 1, 0), // -z face
+
+    vec3(0, 1, 1),    vec3(1, 0, 1),    vec3(1, 1, 1),
+    vec3(1, 0, 1),    vec3(0, 1, 1),    vec3(0, 0, 1));// +z face
+
+// Texture coordinate (for now, just used for the color border).
+vec2 uv_array[36] = vec2[] (
+    vec2(1, 1),    vec2(1, 0),    vec2(0, 1),
+    vec2(1, 0),    vec2(0, 0),    vec2(0, 1), // -x face
+
+    vec2(0, 0),    vec2(1, 0),    vec2(0, 1),
+    vec2(1, 0),    vec2(1, 1),    vec2(0, 1), // +x face
+
+    vec2(0, 0),    vec2(1, 1),    vec2(0, 1),
+    vec2(0, 0),    vec2(1, 0),    vec2(1, 1), // -y face
+
+    vec2(1, 1),    vec2(1, 0),    vec2(0, 0),
+    vec2(0, 1),    vec2(1, 1),    vec2(0, 0), // +y face
+
+    vec2(0, 0),    vec2(0, 1),    vec2(1, 0),
+    vec2(1, 1),    vec2(1, 0),    vec2(0, 1), // -z face
+
+    vec2(0, 1),    vec2(1, 0),    vec2(1, 1),
+    vec2(1, 0),    vec2(0, 1),    vec2(0, 0));// +z face
+
+void main() {
+#ifdef INDIRECT
+    GpuDraw draw = draws[gl_DrawIDARB];
+    uvec2 instance = InstanceBuffer(draw.instance_address).instances[gl_InstanceIndex];
+    uint packed_residue_face = instance.x;
+    uint packed_color = instance.y;
+#endif
+
+    int face_index = int((packed_residue_face >> FACE_INDEX_SHIFT) & 7);
+    int index = face_index * 6 + gl_VertexIndex;
+
+    // Position the face's vertex in the correct location.
+    vec3 unit_box_vertex = unit_box_verts[index];
+    float x = float((packed_residue_face >> X_SHIFT) & 255)
+            + unit_box_vertex.x;
+    float y = float((packed_residue_face >> Y_SHIFT) & 255)
+            + unit_box_vertex.y;
+    float z = float((packed_residue_face >> Z_SHIFT) & 255)
+            + unit_box_vertex.z;
+    vec4 model_space_position = vec4(x, y, z, 1);
+    v_residue_coord = model_space_position.xyz;
+
+    // Perspective transformation, relative to the eye.
+#ifdef INDIRECT
+    gl_Position = camera.view_projection * vec4(eye_relative(draw.group, model_space_position.xyz), 1);
+#else
+    gl_Position = camera.view_projection * vec4(eye_relative(push.group, model_space_position.xyz), 1);
+#endif
+
+    // Unpack the color.
+    float red   = ((packed_color >> RED_SHIFT) & 255) * (1./255.);
+    float green = ((packed_color >> GREEN_SHIFT) & 255) * (1./255.);
+    float blue  = ((packed_color >> BLUE_SHIFT) & 255) * (1./255.);
+    v_color = vec3(red, green, blue);
+
+    v_uv = uv_array[index];
+}
@@ -0,0 +1,339 @@
+#include "faces.hh"
+
+#include <algorithm>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MYRICUBE_X86 1
+#endif
+
+namespace myricube {
+
+// Face i (in the order -x, +x, -y, +y, -z, +z) has face bit 1 << (24 + i).
+static_assert(NEG_X_FACE_BIT == 1 << 24 && POS_X_FACE_BIT == 1 << 25
+           && NEG_Y_FACE_BIT == 1 << 26 && POS_Y_FACE_BIT == 1 << 27
+           && NEG_Z_FACE_BIT == 1 << 28 && POS_Z_FACE_BIT == 1 << 29,
+              "face bits must be consecutive");
+
+void OccupancyGrid::fill(const ChunkGroup& group)
+{
+    memset(columns, 0, sizeof columns);
+
+    constexpr int chunks_per_word = 64 / chunk_size;
+    for (int cz = 0; cz < edge_chunks; ++cz) {
+        for (int cy = 0; cy < edge_chunks; ++cy) {
+            for (int cx = 0; cx < edge_chunks; ++cx) {
+                const Chunk* chunk = group.get_chunk(cx, cy, cz);
+                if (chunk == nullptr) continue;
+
+                int word = cx / chunks_per_word;
+                int shift = (cx % chunks_per_word) * chunk_size;
+                for (int z = 0; z < chunk_size; ++z) {
+                    for (int y = 0; y < chunk_size; ++y) {
+                        columns[cz*chunk_size + z][cy*chunk_size + y][word]
+                            |= uint64_t(chunk->row_bits[z][y]) << shift;
+                    }
+                }
+            }
+        }
+    }
+}
+
+uint32_t voxel_face_bits(const ChunkGroup& group, int x, int y, int z)
+{
+    if (!group.get(x, y, z).visible()) return 0;
+
+    auto visible_at = [&group] (int x, int y, int z) -> bool
+    {
+        if (unsigned(x) >= group_size) return false;
+        if (unsigned(y) >= group_size) return false;
+        if (unsigned(z) >= group_size) return false;
+        return group.get(x, y, z).visible();
+    };
+
+    uint32_t face_bits = 0;
+    if (!visible_at(x-1, y, z)) face_bits |= NEG_X_FACE_BIT;
+    if (!visible_at(x+1, y, z)) face_bits |= POS_X_FACE_BIT;
+    if (!visible_at(x, y-1, z)) face_bits |= NEG_Y_FACE_BIT;
+    if (!visible_at(x, y+1, z)) face_bits |= POS_Y_FACE_BIT;
+    if (!visible_at(x, y, z-1)) face_bits |= NEG_Z_FACE_BIT;
+    if (!visible_at(x, y, z+1)) face_bits |= POS_Z_FACE_BIT;
+    return face_bits;
+}
+
+// Exposed-face masks of one column, indexed [face][word] with faces
+// in face bit order.
+using ColumnMasks = uint64_t[6][column_words];
+
+alignas(32) static const uint64_t empty_column[column_words] = { };
+
+// Emit an instance for every set bit of the union of the column's
+// face masks (or a face record for every set bit of each mask).
+static inline void emit_column(
+    const ChunkGroup& group, int y, int z,
+    const ColumnMasks& masks,
+    std::vector<VoxelInstance>* out,
+    VoxelLayout layout)
+{
+    uint32_t residue = uint32_t(y) << Y_SHIFT | uint32_t(z) << Z_SHIFT;
+    for (int w = 0; w < column_words; ++w) {
+        uint64_t any = masks[0][w] | masks[1][w] | masks[2][w]
+                     | masks[3][w] | masks[4][w] | masks[5][w];
+        while (any != 0) {
+            int b = __builtin_ctzll(any);
+            any &= any - 1;
+
+            int x = w * 64 + b;
+            uint32_t packed_color = group.get(x, y, z).packed_color;
+            uint32_t packed_residue = residue | uint32_t(x) << X_SHIFT;
+
+            if (layout == VoxelLayout::face) {
+                for (uint32_t i = 0; i < 6; ++i) {
+                    if ((masks[i][w] >> b) & 1) {
+                        out->push_back({
+                            packed_residue | i << FACE_INDEX_SHIFT, packed_color });
+                    }
+                }
+                continue;
+            }
+
+            uint32_t face_bits = 0;
+            for (int i = 0; i < 6; ++i) {
+                face_bits |= uint32_t((masks[i][w] >> b) & 1) << (24 + i);
+            }
+            out->push_back({ packed_residue | face_bits, packed_color });
+        }
+    }
+}
+
+static inline bool column_empty(const uint64_t* c)
+{
+    return (c[0] | c[1] | c[2] | c[3]) == 0;
+}
+static_assert(column_words == 4, "column_empty assumes 4 words");
+
+// Portable version: 64-bit shifts with the carry passed between words.
+static void make_instances_scalar(
+    const ChunkGroup& group,
+    const OccupancyGrid& grid,
+    std::vector<VoxelInstance>* out,
+    VoxelLayout layout)
+{
+    ColumnMasks masks;
+    for (int z = 0; z < group_size; ++z) {
+        for (int y = 0; y < group_size; ++y) {
+            const uint64_t* c = grid.columns[z][y];
+            if (column_empty(c)) continue;
+
+            const uint64_t* ny = y > 0 ? grid.columns[z][y-1] : empty_column;
+            const uint64_t* py = y < group_size-1 ? grid.columns[z][y+1] : empty_column;
+            const uint64_t* nz = z > 0 ? grid.columns[z-1][y] : empty_column;
+            const uint64_t* pz = z < group_size-1 ? grid.columns[z+1][y] : empty_column;
+
+            for (int w = 0; w < column_words; ++w) {
+                uint64_t carry_in = w > 0 ? c[w-1] >> 63 : 0;
+                uint64_t carry_out = w < column_words-1 ? c[w+1] << 63 : 0;
+                masks[0][w] = c[w] & ~(c[w] << 1 | carry_in);
+                masks[1][w] = c[w] & ~(c[w] >> 1 | carry_out);
+                masks[2][w] = c[w] & ~ny[w];
+                masks[3][w] = c[w] & ~py[w];
+                masks[4][w] = c[w] & ~nz[w];
+                masks[5][w] = c[w] & ~pz[w];
+            }
+            emit_column(group, y, z, masks, out, layout);
+        }
+    }
+}
+
+#ifdef MYRICUBE_X86
+__attribute__((target("avx2")))
+static inline __m256i load_column(const uint64_t* p)
+{
+    return _mm256_load_si256(reinterpret_cast<const __m256i*>(p));
+}
+
+__attribute__((target("avx2")))
+static inline void store_column(uint64_t* p, __m256i v)
+{
+    _mm256_store_si256(reinterpret_cast<__m256i*>(p), v);
+}
+
+// AVX2 version: a whole 256-voxel column is one register. The x
+// shifts move the carry between 64-bit lanes with a lane permute.
+__attribute__((target("avx2")))
+static void make_instances_avx2(
+    const ChunkGroup& group,
+    const OccupancyGrid& grid,
+    std::vector<VoxelInstance>* out,
+    VoxelLayout layout)
+{
+    alignas(32) ColumnMasks masks;
+    const __m256i zero = _mm256_setzero_si256();
+
+    for (int z = 0; z < group_size; ++z) {
+        for (int y = 0; y < group_size; ++y) {
+            __m256i c = load_column(grid.columns[z][y]);
+            if (_mm256_testz_si256(c, c)) continue;
+
+            // Lane i of prev is lane i-1 of c (0 for lane 0); lane i
+            // of next is lane i+1 of c (0 for lane 3).
+            __m256i prev = _mm256_blend_epi32(
+                _mm256_permute4x64_epi64(c, _MM_SHUFFLE(2, 1, 0, 0)), zero, 0x03);
+            __m256i next = _mm256_blend_epi32(
+                _mm256_permute4x64_epi64(c, _MM_SHUFFLE(3, 3, 2, 1)), zero, 0xC0);
+            __m256i shl = _mm256_or_si256(
+                _mm256_slli_epi64(c, 1), _mm256_srli_epi64(prev, 63));
+            __m256i shr = _mm256_or_si256(
+                _mm256_srli_epi64(c, 1), _mm256_slli_epi64(next, 63));
+
+            const uint64_t* ny = y > 0 ? grid.columns[z][y-1] : empty_column;
+            const uint64_t* py = y < group_size-1 ? grid.columns[z][y+1] : empty_column;
+            const uint64_t* nz = z > 0 ? grid.columns[z-1][y] : empty_column;
+            const uint64_t* pz = z < group_size-1 ? grid.columns[z+1][y] : empty_column;
+
+            store_column(masks[0], _mm256_andnot_si256(shl, c));
+            store_column(masks[1], _mm256_andnot_si256(shr, c));
+            store_column(masks[2], _mm256_andnot_si256(load_column(ny), c));
+            store_column(masks[3], _mm256_andnot_si256(load_column(py), c));
+            store_column(masks[4], _mm256_andnot_si256(load_column(nz), c));
+            store_column(masks[5], _mm256_andnot_si256(load_column(pz), c));
+            emit_column(group, y, z, masks, out, layout);
+        }
+    }
+}
+
+static bool cpu_has_avx2()
+{
+    static const bool result = __builtin_cpu_supports("avx2");
+    return result;
+}
+#endif
+
+void make_voxel_instances(
+    const ChunkGroup& group,
+    OccupancyGrid* scratch,
+    std::vector<VoxelInstance>* out,
+    VoxelLayout layout)
+{
+    out->clear();
+    scratch->fill(group);
+
+#ifdef MYRICUBE_X86
+    if (cpu_has_avx2()) {
+        make_instances_avx2(group, *scratch, out, layout);
+        return;
+    }
+#endif
+    make_instances_scalar(group, *scratch, out, layout);
+}
+
+void make_voxel_instances_scalar(
+    const ChunkGroup& group,
+    OccupancyGrid* scratch,
+    std::vector<VoxelInstance>* out,
+    VoxelLayout layout)
+{
+    out->clear();
+    scratch->fill(group);
+    make_instances_scalar(group, *scratch, out, layout);
+}
+
+// Key of a record in InstanceList::index_map: the residue, plus the
+// face index for face records.
+static inline uint32_t record_key(VoxelLayout layout, VoxelInstance instance)
+{
+    uint32_t mask = layout == VoxelLayout::box ? 0xFFFFFF : 0x7FFFFFF;
+    return instance.packed_residue_face_bits & mask;
+}
+
+void InstanceList::rebuild(const ChunkGroup& group, OccupancyGrid* scratch)
+{
+    make_voxel_instances(group, scratch, &instances, layout);
+    index_map.clear();
+    index_map.reserve(instances.size());
+    for (uint32_t i = 0; i < instances.size(); ++i) {
+        index_map[record_key(layout, instances[i])] = i;
+    }
+    dirty.clear();
+}
+
+void InstanceList::update_voxel(const ChunkGroup* group, int x, int y, int z)
+{
+    update_one(group, x, y, z);
+    if (x > 0) update_one(group, x-1, y, z);
+    if (x < group_size-1) update_one(group, x+1, y, z);
+    if (y > 0) update_one(group, x, y-1, z);
+    if (y < group_size-1) update_one(group, x, y+1, z);
+    if (z > 0) update_one(group, x, y, z-1);
+    if (z < group_size-1) update_one(group, x, y, z+1);
+}
+
+void InstanceList::update_one(const ChunkGroup* group, int x, int y, int z)
+{
+    uint32_t residue = uint32_t(x) << X_SHIFT | uint32_t(y) << Y_SHIFT | uint32_t(z) << Z_SHIFT;
+    uint32_t face_bits = group ? voxel_face_bits(*group, x, y, z) : 0;
+    uint32_t packed_color = face_bits ? group->get(x, y, z).packed_color : 0;
+
+    if (layout == VoxelLayout::box) {
+        update_record(residue, face_bits != 0, { residue | face_bits, packed_color });
+        return;
+    }
+
+    for (uint32_t i = 0; i < 6; ++i) {
+        uint32_t key = residue | i << FACE_INDEX_SHIFT;
+        bool wanted = (face_bits >> (24 + i)) & 1;
+        update_record(key, wanted, { key, packed_color });
+    }
+}
+
+// Add, patch, or remove the record with the given key so that it
+// exists with the given value iff wanted.
+void InstanceList::update_record(uint32_t key, bool wanted, VoxelInstance instance)
+{
+    auto it = index_map.find(key);
+
+    if (!wanted) {
+        if (it == index_map.end()) return;
+
+        // Remove by moving the last instance into the hole.
+        uint32_t index = it->second;
+        uint32_t last = uint32_t(instances.size() - 1);
+        index_map.erase(it);
+        if (index != last) {
+            instances[index] = instances[last];
+            index_map[record_key(layout, instances[index])] = index;
+            dirty.push_back(index);
+        }
+        instances.pop_back();
+        return;
+    }
+
+    if (it == index_map.end()) {
+        uint32_t index = uint32_t(instances.size());
+        index_map.emplace(key, index);
+        instances.push_back(instance);
+        dirty.push_back(index);
+        return;
+    }
+
+    VoxelInstance& old = instances[it->second];
+    if (old.packed_residue_face_bits != instance.packed_residue_face_bits
+     || old.packed_color != instance.packed_color) {
+        old = instance;
+        dirty.push_back(it->second);
+    }
+}
+
+void InstanceList::take_dirty(std::vector<uint32_t>* out)
+{
+    std::sort(dirty.begin(), dirty.end());
+    dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+
+    // Indices past the end were removed again; nothing to upload.
+    auto end = std::lower_bound(dirty.begin(), dirty.end(), uint32_t(instances.size()));
+    out->assign(dirty.begin(), end);
+    dirty.clear();
+}
+
+} // end namespace
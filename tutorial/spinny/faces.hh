@@ -0,0 +1,144 @@
+// Face visibility generator. Derives the NEG_X_FACE_BIT..POS_Z_FACE_BIT
+// bits of the voxel instances of a chunk group from a bit-packed
+// occupancy grid, using 64-bit (or 256-bit AVX2, when the CPU has it)
+// column shifts and and-nots instead of per-voxel neighbor lookups.
+#ifndef MYRICUBE_FACES_HH_
+#define MYRICUBE_FACES_HH_
+
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include "chunk.hh"
+
+namespace myricube {
+
+// Layout of the instance stream drawn for a chunk group.
+enum class VoxelLayout
+{
+    // One record per voxel with any exposed face, holding its face
+    // bits. voxel.vert draws 36 vertices per record, collapsing
+    // hidden faces to degenerate triangles.
+    box,
+
+    // One record per exposed face, holding the face index at
+    // FACE_INDEX_SHIFT. face.vert draws 6 vertices per record.
+    face,
+};
+
+// Vertex shader invocations per record of the given layout.
+inline int vertices_per_record(VoxelLayout layout)
+{
+    return layout == VoxelLayout::box ? 36 : 6;
+}
+
+// One instance of the voxel pipeline. Same layout as VoxelVertex in
+// render.cc (which adds the Vulkan vertex input descriptions). The
+// top byte of packed_residue_face_bits depends on the VoxelLayout.
+struct VoxelInstance
+{
+    uint32_t packed_residue_face_bits;
+    uint32_t packed_color;
+};
+
+// Number of 64-bit words in one 256-voxel column along x.
+constexpr int column_words = group_size / 64;
+
+// Occupancy of a whole chunk group, one bit per voxel. Column (y, z)
+// is 256 bits along the x axis; bit x is set iff voxel (x, y, z) is
+// visible. This is 2 MiB, so don't put it on the stack.
+struct OccupancyGrid
+{
+    alignas(32) uint64_t columns[group_size][group_size][column_words];
+
+    // Fill the grid from the chunk row bits of the given chunk group.
+    void fill(const ChunkGroup& group);
+
+    bool get(int x, int y, int z) const
+    {
+        return (columns[z][y][x / 64] >> (x % 64)) & 1;
+    }
+};
+
+// Return the face bits (NEG_X_FACE_BIT, etc.) for the voxel at the
+// given residue coordinates, treating the chunk group's boundary as
+// exposed. 0 if the voxel is invisible or fully hidden.
+uint32_t voxel_face_bits(const ChunkGroup& group, int x, int y, int z);
+
+// Replace *out with the records of every visible voxel in the chunk
+// group that has at least one exposed face, in z, y, x (then face)
+// order. The occupancy grid is scratch space (it is overwritten).
+void make_voxel_instances(
+    const ChunkGroup& group,
+    OccupancyGrid* scratch,
+    std::vector<VoxelInstance>* out,
+    VoxelLayout layout = VoxelLayout::box);
+
+// make_voxel_instances, but always with the portable 64-bit kernel
+// (to check the AVX2 one against).
+void make_voxel_instances_scalar(
+    const ChunkGroup& group,
+    OccupancyGrid* scratch,
+    std::vector<VoxelInstance>* out,
+    VoxelLayout layout = VoxelLayout::box);
+
+// Instance list of one chunk group that can be patched in place when
+// individual voxels are edited, instead of being regenerated. Keeps a
+// map from residue coordinates to instance index, and remembers which
+// instances changed so only those need to be re-uploaded.
+class InstanceList
+{
+    VoxelLayout layout;
+
+    std::vector<VoxelInstance> instances;
+
+    // Packed residue (x | y << 8 | z << 16), plus the face index for
+    // the face layout, to index in instances.
+    std::unordered_map<uint32_t, uint32_t> index_map;
+
+    // Indices of instances modified since the last take_dirty call.
+    std::vector<uint32_t> dirty;
+
+  public:
+    explicit InstanceList(VoxelLayout layout_ = VoxelLayout::box) : layout(layout_)
+    {
+
+    }
+
+    VoxelLayout get_layout() const
+    {
+        return layout;
+    }
+
+    const std::vector<VoxelInstance>& get_instances() const
+    {
+        return instances;
+    }
+
+    size_t size() const
+    {
+        return instances.size();
+    }
+
+    // Regenerate from scratch with make_voxel_instances, in this
+    // list's layout. Clears the dirty list (the caller is expected to
+    // upload everything).
+    void rebuild(const ChunkGroup& group, OccupancyGrid* scratch);
+
+    // Recompute the face bits of the voxel at the given residue
+    // coordinates and of its six neighbors in the same chunk group,
+    // adding, patching, or removing their instances as needed. Call
+    // after each edit; group is nullptr if the edit emptied it.
+    void update_voxel(const ChunkGroup* group, int x, int y, int z);
+
+    // Write out the sorted, de-duplicated indices of instances that
+    // changed since the last call, and clear the dirty list.
+    void take_dirty(std::vector<uint32_t>* out);
+
+  private:
+    void update_one(const ChunkGroup* group, int x, int y, int z);
+    void update_record(uint32_t key, bool wanted, VoxelInstance instance);
+};
+
+} // end namespace
+#endif /* !MYRICUBE_FACES_HH_ */
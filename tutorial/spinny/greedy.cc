@@ -0,0 +1,184 @@
+#include "greedy.hh"
+
+namespace myricube {
+
+// Emit one quad. The quad lies in the plane axis = plane, and covers
+// [u0, u1) x [v0, v1) along axes (axis+1)%3 and (axis+2)%3. Corners go
+// counterclockwise seen from the +axis side (u then v), so the
+// winding is reversed for negative faces to keep them front-facing.
+static void emit_quad(
+    GreedyMesh* out, int face, int plane,
+    int u0, int v0, int u1, int v1, uint32_t packed_color)
+{
+    int axis = face / 2;
+    bool positive = face & 1;
+    uint32_t first = uint32_t(out->vertices.size());
+
+    const int corners[4][2] = { { u0, v0 }, { u1, v0 }, { u1, v1 }, { u0, v1 } };
+    for (const auto& corner : corners) {
+        int xyz[3];
+        xyz[axis] = plane;
+        xyz[(axis+1) % 3] = corner[0];
+        xyz[(axis+2) % 3] = corner[1];
+
+        MeshVertex vertex;
+        vertex.packed_position = uint32_t(xyz[0]) << MESH_X_SHIFT
+                               | uint32_t(xyz[1]) << MESH_Y_SHIFT
+                               | uint32_t(xyz[2]) << MESH_Z_SHIFT
+                               | uint32_t(face) << MESH_FACE_SHIFT;
+        vertex.packed_color = packed_color;
+        out->vertices.push_back(vertex);
+    }
+
+    static const uint32_t pos_order[6] = { 0, 1, 2, 0, 2, 3 };
+    static const uint32_t neg_order[6] = { 0, 3, 2, 0, 2, 1 };
+    for (uint32_t i : positive ? pos_order : neg_order) {
+        out->indices.push_back(first + i);
+    }
+}
+
+// Occupancy bits x0-1 to x0+16 of the group's row (y, z), so bit i+1
+// is voxel x0+i. Rows outside the group are empty.
+static inline uint32_t row_window(const OccupancyGrid& grid, int x0, int y, int z)
+{
+    if (unsigned(y) >= group_size || unsigned(z) >= group_size) return 0;
+    const uint64_t* column = grid.columns[z][y];
+    auto bit = [column] (int x) -> uint32_t
+    {
+        return unsigned(x) < group_size ? uint32_t(column[x / 64] >> (x % 64)) & 1 : 0;
+    };
+    uint32_t bits = uint32_t(column[x0 / 64] >> (x0 % 64)) & 0xFFFF;
+    return bit(x0 - 1) | bits << 1 | bit(x0 + chunk_size) << 17;
+}
+
+// Exposed faces of one chunk, indexed [face][z][y]; bit x is set iff
+// that face of voxel (x, y, z) of the chunk is exposed.
+using ChunkFaceBits = uint16_t[6][chunk_size][chunk_size];
+
+static void chunk_face_bits(
+    const Chunk& chunk, const OccupancyGrid& grid, const int origin[3],
+    ChunkFaceBits& out)
+{
+    auto row = [&grid, origin] (int y, int z) -> uint32_t
+    {
+        return row_window(grid, origin[0], y, z) >> 1 & 0xFFFF;
+    };
+    for (int z = 0; z < chunk_size; ++z) {
+        for (int y = 0; y < chunk_size; ++y) {
+            int gy = origin[1] + y, gz = origin[2] + z;
+            uint32_t occ = chunk.row_bits[z][y];
+            uint32_t window = occ ? row_window(grid, origin[0], gy, gz) : 0;
+            out[0][z][y] = uint16_t(occ & ~window);
+            out[1][z][y] = uint16_t(occ & ~(window >> 2));
+            out[2][z][y] = uint16_t(occ ? occ & ~row(gy-1, gz) : 0);
+            out[3][z][y] = uint16_t(occ ? occ & ~row(gy+1, gz) : 0);
+            out[4][z][y] = uint16_t(occ ? occ & ~row(gy, gz-1) : 0);
+            out[5][z][y] = uint16_t(occ ? occ & ~row(gy, gz+1) : 0);
+        }
+    }
+}
+
+// Mesh one face direction of one chunk. Each of the 16 slices along
+// the face's axis gets a 16x16 mask of exposed face colors (0 = none),
+// which is then covered with maximal same-color rectangles: extend
+// each rectangle along u as far as possible, then along v while the
+// whole row matches.
+static void mesh_chunk_face(
+    const Chunk& chunk, const ChunkFaceBits& face_bits,
+    const int origin[3], int face, GreedyMesh* out)
+{
+    int axis = face / 2;
+    int u_axis = (axis+1) % 3;
+    int v_axis = (axis+2) % 3;
+    uint32_t mask[chunk_size][chunk_size];   // [v][u]
+
+    // Bit s is set iff slice s has any exposed face.
+    uint32_t slices = 0;
+    for (int z = 0; z < chunk_size; ++z) {
+        for (int y = 0; y < chunk_size; ++y) {
+            uint32_t bits = face_bits[face][z][y];
+            if (bits == 0) continue;
+            slices |= axis == 0 ? bits : 1u << (axis == 1 ? y : z);
+        }
+    }
+
+    for (int s = 0; s < chunk_size; ++s) {
+        if (!(slices >> s & 1)) continue;
+
+        for (int v = 0; v < chunk_size; ++v) {
+            for (int u = 0; u < chunk_size; ++u) {
+                int local[3];
+                local[axis] = s;
+                local[u_axis] = u;
+                local[v_axis] = v;
+                bool exposed = face_bits[face][local[2]][local[1]] >> local[0] & 1;
+                mask[v][u] = exposed ? chunk.get(local[0], local[1], local[2]).packed_color : 0;
+            }
+        }
+
+        int plane = origin[axis] + s + (face & 1);
+        for (int v = 0; v < chunk_size; ++v) {
+            for (int u = 0; u < chunk_size; ) {
+                uint32_t color = mask[v][u];
+                if (color == 0) {
+                    ++u;
+                    continue;
+                }
+
+                int u1 = u + 1;
+                while (u1 < chunk_size && mask[v][u1] == color) ++u1;
+
+                int v1 = v + 1;
+                for (; v1 < chunk_size; ++v1) {
+                    bool row_matches = true;
+                    for (int i = u; i < u1; ++i) {
+                        if (mask[v1][i] != color) {
+                            row_matches = false;
+                            break;
+                        }
+                    }
+                    if (!row_matches) break;
+                }
+
+                for (int j = v; j < v1; ++j) {
+                    for (int i = u; i < u1; ++i) mask[j][i] = 0;
+                }
+
+                emit_quad(out, face, plane,
+                    origin[u_axis] + u, origin[v_axis] + v,
+                    origin[u_axis] + u1, origin[v_axis] + v1,
+                    color);
+                u = u1;
+            }
+        }
+    }
+}
+
+void make_greedy_mesh(
+    const ChunkGroup& group,
+    OccupancyGrid* scratch,
+    GreedyMesh* out)
+{
+    out->vertices.clear();
+    out->indices.clear();
+    scratch->fill(group);
+
+    ChunkFaceBits face_bits;
+
+    for (int cz = 0; cz < edge_chunks; ++cz) {
+        for (int cy = 0; cy < edge_chunks; ++cy) {
+            for (int cx = 0; cx < edge_chunks; ++cx) {
+                const Chunk* chunk = group.get_chunk(cx, cy, cz);
+                if (chunk == nullptr) continue;
+
+                const int origin[3] = { cx * chunk_size, cy * chunk_size, cz * chunk_size };
+                chunk_face_bits(*chunk, *scratch, origin, face_bits);
+                for (int face = 0; face < 6; ++face) {
+                    mesh_chunk_face(*chunk, face_bits, origin, face, out);
+                }
+            }
+        }
+    }
+}
+
+} // end namespace
@@ -0,0 +1,55 @@
+// Greedy mesher. Merges coplanar, same-color exposed voxel faces of
+// each chunk into maximal rectangles, producing a conventional
+// indexed triangle mesh (drawn with greedy.vert) instead of one
+// instance per voxel or face. Much fewer triangles for flat terrain,
+// but the whole mesh must be regenerated when a voxel changes.
+#ifndef MYRICUBE_GREEDY_HH_
+#define MYRICUBE_GREEDY_HH_
+
+#include <stdint.h>
+#include <vector>
+
+#include "chunk.hh"
+#include "faces.hh"
+
+// Layout of MeshVertex::packed_position. Coordinates go from 0 to
+// group_size inclusive, so they need 9 bits. Keep in sync with greedy.vert.
+#define MESH_X_SHIFT 0
+#define MESH_Y_SHIFT 9
+#define MESH_Z_SHIFT 18
+#define MESH_FACE_SHIFT 27
+
+namespace myricube {
+
+// Corner of a quad, in residue coordinates of its chunk group. The
+// face index (-x, +x, -y, +y, -z, +z order) is stored with the
+// position to orient the border texture coordinates. packed_color is
+// the same as Voxel::packed_color.
+struct MeshVertex
+{
+    uint32_t packed_position;
+    uint32_t packed_color;
+};
+
+// Triangle mesh of a chunk group: 4 vertices and 6 indices per quad.
+struct GreedyMesh
+{
+    std::vector<MeshVertex> vertices;
+    std::vector<uint32_t> indices;
+
+    size_t quad_count() const
+    {
+        return vertices.size() / 4;
+    }
+};
+
+// Replace *out with the greedy mesh of the chunk group. As with
+// make_voxel_instances, the group's boundary counts as exposed and the
+// occupancy grid is scratch space.
+void make_greedy_mesh(
+    const ChunkGroup& group,
+    OccupancyGrid* scratch,
+    GreedyMesh* out);
+
+} // end namespace
+#endif /* !MYRICUBE_GREEDY_HH_ */
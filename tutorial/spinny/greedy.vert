@@ -0,0 +1,66 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+#define MESH_X_SHIFT 0
+#define MESH_Y_SHIFT 9
+#define MESH_Z_SHIFT 18
+#define MESH_FACE_SHIFT 27
+
+#define RED_SHIFT 24
+#define GREEN_SHIFT 16
+#define BLUE_SHIFT 8
+
+#define GROUP_SIZE 256
+
+// Camera of the frame (CameraUniform in render.cc), shared by all the
+// chunk groups' draws, which are recorded once and reused.
+layout(set=0, binding=0) uniform CameraBlock {
+    mat4 view_projection;   // Eye-relative (the view without translation).
+    ivec4 eye_group;        // Chunk group the eye is in,
+    vec4 eye_residue;       // and the eye's position within it.
+} camera;
+
+layout(push_constant) uniform GroupPushConstantBlock {
+    ivec4 group;            // Chunk group coordinate; w is its level of detail.
+} push;
+
+// Eye-relative position of a point in residue coordinates of the level
+// of detail the group is drawn at.
+vec3 eye_relative(vec3 residue) {
+    return vec3(push.group.xyz - camera.eye_group.xyz) * GROUP_SIZE
+         + residue * float(1 << push.group.w) - camera.eye_residue.xyz;
+}
+
+// Per-vertex inputs (see MeshVertex in greedy.hh):
+// Corner of a merged quad in residue coordinates, and its face index
+// (-x, +x, -y, +y, -z, +z).
+layout(location=0) in uint packed_position;
+// Color of the quad's voxels
+layout(location=1) in uint packed_color;
+
+layout(location=0) out vec3 v_color;
+layout(location=1) out vec3 v_residue_coord;
+layout(location=2) out vec2 v_uv;
+
+void main() {
+    vec3 position = vec3(
+        float((packed_position >> MESH_X_SHIFT) & 511),
+        float((packed_position >> MESH_Y_SHIFT) & 511),
+        float((packed_position >> MESH_Z_SHIFT) & 511));
+    v_residue_coord = position;
+
+    // Perspective transformation, relative to the eye.
+    gl_Position = camera.view_projection * vec4(eye_relative(position), 1);
+
+    // Unpack the color.
+    float red   = ((packed_color >> RED_SHIFT) & 255) * (1./255.);
+    float green = ((packed_color >> GREEN_SHIFT) & 255) * (1./255.);
+    float blue  = ((packed_color >> BLUE_SHIFT) & 255) * (1./255.);
+    v_color = vec3(red, green, blue);
+
+    // Texture coordinates are the in-plane coordinates, so that the
+    // border effect (which only looks at the fractional part) still
+    // outlines each voxel of the merged quad.
+    int axis = int((packed_position >> MESH_FACE_SHIFT) & 7) / 2;
+    v_uv = axis == 0 ? position.yz : axis == 1 ? position.zx : position.xy;
+}
@@ -0,0 +1,174 @@
+#include "jobs.hh"
+
+#include <assert.h>
+#include <algorithm>
+
+namespace myricube {
+
+JobId JobGraph::add(const char* name, std::function<void(int worker)> function,
+                    std::initializer_list<JobId> after)
+{
+    JobId id = JobId(jobs.size());
+    jobs.emplace_back();
+    Job& job = jobs.back();
+    job.name = name;
+    job.function = std::move(function);
+    for (JobId before : after) depend(id, before);
+    return id;
+}
+
+JobId JobGraph::add_range(const char* name, size_t count, size_t grain,
+                          std::function<void(size_t begin, size_t end, int worker)> function,
+                          std::initializer_list<JobId> after)
+{
+    grain = std::max<size_t>(grain, 1);
+    std::vector<JobId> ranges;
+    for (size_t begin = 0; begin < count; begin += grain) {
+        size_t end = std::min(begin + grain, count);
+        ranges.push_back(add(name, [function, begin, end] (int worker) {
+            function(begin, end, worker);
+        }, after));
+    }
+    JobId done = add("", [] (int) {}, after);
+    for (JobId range : ranges) depend(done, range);
+    return done;
+}
+
+void JobGraph::depend(JobId job, JobId before)
+{
+    assert(before < job && job < jobs.size());
+    jobs[before].dependents.push_back(job);
+    ++jobs[job].dependency_count;
+}
+
+std::vector<JobTiming> JobGraph::timings() const
+{
+    std::vector<JobTiming> result;
+    result.reserve(jobs.size());
+    for (const Job& job : jobs) result.push_back(job.timing);
+    return result;
+}
+
+JobSystem::JobSystem(int thread_count)
+{
+    if (thread_count <= 0) thread_count = int(std::max(1u, std::thread::hardware_concurrency()));
+    for (int i = 0; i < thread_count; ++i) workers.push_back(std::make_unique<Worker>());
+    for (int i = 1; i < thread_count; ++i) threads.emplace_back(&JobSystem::worker_loop, this, i);
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread& thread : threads) thread.join();
+}
+
+void JobSystem::push(int worker, JobId id)
+{
+    {
+        Worker& w = *workers[worker];
+        std::lock_guard<std::mutex> lock(w.mutex);
+        w.ready.push_back(id);
+    }
+    // Taking sleep_mutex orders this with a sleeper's check of queued.
+    ++queued;
+    { std::lock_guard<std::mutex> lock(sleep_mutex); }
+    wake.notify_one();
+}
+
+bool JobSystem::pop_or_steal(int worker, JobId* id)
+{
+    int count = thread_count();
+    for (int i = 0; i < count; ++i) {
+        int victim = (worker + i) % count;
+        Worker& w = *workers[victim];
+        std::lock_guard<std::mutex> lock(w.mutex);
+        if (w.ready.empty()) continue;
+        if (i == 0) {
+            *id = w.ready.back();
+            w.ready.pop_back();
+        }
+        else {
+            *id = w.ready.front();
+            w.ready.pop_front();
+        }
+        --queued;
+        return true;
+    }
+    return false;
+}
+
+void JobSystem::execute(int worker, JobId id)
+{
+    using ms = std::chrono::duration<double, std::milli>;
+    JobGraph::Job& job = graph->jobs[id];
+    job.timing.name = job.name;
+    job.timing.worker = worker;
+    job.timing.start_ms = ms(std::chrono::steady_clock::now() - start).count();
+    try {
+        job.function(worker);
+    }
+    catch (...) {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (error == nullptr) error = std::current_exception();
+    }
+    job.timing.end_ms = ms(std::chrono::steady_clock::now() - start).count();
+
+    for (JobId dependent : job.dependents) {
+        if (--graph->jobs[dependent].remaining == 0) push(worker, dependent);
+    }
+    if (--unfinished == 0) {
+        { std::lock_guard<std::mutex> lock(sleep_mutex); }
+        wake.notify_all();
+    }
+}
+
+void JobSystem::worker_loop(int worker)
+{
+    while (true) {
+        JobId id;
+        if (pop_or_steal(worker, &id)) {
+            execute(worker, id);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        wake.wait(lock, [this] { return queued > 0 || stopping; });
+        if (stopping) return;
+    }
+}
+
+void JobSystem::run(JobGraph& graph_)
+{
+    if (graph_.jobs.empty()) return;
+    graph = &graph_;
+    start = std::chrono::steady_clock::now();
+    error = nullptr;
+    unfinished = graph->jobs.size();
+    for (JobGraph::Job& job : graph->jobs) job.remaining = job.dependency_count;
+
+    // Deal out the initially ready jobs.
+    int next = 0;
+    for (JobId id = 0; id < graph->jobs.size(); ++id) {
+        if (graph->jobs[id].dependency_count != 0) continue;
+        push(next, id);
+        next = (next + 1) % thread_count();
+    }
+    wake.notify_all();
+
+    while (unfinished > 0) {
+        JobId id;
+        if (pop_or_steal(0, &id)) {
+            execute(0, id);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        wake.wait(lock, [this] { return queued > 0 || unfinished == 0; });
+    }
+    graph = nullptr;
+    if (error != nullptr) std::rethrow_exception(error);
+}
+
+} // end namespace
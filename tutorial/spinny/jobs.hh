@@ -0,0 +1,144 @@
+// Work-stealing job scheduler. Work is described as a JobGraph: jobs
+// (functions) with dependencies between them, typically built anew
+// every frame. JobSystem::run executes a graph on a fixed set of
+// worker threads plus the calling thread. Each thread has its own
+// deque of ready jobs: it pushes and pops at the back (so a job's
+// dependents tend to run on the thread whose cache holds its results),
+// and, when its deque is empty, steals from the front of the others'.
+// Every job's start and end time and thread are recorded, to see how
+// the work scales with the thread count.
+#ifndef MYRICUBE_JOBS_HH_
+#define MYRICUBE_JOBS_HH_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace myricube {
+
+using JobId = uint32_t;
+
+// When and where one job ran: milliseconds since its graph started
+// running, and the worker index (0 is the thread that called run).
+struct JobTiming
+{
+    const char* name = "";
+    int worker = 0;
+    double start_ms = 0, end_ms = 0;
+};
+
+class JobGraph
+{
+    friend class JobSystem;
+
+    struct Job
+    {
+        const char* name;
+        std::function<void(int worker)> function;
+        std::vector<JobId> dependents;
+        uint32_t dependency_count = 0;
+        std::atomic<uint32_t> remaining { 0 };
+        JobTiming timing;
+    };
+
+    // Deque, so that jobs (with their atomics) never move.
+    std::deque<Job> jobs;
+
+  public:
+    JobGraph() = default;
+    JobGraph(JobGraph&&) = delete;
+
+    // Add a job calling function(worker), where worker is the index
+    // of the thread running it (for per-thread scratch space). It runs
+    // only after all the jobs in after have finished.
+    JobId add(const char* name, std::function<void(int worker)> function,
+              std::initializer_list<JobId> after = {});
+
+    // Split [0, count) into ranges of about grain items, and add a job
+    // calling function(begin, end, worker) for each, after the jobs in
+    // after. Returns an unnamed no-op job that finishes after all of
+    // them.
+    JobId add_range(const char* name, size_t count, size_t grain,
+                    std::function<void(size_t begin, size_t end, int worker)> function,
+                    std::initializer_list<JobId> after = {});
+
+    // Make job run only after before has finished. before must have
+    // been added first, so that the graph has no cycles.
+    void depend(JobId job, JobId before);
+
+    size_t size() const
+    {
+        return jobs.size();
+    }
+
+    void clear()
+    {
+        jobs.clear();
+    }
+
+    // Timing of each job in the last run, in the order added.
+    std::vector<JobTiming> timings() const;
+};
+
+class JobSystem
+{
+    // Ready jobs (of the graph being run) of one thread.
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<JobId> ready;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers;
+    std::vector<std::thread> threads;
+
+    // Threads with nothing to do sleep on wake until a job is queued,
+    // the graph is finished, or the system is stopping.
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    std::atomic<int> queued { 0 };
+    std::atomic<size_t> unfinished { 0 };
+    std::atomic<bool> stopping { false };
+
+    JobGraph* graph = nullptr;
+    std::chrono::steady_clock::time_point start;
+
+    // First exception thrown by a job of the graph being run.
+    std::mutex error_mutex;
+    std::exception_ptr error;
+
+    void push(int worker, JobId id);
+    bool pop_or_steal(int worker, JobId* id);
+    void execute(int worker, JobId id);
+    void worker_loop(int worker);
+
+  public:
+    // Use thread_count threads in all, including the one calling run;
+    // 0 means one per hardware thread.
+    explicit JobSystem(int thread_count = 0);
+    JobSystem(JobSystem&&) = delete;
+    ~JobSystem();
+
+    int thread_count() const
+    {
+        return int(workers.size());
+    }
+
+    // Run all jobs of the graph, respecting dependencies, and return
+    // when they are finished; rethrows the first exception a job threw
+    // (the other jobs still run). Jobs must not call run themselves.
+    void run(JobGraph& graph);
+};
+
+} // end namespace
+#endif /* !MYRICUBE_JOBS_HH_ */
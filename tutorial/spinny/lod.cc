@@ -0,0 +1,118 @@
+#include "lod.hh"
+
+namespace myricube {
+
+Voxel downsample_voxels(const Voxel* voxels, int count)
+{
+    assert(count > 0 && count <= 8);
+    uint32_t red = 0, green = 0, blue = 0;
+    for (int i = 0; i < count; ++i) {
+        // Usually all the same, so this returns on the first voxel.
+        int same = 0;
+        for (int j = 0; j < count; ++j) same += voxels[j] == voxels[i];
+        if (2 * same > count) return voxels[i];
+
+        red += voxels[i].packed_color >> RED_SHIFT & 255;
+        green += voxels[i].packed_color >> GREEN_SHIFT & 255;
+        blue += voxels[i].packed_color >> BLUE_SHIFT & 255;
+    }
+    uint32_t half = uint32_t(count) / 2;
+    return Voxel::from_rgb(uint8_t((red + half) / count),
+                           uint8_t((green + half) / count),
+                           uint8_t((blue + half) / count));
+}
+
+GroupLod::GroupLod(GroupCoord coord)
+{
+    for (int i = 0; i < max_lod_level; ++i) {
+        levels[i] = std::make_unique<ChunkGroup>(coord);
+        dirty_chunks[i].set();
+    }
+}
+
+void GroupLod::mark_dirty(int x, int y, int z)
+{
+    assert(unsigned(x) < group_size);
+    assert(unsigned(y) < group_size);
+    assert(unsigned(z) < group_size);
+    for (int level = 1; level <= max_lod_level; ++level) {
+        int cx = (x >> level) / chunk_size;
+        int cy = (y >> level) / chunk_size;
+        int cz = (z >> level) / chunk_size;
+        dirty_chunks[level - 1].set((cz * edge_chunks + cy) * edge_chunks + cx);
+    }
+    dirty = true;
+}
+
+// Each of the 8 finer chunks below the coarse chunk fills one octant of
+// it; the finer chunk's row bits let empty pairs of rows be skipped.
+void GroupLod::update_chunk(const ChunkGroup& finer, ChunkGroup* coarser, int cx, int cy, int cz)
+{
+    constexpr int half = chunk_size / 2;
+    Voxel voxels[chunk_size][chunk_size][chunk_size] = {};
+    Voxel src[chunk_voxels];
+    bool any = false;
+
+    for (int octant = 0; octant < 8; ++octant) {
+        int ox = octant & 1, oy = octant >> 1 & 1, oz = octant >> 2;
+        const Chunk* chunk = finer.get_chunk(2 * cx + ox, 2 * cy + oy, 2 * cz + oz);
+        if (chunk == nullptr) continue;
+        any = true;
+        chunk->decode(src);
+
+        for (int z = 0; z < half; ++z) {
+            for (int y = 0; y < half; ++y) {
+                uint32_t rows = chunk->row_bits[2*z][2*y] | chunk->row_bits[2*z][2*y + 1]
+                              | chunk->row_bits[2*z + 1][2*y] | chunk->row_bits[2*z + 1][2*y + 1];
+                if (rows == 0) continue;
+                for (int x = 0; x < half; ++x) {
+                    if ((rows >> (2 * x) & 3) == 0) continue;
+                    Voxel visible[8];
+                    int count = 0;
+                    for (int i = 0; i < 8; ++i) {
+                        int fx = 2 * x + (i & 1), fy = 2 * y + (i >> 1 & 1), fz = 2 * z + (i >> 2);
+                        Voxel v = src[(fz * chunk_size + fy) * chunk_size + fx];
+                        if (v.visible()) visible[count++] = v;
+                    }
+                    voxels[oz * half + z][oy * half + y][ox * half + x] = downsample_voxels(visible, count);
+                }
+            }
+        }
+    }
+
+    if (!any) {
+        coarser->set_chunk(cx, cy, cz, nullptr);
+        return;
+    }
+    auto chunk = std::make_unique<Chunk>();
+    chunk->assign(&voxels[0][0][0]);
+    chunk->compress();      // Never edited.
+    coarser->set_chunk(cx, cy, cz, std::move(chunk));
+}
+
+int GroupLod::update(const ChunkGroup& group)
+{
+    if (!dirty) return 0;
+    int updated = 0;
+    const ChunkGroup* finer = &group;
+    for (int level = 1; level <= max_lod_level; ++level) {
+        ChunkGroup* coarser = levels[level - 1].get();
+        auto& bits = dirty_chunks[level - 1];
+        int edge = edge_chunks >> level;
+        for (int cz = 0; cz < edge; ++cz) {
+            for (int cy = 0; cy < edge; ++cy) {
+                for (int cx = 0; cx < edge; ++cx) {
+                    if (!bits[(cz * edge_chunks + cy) * edge_chunks + cx]) continue;
+                    update_chunk(*finer, coarser, cx, cy, cz);
+                    ++updated;
+                }
+            }
+        }
+        bits.reset();
+        finer = coarser;
+    }
+    dirty = false;
+    return updated;
+}
+
+} // end namespace
@@ -0,0 +1,69 @@
+// Levels of detail of a chunk group. Level L is the group downsampled
+// L times by 2 along each axis: a ChunkGroup whose residue coordinates
+// only span [0, group_size >> L), each of its voxels standing for a
+// 2^L x 2^L x 2^L block of the original group. A coarse voxel is
+// visible iff any of its 8 finer voxels is, and takes the color most
+// of them share, or else their average color. Drawn scaled up by 2^L,
+// far chunk groups need 8x (level 1) or 64x (level 2) fewer voxels,
+// and raycast ones traverse a smaller volume.
+//
+// The levels are regenerated incrementally: edits mark the chunks of
+// each level above the edited voxel dirty, and only those are rebuilt,
+// each from the 8 chunks below it in the next finer level.
+#ifndef MYRICUBE_LOD_HH_
+#define MYRICUBE_LOD_HH_
+
+#include <bitset>
+#include <memory>
+
+#include "chunk.hh"
+
+namespace myricube {
+
+// Coarsest level of detail (level 0 is the chunk group itself).
+constexpr int max_lod_level = 2;
+
+// The color a coarse voxel takes from its (up to 8) visible finer
+// voxels: the one held by more than half of them, or else the average.
+Voxel downsample_voxels(const Voxel* voxels, int count);
+
+class GroupLod
+{
+    // levels[L - 1] is level L.
+    std::unique_ptr<ChunkGroup> levels[max_lod_level];
+
+    // Chunks of each level to regenerate, by chunk index
+    // (cz * edge_chunks + cy) * edge_chunks + cx.
+    std::bitset<edge_chunks * edge_chunks * edge_chunks> dirty_chunks[max_lod_level];
+    bool dirty = true;
+
+    void update_chunk(const ChunkGroup& finer, ChunkGroup* coarser, int cx, int cy, int cz);
+
+  public:
+    // All levels start out dirty (and empty).
+    explicit GroupLod(GroupCoord coord);
+    GroupLod(GroupLod&&) = delete;
+
+    // Level 1 to max_lod_level; only up-to-date after update.
+    const ChunkGroup& get_level(int level) const
+    {
+        assert(level >= 1 && level <= max_lod_level);
+        return *levels[level - 1];
+    }
+
+    bool is_dirty() const
+    {
+        return dirty;
+    }
+
+    // Note that the voxel at the given residue coordinates (of level 0)
+    // changed.
+    void mark_dirty(int x, int y, int z);
+
+    // Regenerate the dirty chunks of each level, from the given chunk
+    // group (level 0) up. Returns the number of chunks regenerated.
+    int update(const ChunkGroup& group);
+};
+
+} // end namespace
+#endif /* !MYRICUBE_LOD_HH_ */
@@ -1,3 +1,5 @@
+#include "chunk.hh"
+#include "region.hh"
 #include "window.hh"
 #include "render.hh"
 #include "util.hh"
@@ -24,10 +26,17 @@ bool ends_with_bin_or_exe(const std::string& in)
     return strcmp(suffix, "-bin") == 0 or strcmp(suffix, ".exe") == 0;
 }
 
+// Region file the world is loaded from (the first argument), and
+// saved to; world.region in the data directory by default.
+std::string region_filename;
+
+// Chunk compression attempts per frame (VoxelWorld::compress_idle_chunks).
+constexpr int max_frame_compress_attempts = 32;
+
 bool paused = false;
 int target_fragments = 0;
 
-void add_key_targets(Window& window, Camera& camera)
+void add_key_targets(Window& window, Camera& camera, VoxelWorld& world, Renderer* renderer)
 {
     static float speed = 8.0f;
     static float sprint_mod = 1.0f;
@@ -178,6 +187,157 @@ void add_key_targets(Window& window, Camera& camera)
     window.add_key_target("look_around", look_around);
     window.add_key_target("vertical_scroll", vertical_scroll);
     window.add_key_target("horizontal_scroll", horizontal_scroll);
+
+    KeyTarget toggle_voxel_layout;
+    toggle_voxel_layout.down = [renderer] (KeyArg arg) -> bool
+    {
+        if (arg.repeat) return false;
+        fprintf(stderr, "%llu voxel vertices last frame\n",
+            (unsigned long long) get_voxel_vertex_count(renderer));
+        bool box = get_voxel_layout(renderer) == VoxelLayout::box;
+        set_voxel_layout(renderer, box ? VoxelLayout::face : VoxelLayout::box);
+        fprintf(stderr, "Drawing voxels as %s\n", box ? "faces" : "boxes");
+        return true;
+    };
+    window.add_key_target("toggle_voxel_layout", toggle_voxel_layout);
+
+    KeyTarget toggle_greedy_here;
+    toggle_greedy_here.down = [renderer, &camera] (KeyArg arg) -> bool
+    {
+        if (arg.repeat) return false;
+        glm::dvec3 eye = camera.get_eye();
+        GroupCoord coord = GroupCoord::from_world(
+            int32_t(floor(eye.x)), int32_t(floor(eye.y)), int32_t(floor(eye.z)));
+        bool greedy = !get_group_greedy(renderer, coord);
+        set_group_greedy(renderer, coord, greedy);
+        fprintf(stderr, "Chunk group (%i, %i, %i) %s\n",
+            int(coord.x), int(coord.y), int(coord.z),
+            greedy ? "greedy meshed" : "instanced");
+        return true;
+    };
+    window.add_key_target("toggle_greedy_here", toggle_greedy_here);
+
+    KeyTarget print_render_stats;
+    print_render_stats.down = [renderer, &world] (KeyArg arg) -> bool
+    {
+        if (arg.repeat) return false;
+        StreamStats stats = get_stream_stats(renderer);
+        fprintf(stderr, "%zu chunk groups queued, %i uploaded, %llu bytes uploaded last frame (%i staging stalls)\n",
+            stats.queueDepth, stats.newGroups, (unsigned long long)stats.uploadBytes, stats.stagingStalls);
+        fprintf(stderr, "%i chunk groups evicted when the eye last changed groups\n", stats.evictedGroups);
+        CullStats cull = get_cull_stats(renderer);
+        fprintf(stderr, "%zu chunk groups visible, %zu culled, %zu occluded\n", cull.visible, cull.culled, cull.occluded);
+        DrawStats draw = get_draw_stats(renderer);
+        fprintf(stderr, "%zu chunk group draws, %i recorded last frame\n", draw.drawnGroups, draw.recordedGroups);
+        GpuTimeStats gpu = get_gpu_time_stats(renderer);
+        if (gpu.frames != 0) {
+            fprintf(stderr, "GPU ms per frame (last %i): %.3f total, %.3f compute, %.3f quads, %.3f voxels, %.3f raycast\n",
+                gpu.frames, gpu.frameMs, gpu.computeMs, gpu.quadsMs, gpu.voxelMs, gpu.raycastMs);
+        }
+        LodStats lod = get_lod_stats(renderer);
+        fprintf(stderr, "Chunk groups per level of detail:");
+        for (size_t groups : lod.groups) fprintf(stderr, " %zu", groups);
+        fprintf(stderr, " (%i level chunks regenerated)\n", lod.updatedChunks);
+        fprintf(stderr, "%zu KiB of voxels in memory\n", world.memory_bytes() / 1024);
+        MemoryStats memory = get_memory_stats(renderer);
+        fprintf(stderr, "%zu device memory blocks (%llu KiB): %zu suballocations, %llu KiB used, %llu KiB requested, %.1f%% fragmented\n",
+            memory.blocks, (unsigned long long)(memory.blockBytes / 1024), memory.suballocations,
+            (unsigned long long)(memory.usedBytes / 1024), (unsigned long long)(memory.requestedBytes / 1024),
+            100.0 * memory.fragmentation);
+        fprintf(stderr, "%zu dedicated device memory allocations (%llu KiB)\n",
+            memory.dedicatedAllocations, (unsigned long long)(memory.dedicatedBytes / 1024));
+        fprintf(stderr, "Jobs on %i threads:\n", get_job_threads(renderer));
+        for (const JobStats& job : get_job_stats(renderer)) {
+            fprintf(stderr, "  %-16s %6zu jobs %8.3f ms total %8.3f ms max %8.3f ms wall\n",
+                job.name, job.count, job.totalMs, job.maxMs, job.wallMs);
+        }
+        return true;
+    };
+    window.add_key_target("print_render_stats", print_render_stats);
+
+    KeyTarget toggle_gpu_culling;
+    toggle_gpu_culling.down = [renderer] (KeyArg arg) -> bool
+    {
+        if (arg.repeat) return false;
+        set_gpu_culling(renderer, !get_gpu_culling(renderer));
+        fprintf(stderr, "GPU culling %s\n", get_gpu_culling(renderer) ? "on" : "off (or unsupported)");
+        return true;
+    };
+    window.add_key_target("toggle_gpu_culling", toggle_gpu_culling);
+
+    KeyTarget toggle_hiz_culling;
+    toggle_hiz_culling.down = [renderer] (KeyArg arg) -> bool
+    {
+        if (arg.repeat) return false;
+        set_hiz_culling(renderer, !get_hiz_culling(renderer));
+        fprintf(stderr, "Hi-Z culling %s\n", get_hiz_culling(renderer) ? "on" : "off (or unsupported)");
+        return true;
+    };
+    window.add_key_target("toggle_hiz_culling", toggle_hiz_culling);
+
+    // Pacing to presentation (the default) uses FIFO, pacing at the
+    // refresh rate; the other pacings use mailbox, so that presentation
+    // doesn't hold them back. cycle_present_mode can override that.
+    KeyTarget cycle_frame_pacing;
+    cycle_frame_pacing.down = [&window, renderer] (KeyArg arg) -> bool
+    {
+        if (arg.repeat) return false;
+        switch (window.get_frame_pacing()) {
+            case FramePacing::uncapped:
+                window.set_frame_pacing(FramePacing::target_fps);
+                fprintf(stderr, "Frame pacing: %.0f FPS\n", window.get_target_fps());
+                break;
+            case FramePacing::target_fps:
+                window.set_frame_pacing(FramePacing::present);
+                set_present_mode(renderer, PresentMode::fifo);
+                fprintf(stderr, "Frame pacing: presentation (FIFO)\n");
+                break;
+            case FramePacing::present:
+                window.set_frame_pacing(FramePacing::uncapped);
+                set_present_mode(renderer, PresentMode::mailbox);
+                fprintf(stderr, "Frame pacing: uncapped\n");
+                break;
+        }
+        return true;
+    };
+    window.add_key_target("cycle_frame_pacing", cycle_frame_pacing);
+
+    KeyTarget cycle_present_mode;
+    cycle_present_mode.down = [renderer] (KeyArg arg) -> bool
+    {
+        if (arg.repeat) return false;
+        switch (get_present_mode(renderer)) {
+            case PresentMode::fifo:
+                set_present_mode(renderer, PresentMode::mailbox);
+                fprintf(stderr, "Present mode: mailbox (or FIFO if unsupported)\n");
+                break;
+            case PresentMode::mailbox:
+                set_present_mode(renderer, PresentMode::immediate);
+                fprintf(stderr, "Present mode: immediate (or FIFO if unsupported)\n");
+                break;
+            case PresentMode::immediate:
+                set_present_mode(renderer, PresentMode::fifo);
+                fprintf(stderr, "Present mode: FIFO\n");
+                break;
+        }
+        return true;
+    };
+    window.add_key_target("cycle_present_mode", cycle_present_mode);
+
+    KeyTarget save_world;
+    save_world.down = [&world] (KeyArg arg) -> bool
+    {
+        if (arg.repeat) return false;
+        if (write_region(region_filename, world)) {
+            fprintf(stderr, "Saved world to %s\n", region_filename.c_str());
+        }
+        else {
+            fprintf(stderr, "Could not save world to %s\n", region_filename.c_str());
+            fprintf(stderr, "%s (%i)\n", strerror(errno), errno);
+        }
+        return true;
+    };
+    window.add_key_target("save_world", save_world);
 }
 
 // Given the full path of a key binds file, parse it for key bindings
@@ -328,6 +488,14 @@ bool add_key_binds_from_file(Window& window, std::string filename) noexcept
     return true; // I'm getting bogus EOF fails all the time so fake success :/
 }
 
+// Small hard-coded test scene.
+void add_test_voxels(VoxelWorld& world)
+{
+    world.set(2, 0, 2, Voxel::from_rgb(0x00, 0x80, 0xFF));
+    world.set(3, 0, 2, Voxel::from_rgb(0xFF, 0x80, 0x00));
+    world.set(3, 1, 2, Voxel::from_rgb(0x80, 0x80, 0x80));
+}
+
 void bind_keys(Window& window)
 {
     auto default_file = expand_filename("default-keybinds.txt");
@@ -368,8 +536,24 @@ int main(int argc, char** argv)
     for (int i = 0; i < 4; ++i) data_directory.pop_back();
     data_directory += "-data/";
 
-    // Instantiate the camera.
+    // Instantiate the camera and the voxel world, backed by the region
+    // file if one was given.
     Camera camera;
+    VoxelWorld world;
+    RegionFile region;
+    if (argc > 1) {
+        region_filename = argv[1];
+        if (!region.open(region_filename)) {
+            fprintf(stderr, "Could not open region file %s\n", region_filename.c_str());
+            fprintf(stderr, "%s (%i)\n", strerror(errno), errno);
+            return 1;
+        }
+        world.set_region(&region);
+    }
+    else {
+        region_filename = expand_filename("world.region");
+        add_test_voxels(world);
+    }
 
     // Create a window; callback ensures these window dimensions stay accurate.
     int screen_x = 0, screen_y = 0;
@@ -380,12 +564,16 @@ int main(int argc, char** argv)
         screen_y = y;
     };
     Window window(on_window_resize);
-    Renderer* renderer = new_renderer(window);
+    Renderer* renderer = new_renderer(window, world);
 
-    add_key_targets(window, camera);
+    add_key_targets(window, camera, world, renderer);
     bind_keys(window);
 
-    while (window.frame_update()) draw_frame(renderer, camera);
+    // Chunks left alone for a while are compressed, a few per frame.
+    while (window.frame_update()) {
+        draw_frame(renderer, camera);
+        world.compress_idle_chunks(max_frame_compress_attempts);
+    }
 
     delete_renderer(renderer);
 }
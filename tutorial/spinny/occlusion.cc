@@ -0,0 +1,252 @@
+#include "occlusion.hh"
+
+#include <math.h>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MYRICUBE_X86 1
+#endif
+
+namespace myricube {
+
+void find_occluders(const ChunkGroup& group, std::vector<OccluderBox>* out)
+{
+    out->clear();
+    constexpr int solid_count = chunk_size * chunk_size * chunk_size;
+    auto solid = [&group] (int cx, int cy, int cz)
+    {
+        const Chunk* chunk = group.get_chunk(cx, cy, cz);
+        return chunk != nullptr && chunk->visible_count == solid_count;
+    };
+
+    for (int cz = 0; cz < edge_chunks; ++cz) {
+        for (int cy = 0; cy < edge_chunks; ++cy) {
+            int cx = 0;
+            while (cx < edge_chunks) {
+                if (!solid(cx, cy, cz)) {
+                    ++cx;
+                    continue;
+                }
+                int end = cx + 1;
+                while (end < edge_chunks && solid(end, cy, cz)) ++end;
+
+                OccluderBox box;
+                box.lo[0] = int16_t(cx * chunk_size);
+                box.lo[1] = int16_t(cy * chunk_size);
+                box.lo[2] = int16_t(cz * chunk_size);
+                box.hi[0] = int16_t(end * chunk_size);
+                box.hi[1] = int16_t((cy + 1) * chunk_size);
+                box.hi[2] = int16_t((cz + 1) * chunk_size);
+                out->push_back(box);
+                cx = end;
+            }
+        }
+    }
+}
+
+void OcclusionBuffer::begin(const glm::mat4& view, const glm::mat4& projection, glm::dvec3 eye_)
+{
+    glm::mat4 rotation = view;
+    rotation[3] = glm::vec4(0, 0, 0, 1);
+    vp = projection * rotation;
+    eye = eye_;
+    std::fill(&depth[0][0], &depth[0][0] + occlusion_width * occlusion_height, 1.0f);
+}
+
+bool OcclusionBuffer::project(glm::dvec3 point, float* x, float* y, float* z) const
+{
+    glm::vec4 clip = vp * glm::vec4(glm::vec3(point - eye), 1.0f);
+    if (clip.z < 0 || clip.w <= 0) return false;
+    float inv_w = 1.0f / clip.w;
+    *x = (clip.x * inv_w * 0.5f + 0.5f) * occlusion_width;
+    *y = (clip.y * inv_w * 0.5f + 0.5f) * occlusion_height;
+    *z = clip.z * inv_w;
+    return true;
+}
+
+// Edge function E = a*x + b*y + c of a convex polygon's edge, and the
+// value E must reach at a pixel center for the whole pixel to be on
+// the inside (E >= 0) of the edge.
+struct Edge
+{
+    float a, b, c;
+    float threshold;
+};
+
+static inline float cross(glm::vec2 o, glm::vec2 a, glm::vec2 b)
+{
+    return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+}
+
+// Counterclockwise convex hull (monotone chain) of up to 8 points;
+// returns the vertex count.
+static int convex_hull(glm::vec2 points[8], glm::vec2 hull[16])
+{
+    std::sort(points, points + 8, [] (glm::vec2 p, glm::vec2 q)
+    {
+        return p.x < q.x || (p.x == q.x && p.y < q.y);
+    });
+    int k = 0;
+    for (int i = 0; i < 8; ++i) {
+        while (k >= 2 && cross(hull[k-2], hull[k-1], points[i]) <= 0) --k;
+        hull[k++] = points[i];
+    }
+    for (int i = 6, lower = k + 1; i >= 0; --i) {
+        while (k >= lower && cross(hull[k-2], hull[k-1], points[i]) <= 0) --k;
+        hull[k++] = points[i];
+    }
+    return k - 1;
+}
+
+// Lower depth to at most z over the pixels [x0, x1) of a row.
+static void min_span_scalar(float* row, int x0, int x1, float z)
+{
+    for (int x = x0; x < x1; ++x) row[x] = std::min(row[x], z);
+}
+
+#ifdef MYRICUBE_X86
+__attribute__((target("avx")))
+static void min_span_avx(float* row, int x0, int x1, float z)
+{
+    const __m256 z8 = _mm256_set1_ps(z);
+    int x = x0;
+    for (; x + 8 <= x1; x += 8) {
+        _mm256_storeu_ps(row + x, _mm256_min_ps(_mm256_loadu_ps(row + x), z8));
+    }
+    min_span_scalar(row, x, x1, z);
+}
+
+// True if any of the pixels [x0, x1) of the row is at least z.
+__attribute__((target("avx")))
+static bool any_at_least_avx(const float* row, int x0, int x1, float z)
+{
+    const __m256 z8 = _mm256_set1_ps(z);
+    int x = x0;
+    for (; x + 8 <= x1; x += 8) {
+        __m256 cmp = _mm256_cmp_ps(_mm256_loadu_ps(row + x), z8, _CMP_GE_OQ);
+        if (_mm256_movemask_ps(cmp) != 0) return true;
+    }
+    for (; x < x1; ++x) {
+        if (row[x] >= z) return true;
+    }
+    return false;
+}
+
+static bool cpu_has_avx()
+{
+    static const bool result = __builtin_cpu_supports("avx");
+    return result;
+}
+#endif
+
+static bool any_at_least_scalar(const float* row, int x0, int x1, float z)
+{
+    for (int x = x0; x < x1; ++x) {
+        if (row[x] >= z) return true;
+    }
+    return false;
+}
+
+void OcclusionBuffer::add_occluder(glm::dvec3 lo, glm::dvec3 hi)
+{
+    // Project the corners; the farthest one's depth is used for the
+    // whole box.
+    glm::vec2 points[8];
+    float z_max = 0;
+    for (int i = 0; i < 8; ++i) {
+        glm::dvec3 corner(i & 1 ? hi.x : lo.x, i & 2 ? hi.y : lo.y, i & 4 ? hi.z : lo.z);
+        float z;
+        if (!project(corner, &points[i].x, &points[i].y, &z)) return;
+        z_max = std::max(z_max, z);
+    }
+
+    glm::vec2 hull[16];
+    int count = convex_hull(points, hull);
+    if (count < 3) return;
+
+    float x_min = occlusion_width, x_max = 0, y_min = occlusion_height, y_max = 0;
+    Edge edges[8];
+    for (int i = 0; i < count; ++i) {
+        glm::vec2 p = hull[i], q = hull[i + 1 == count ? 0 : i + 1];
+        Edge& e = edges[i];
+        e.a = p.y - q.y;
+        e.b = q.x - p.x;
+        e.c = -(e.a * p.x + e.b * p.y);
+        e.threshold = 0.5f * (fabsf(e.a) + fabsf(e.b));
+        x_min = std::min(x_min, p.x);
+        x_max = std::max(x_max, p.x);
+        y_min = std::min(y_min, p.y);
+        y_max = std::max(y_max, p.y);
+    }
+
+    int x0 = std::max(int(floorf(x_min)), 0);
+    int x1 = std::min(int(ceilf(x_max)), occlusion_width);
+    int y0 = std::max(int(floorf(y_min)), 0);
+    int y1 = std::min(int(ceilf(y_max)), occlusion_height);
+    if (x0 >= x1 || y0 >= y1) return;
+
+    // The pixels of a row entirely inside the polygon form a span,
+    // bounded on the left by edges with a > 0 and on the right by edges
+    // with a < 0; horizontal edges (a == 0) accept or reject the row.
+    // The bounds are pulled in slightly against rounding.
+    for (int y = y0; y < y1; ++y) {
+        float py = y + 0.5f;
+        float span_lo = x0 + 0.5f, span_hi = x1 - 0.5f;
+        for (int i = 0; i < count; ++i) {
+            const Edge& e = edges[i];
+            float rest = e.threshold - e.b * py - e.c;
+            if (e.a > 0) span_lo = std::max(span_lo, rest / e.a + 1e-3f);
+            else if (e.a < 0) span_hi = std::min(span_hi, rest / e.a - 1e-3f);
+            else if (rest > 0) span_hi = -1;
+        }
+        if (span_lo > span_hi) continue;
+
+        // Pixels whose centers x + 0.5 are in [span_lo, span_hi].
+        int begin = int(ceilf(span_lo - 0.5f));
+        int end = int(floorf(span_hi - 0.5f)) + 1;
+#ifdef MYRICUBE_X86
+        if (cpu_has_avx()) {
+            min_span_avx(depth[y], begin, end, z_max);
+            continue;
+        }
+#endif
+        min_span_scalar(depth[y], begin, end, z_max);
+    }
+}
+
+bool OcclusionBuffer::occluded(glm::dvec3 lo, glm::dvec3 hi) const
+{
+    // Screen rectangle and nearest depth of the box.
+    float x_min = occlusion_width, x_max = 0, y_min = occlusion_height, y_max = 0;
+    float z_min = 1;
+    for (int i = 0; i < 8; ++i) {
+        glm::dvec3 corner(i & 1 ? hi.x : lo.x, i & 2 ? hi.y : lo.y, i & 4 ? hi.z : lo.z);
+        float x, y, z;
+        if (!project(corner, &x, &y, &z)) return false;
+        x_min = std::min(x_min, x);
+        x_max = std::max(x_max, x);
+        y_min = std::min(y_min, y);
+        y_max = std::max(y_max, y);
+        z_min = std::min(z_min, z);
+    }
+
+    int x0 = std::max(int(floorf(x_min)), 0);
+    int x1 = std::min(int(ceilf(x_max)), occlusion_width);
+    int y0 = std::max(int(floorf(y_min)), 0);
+    int y1 = std::min(int(ceilf(y_max)), occlusion_height);
+    if (x0 >= x1 || y0 >= y1) return false;
+
+    for (int y = y0; y < y1; ++y) {
+#ifdef MYRICUBE_X86
+        if (cpu_has_avx()) {
+            if (any_at_least_avx(depth[y], x0, x1, z_min)) return false;
+            continue;
+        }
+#endif
+        if (any_at_least_scalar(depth[y], x0, x1, z_min)) return false;
+    }
+    return true;
+}
+
+} // end namespace
@@ -0,0 +1,63 @@
+// Software occlusion culling. The fully solid chunks of nearby chunk
+// groups are rasterized as occluders into a small CPU depth buffer
+// (8 pixels at a time with AVX, when the CPU has it), then chunk group
+// boxes that are behind the buffer everywhere they cover are hidden.
+// Both sides are conservative: occluders only cover pixels they cover
+// entirely, at their farthest depth, and boxes are tested over their
+// whole screen rectangle at their nearest depth.
+#ifndef MYRICUBE_OCCLUSION_HH_
+#define MYRICUBE_OCCLUSION_HH_
+
+#include <stdint.h>
+#include <vector>
+
+#include "chunk.hh"
+#include "glm/glm.hpp"
+
+namespace myricube {
+
+// Box of fully solid chunks, in residue coordinates (hi exclusive).
+struct OccluderBox
+{
+    int16_t lo[3];
+    int16_t hi[3];
+};
+
+// Replace *out with boxes covering the fully solid chunks of the
+// group, with runs of them along x merged into one box.
+void find_occluders(const ChunkGroup& group, std::vector<OccluderBox>* out);
+
+// Size of the depth buffer, in pixels (width a multiple of 8).
+constexpr int occlusion_width = 256;
+constexpr int occlusion_height = 128;
+
+class OcclusionBuffer
+{
+    // Normalized device depth (0 near, 1 far) of the farthest
+    // occluder point covering each pixel; 1 where nothing does.
+    alignas(32) float depth[occlusion_height][occlusion_width];
+
+    // Eye-relative view-projection, and the eye.
+    glm::mat4 vp;
+    glm::dvec3 eye;
+
+    // Screen coordinates (pixels) and depth of a world point; false if
+    // it is behind the near plane.
+    bool project(glm::dvec3 point, float* x, float* y, float* z) const;
+
+  public:
+    // Clear the buffer for a new frame seen by the given camera; view
+    // must be a rigid (lookAt) transform, its translation is ignored.
+    void begin(const glm::mat4& view, const glm::mat4& projection, glm::dvec3 eye);
+
+    // Rasterize a box known to be opaque (world coordinates). Boxes
+    // crossing the near plane are skipped.
+    void add_occluder(glm::dvec3 lo, glm::dvec3 hi);
+
+    // True if the box (world coordinates) is certainly hidden behind
+    // the occluders added so far.
+    bool occluded(glm::dvec3 lo, glm::dvec3 hi) const;
+};
+
+} // end namespace
+#endif /* !MYRICUBE_OCCLUSION_HH_ */
@@ -0,0 +1,157 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+// Layout of the volume; keep in sync with volume.hh.
+#define CHUNK_SIZE 16
+#define EDGE_CHUNKS 16
+#define EMPTY_BRICK 0xFFFFFFFFu
+#define CHUNK_TABLE_WORDS (EDGE_CHUNKS * EDGE_CHUNKS * EDGE_CHUNKS)
+#define BRICK_WORDS (CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE)
+
+#define RED_SHIFT 24
+#define GREEN_SHIFT 16
+#define BLUE_SHIFT 8
+
+// Upper bounds on DDA steps, in case of float trouble. A ray crosses
+// at most 3 * 16 chunks of a group, and 3 * 16 voxels of a chunk.
+#define MAX_CHUNK_STEPS 48
+#define MAX_VOXEL_STEPS 48
+
+#define GROUP_SIZE 256
+
+// Camera of the frame (CameraUniform in render.cc), as in voxel.vert.
+layout(set=0, binding=0) uniform CameraBlock {
+    mat4 view_projection;   // Eye-relative (the view without translation).
+    ivec4 eye_group;        // Chunk group the eye is in,
+    vec4 eye_residue;       // and the eye's position within it.
+} camera;
+
+layout(push_constant) uniform RaycastPushConstantBlock {
+    ivec4 group;    // Chunk group coordinate; w is its level of detail.
+    ivec4 box_min;  // Bounding box of the volume in residue coordinates.
+    ivec4 box_max;
+} push;
+
+layout(set=1, binding=0) readonly buffer Volume {
+    uint words[];
+} volume;
+
+// Point on the (back face of the) bounding box; the ray goes from the
+// eye through here.
+layout(location=0) in vec3 v_residue_coord;
+
+layout(location=0) out vec4 out_color;
+
+// Shading for hits on faces perpendicular to x, y, and z.
+const vec3 axis_shade = vec3(0.8, 1.0, 0.9);
+
+void main() {
+    // The eye, and the group's origin relative to it, in residue
+    // coordinates of the drawn level of detail.
+    float voxel_size = float(1 << push.group.w);
+    vec3 group_offset = vec3(push.group.xyz - camera.eye_group.xyz) * GROUP_SIZE - camera.eye_residue.xyz;
+    vec3 origin = -group_offset / voxel_size;
+    vec3 dir = normalize(v_residue_coord - origin);
+    // Avoid dividing by zero: nudge axis-aligned directions slightly.
+    dir = mix(dir, vec3(1e-7), equal(dir, vec3(0)));
+    vec3 inv_dir = 1.0 / dir;
+    ivec3 step_dir = ivec3(sign(dir));
+    ivec3 step_pos = max(step_dir, ivec3(0));
+
+    // Clip the ray to the bounding box.
+    vec3 t0 = (vec3(push.box_min.xyz) - origin) * inv_dir;
+    vec3 t1 = (vec3(push.box_max.xyz) - origin) * inv_dir;
+    vec3 t_near = min(t0, t1);
+    vec3 t_far = max(t0, t1);
+    float t_enter = max(max(max(t_near.x, t_near.y), t_near.z), 0.0);
+    float t_exit = min(min(t_far.x, t_far.y), t_far.z);
+    if (t_enter >= t_exit) discard;
+
+    // Outer DDA over chunks. t is where the ray entered the current
+    // chunk; axis is the axis of the boundary it crossed to get there.
+    ivec3 chunk_min = push.box_min.xyz / CHUNK_SIZE;
+    ivec3 chunk_max = push.box_max.xyz / CHUNK_SIZE - 1;
+    float t = t_enter;
+    vec3 start = origin + dir * t;
+    ivec3 chunk = clamp(ivec3(floor(start / CHUNK_SIZE)), chunk_min, chunk_max);
+    vec3 chunk_t_max = (vec3((chunk + step_pos) * CHUNK_SIZE) - origin) * inv_dir;
+    vec3 chunk_t_delta = abs(CHUNK_SIZE * inv_dir);
+    int axis = t_near.x > t_near.y ? (t_near.x > t_near.z ? 0 : 2) : (t_near.y > t_near.z ? 1 : 2);
+
+    for (int i = 0; i < MAX_CHUNK_STEPS; ++i) {
+        float t_chunk_exit = min(min(chunk_t_max.x, chunk_t_max.y), chunk_t_max.z);
+        uint chunk_index = (chunk.z * EDGE_CHUNKS + chunk.y) * EDGE_CHUNKS + chunk.x;
+        uint brick = volume.words[chunk_index];
+
+        if (brick != EMPTY_BRICK) {
+            // Inner DDA over the voxels of this chunk.
+            uint brick_base = CHUNK_TABLE_WORDS + brick * BRICK_WORDS;
+            ivec3 chunk_origin = chunk * CHUNK_SIZE;
+            vec3 p = origin + dir * t;
+            ivec3 voxel = clamp(ivec3(floor(p)), chunk_origin, chunk_origin + CHUNK_SIZE - 1);
+            vec3 t_max = (vec3(voxel + step_pos) - origin) * inv_dir;
+            vec3 t_delta = abs(inv_dir);
+            float tv = t;
+            int voxel_axis = axis;
+
+            for (int j = 0; j < MAX_VOXEL_STEPS; ++j) {
+                ivec3 local = voxel - chunk_origin;
+                uint color = volume.words[brick_base + (local.z * CHUNK_SIZE + local.y) * CHUNK_SIZE + local.x];
+                if (color != 0u) {
+                    vec3 hit = origin + dir * tv;
+                    vec4 clip = camera.view_projection * vec4(hit * voxel_size + group_offset, 1);
+                    gl_FragDepth = clip.z / clip.w;
+
+                    float red   = ((color >> RED_SHIFT) & 255) * (1./255.);
+                    float green = ((color >> GREEN_SHIFT) & 255) * (1./255.);
+                    float blue  = ((color >> BLUE_SHIFT) & 255) * (1./255.);
+                    out_color = vec4(axis_shade[voxel_axis] * vec3(red, green, blue), 1);
+                    return;
+                }
+
+                if (t_max.x < t_max.y && t_max.x < t_max.z) {
+                    tv = t_max.x;
+                    t_max.x += t_delta.x;
+                    voxel.x += step_dir.x;
+                    voxel_axis = 0;
+                }
+                else if (t_max.y < t_max.z) {
+                    tv = t_max.y;
+                    t_max.y += t_delta.y;
+                    voxel.y += step_dir.y;
+                    voxel_axis = 1;
+                }
+                else {
+                    tv = t_max.z;
+                    t_max.z += t_delta.z;
+                    voxel.z += step_dir.z;
+                    voxel_axis = 2;
+                }
+                if (any(lessThan(voxel, chunk_origin)) || any(greaterThanEqual(voxel, chunk_origin + CHUNK_SIZE))) break;
+            }
+        }
+
+        // Step to the next chunk.
+        if (chunk_t_max.x < chunk_t_max.y && chunk_t_max.x < chunk_t_max.z) {
+            t = chunk_t_max.x;
+            chunk_t_max.x += chunk_t_delta.x;
+            chunk.x += step_dir.x;
+            axis = 0;
+        }
+        else if (chunk_t_max.y < chunk_t_max.z) {
+            t = chunk_t_max.y;
+            chunk_t_max.y += chunk_t_delta.y;
+            chunk.y += step_dir.y;
+            axis = 1;
+        }
+        else {
+            t = chunk_t_max.z;
+            chunk_t_max.z += chunk_t_delta.z;
+            chunk.z += step_dir.z;
+            axis = 2;
+        }
+        if (t > t_exit) break;
+        if (any(lessThan(chunk, chunk_min)) || any(greaterThan(chunk, chunk_max))) break;
+    }
+    discard;
+}
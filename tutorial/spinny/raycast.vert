@@ -0,0 +1,49 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+#define GROUP_SIZE 256
+
+// Camera of the frame (CameraUniform in render.cc), as in voxel.vert.
+layout(set=0, binding=0) uniform CameraBlock {
+    mat4 view_projection;   // Eye-relative (the view without translation).
+    ivec4 eye_group;        // Chunk group the eye is in,
+    vec4 eye_residue;       // and the eye's position within it.
+} camera;
+
+layout(push_constant) uniform RaycastPushConstantBlock {
+    ivec4 group;    // Chunk group coordinate; w is its level of detail.
+    ivec4 box_min;  // Bounding box of the volume in residue coordinates.
+    ivec4 box_max;
+} push;
+
+layout(location=0) out vec3 v_residue_coord;
+
+// No vertex inputs: draw 36 vertices to cover the volume's bounding
+// box. Same unit box as voxel.vert.
+vec3 unit_box_verts[36] = vec3[] (
+    vec3(0, 1, 1),    vec3(0, 1, 0),    vec3(0, 0, 1),
+    vec3(0, 1, 0),    vec3(0, 0, 0),    vec3(0, 0, 1), // -x face
+
+    vec3(1, 0, 0),    vec3(1, 1, 0),    vec3(1, 0, 1),
+    vec3(1, 1, 0),    vec3(1, 1, 1),    vec3(1, 0, 1), // +x face
+
+    vec3(0, 0, 0),    vec3(1, 0, 1),    vec3(0, 0, 1),
+    vec3(0, 0, 0),    vec3(1, 0, 0),    vec3(1, 0, 1), // -y face
+
+    vec3(1, 1, 1),    vec3(1, 1, 0),    vec3(0, 1, 0),
+    vec3(0, 1, 1),    vec3(1, 1, 1),    vec3(0, 1, 0), // +y face
+
+    vec3(0, 0, 0),    vec3(0, 1, 0),    vec3(1, 0, 0),
+    vec3(1, 1, 0),    vec3(1, 0, 0),    vec3(0, 1, 0), // -z face
+
+    vec3(0, 1, 1),    vec3(1, 0, 1),    vec3(1, 1, 1),
+    vec3(1, 0, 1),    vec3(0, 1, 1),    vec3(0, 0, 1));// +z face
+
+void main() {
+    vec3 box_size = vec3(push.box_max.xyz - push.box_min.xyz);
+    vec3 position = vec3(push.box_min.xyz) + unit_box_verts[gl_VertexIndex] * box_size;
+    v_residue_coord = position;
+    vec3 eye_relative = vec3(push.group.xyz - camera.eye_group.xyz) * GROUP_SIZE
+                      + position * float(1 << push.group.w) - camera.eye_residue.xyz;
+    gl_Position = camera.view_projection * vec4(eye_relative, 1);
+}
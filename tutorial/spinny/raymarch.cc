@@ -0,0 +1,222 @@
+#include "raymarch.hh"
+
+#include <math.h>
+#include <algorithm>
+
+namespace myricube {
+
+// Same constants as raycast.frag.
+constexpr int max_chunk_steps = 48;
+constexpr int max_voxel_steps = 48;
+static const float axis_shade[3] = { 0.8f, 1.0f, 0.9f };
+
+// Background, same as the renderer's clear color.
+static const float background[3] = { 0.1f, 0.1f, 0.1f };
+
+static inline int floor_int(float f)
+{
+    return int(floorf(f));
+}
+
+static inline int sign_int(float f)
+{
+    return (f > 0) - (f < 0);
+}
+
+// Index of the smallest component, preferring z then y on ties, which
+// is the order the DDA steps in raycast.frag resolve ties.
+static inline int min_axis(const float v[3])
+{
+    if (v[0] < v[1] && v[0] < v[2]) return 0;
+    return v[1] < v[2] ? 1 : 2;
+}
+
+bool raymarch_volume(
+    const RaycastVolume& volume,
+    glm::vec3 origin_, glm::vec3 dir_,
+    RayHit* out)
+{
+    if (volume.empty()) return false;
+
+    const float origin[3] = { origin_.x, origin_.y, origin_.z };
+    float dir[3] = { dir_.x, dir_.y, dir_.z };
+    float inv_dir[3];
+    int step_dir[3], step_pos[3];
+    float t_near[3], t_far[3];
+    for (int i = 0; i < 3; ++i) {
+        if (dir[i] == 0) dir[i] = 1e-7f;
+        inv_dir[i] = 1.0f / dir[i];
+        step_dir[i] = sign_int(dir[i]);
+        step_pos[i] = std::max(step_dir[i], 0);
+
+        float t0 = (float(volume.box_min[i]) - origin[i]) * inv_dir[i];
+        float t1 = (float(volume.box_max[i]) - origin[i]) * inv_dir[i];
+        t_near[i] = std::min(t0, t1);
+        t_far[i] = std::max(t0, t1);
+    }
+
+    // Clip the ray to the bounding box.
+    float t_enter = std::max(std::max(std::max(t_near[0], t_near[1]), t_near[2]), 0.0f);
+    float t_exit = std::min(std::min(t_far[0], t_far[1]), t_far[2]);
+    if (t_enter >= t_exit) return false;
+
+    // Outer DDA over chunks.
+    int chunk_min[3], chunk_max[3], chunk[3];
+    float chunk_t_max[3], chunk_t_delta[3];
+    float t = t_enter;
+    for (int i = 0; i < 3; ++i) {
+        chunk_min[i] = volume.box_min[i] / chunk_size;
+        chunk_max[i] = volume.box_max[i] / chunk_size - 1;
+        float start = origin[i] + dir[i] * t;
+        chunk[i] = std::min(std::max(floor_int(start / chunk_size), chunk_min[i]), chunk_max[i]);
+        chunk_t_max[i] = (float((chunk[i] + step_pos[i]) * chunk_size) - origin[i]) * inv_dir[i];
+        chunk_t_delta[i] = fabsf(chunk_size * inv_dir[i]);
+    }
+    int axis = t_near[0] > t_near[1] ? (t_near[0] > t_near[2] ? 0 : 2) : (t_near[1] > t_near[2] ? 1 : 2);
+
+    for (int i = 0; i < max_chunk_steps; ++i) {
+        uint32_t chunk_index = (chunk[2] * edge_chunks + chunk[1]) * edge_chunks + chunk[0];
+        uint32_t brick = volume.words[chunk_index];
+
+        if (brick != empty_brick) {
+            // Inner DDA over the voxels of this chunk.
+            const uint32_t* voxels = &volume.words[chunk_table_words + brick * brick_words];
+            int chunk_origin[3], voxel[3];
+            float t_max[3], t_delta[3];
+            for (int a = 0; a < 3; ++a) {
+                chunk_origin[a] = chunk[a] * chunk_size;
+                float p = origin[a] + dir[a] * t;
+                voxel[a] = std::min(std::max(floor_int(p), chunk_origin[a]), chunk_origin[a] + chunk_size - 1);
+                t_max[a] = (float(voxel[a] + step_pos[a]) - origin[a]) * inv_dir[a];
+                t_delta[a] = fabsf(inv_dir[a]);
+            }
+            float tv = t;
+            int voxel_axis = axis;
+
+            for (int j = 0; j < max_voxel_steps; ++j) {
+                int lx = voxel[0] - chunk_origin[0];
+                int ly = voxel[1] - chunk_origin[1];
+                int lz = voxel[2] - chunk_origin[2];
+                uint32_t color = voxels[(lz * chunk_size + ly) * chunk_size + lx];
+                if (color != 0) {
+                    out->t = tv;
+                    out->packed_color = color;
+                    out->axis = voxel_axis;
+                    return true;
+                }
+
+                int a = min_axis(t_max);
+                tv = t_max[a];
+                t_max[a] += t_delta[a];
+                voxel[a] += step_dir[a];
+                voxel_axis = a;
+                if (voxel[a] < chunk_origin[a] || voxel[a] >= chunk_origin[a] + chunk_size) break;
+            }
+        }
+
+        // Step to the next chunk.
+        int a = min_axis(chunk_t_max);
+        t = chunk_t_max[a];
+        chunk_t_max[a] += chunk_t_delta[a];
+        chunk[a] += step_dir[a];
+        axis = a;
+        if (t > t_exit) break;
+        if (chunk[a] < chunk_min[a] || chunk[a] > chunk_max[a]) break;
+    }
+    return false;
+}
+
+CpuRaymarcher::CpuRaymarcher(const VoxelWorld& world)
+{
+    for (const auto& pair : world.get_groups()) add_group(*pair.second);
+}
+
+void CpuRaymarcher::add_group(const ChunkGroup& group)
+{
+    make_raycast_volume(group, &volumes[group.get_coord()]);
+}
+
+bool CpuRaymarcher::trace(glm::dvec3 origin, glm::vec3 dir, double max_distance, RayHit* out) const
+{
+    // DDA over chunk groups, in double precision since world
+    // coordinates may be large; each group's volume is then marched
+    // in its own residue coordinates.
+    int32_t group[3];
+    int32_t step_dir[3];
+    double t_max[3], t_delta[3];
+    for (int i = 0; i < 3; ++i) {
+        double d = dir[i] == 0 ? 1e-7 : dir[i];
+        group[i] = int32_t(floor(origin[i] / group_size));
+        step_dir[i] = d > 0 ? 1 : -1;
+        double boundary = double(group[i] + (d > 0)) * group_size;
+        t_max[i] = (boundary - origin[i]) / d;
+        t_delta[i] = fabs(group_size / d);
+    }
+
+    double t = 0;
+    while (t <= max_distance) {
+        auto it = volumes.find(GroupCoord{ group[0], group[1], group[2] });
+        if (it != volumes.end()) {
+            glm::dvec3 group_origin = glm::dvec3(group[0], group[1], group[2]) * double(group_size);
+            if (raymarch_volume(it->second, glm::vec3(origin - group_origin), dir, out)) {
+                return out->t <= max_distance;
+            }
+        }
+
+        int a = t_max[0] < t_max[1] && t_max[0] < t_max[2] ? 0 : t_max[1] < t_max[2] ? 1 : 2;
+        t = t_max[a];
+        t_max[a] += t_delta[a];
+        group[a] += step_dir[a];
+    }
+    return false;
+}
+
+static inline uint32_t pack_rgba(float r, float g, float b)
+{
+    auto byte = [] (float f) -> uint32_t
+    {
+        return uint32_t(std::min(std::max(f, 0.0f), 1.0f) * 255.0f + 0.5f);
+    };
+    return byte(r) | byte(g) << 8 | byte(b) << 16 | 0xFFu << 24;
+}
+
+void CpuRaymarcher::render(Camera camera, int width, int height, uint32_t* rgba, JobSystem* jobs) const
+{
+    const glm::dvec3 eye = camera.get_eye();
+    const glm::vec3 forward = camera.get_forward_normal();
+    const glm::vec3 right = camera.get_right_normal();
+    const glm::vec3 up = camera.get_up_normal();
+    const float tan_half_fovy = tanf(camera.get_fovy_radians() * 0.5f);
+    const float aspect = float(width) / height;
+    const double max_distance = camera.get_far_plane();
+
+    JobGraph graph;
+    graph.add_range("raymarch", size_t(height), raymarch_rows_per_job, [&] (size_t y0, size_t y1, int) {
+        for (int y = int(y0); y < int(y1); ++y) {
+            float ndc_y = 1.0f - 2.0f * (y + 0.5f) / height;
+            for (int x = 0; x < width; ++x) {
+                float ndc_x = 2.0f * (x + 0.5f) / width - 1.0f;
+                glm::vec3 dir = glm::normalize(forward
+                    + right * (ndc_x * tan_half_fovy * aspect)
+                    + up * (ndc_y * tan_half_fovy));
+
+                RayHit hit;
+                uint32_t pixel;
+                if (trace(eye, dir, max_distance, &hit)) {
+                    float shade = axis_shade[hit.axis] * (1.0f / 255.0f);
+                    pixel = pack_rgba(
+                        float((hit.packed_color >> RED_SHIFT) & 255) * shade,
+                        float((hit.packed_color >> GREEN_SHIFT) & 255) * shade,
+                        float((hit.packed_color >> BLUE_SHIFT) & 255) * shade);
+                }
+                else {
+                    pixel = pack_rgba(background[0], background[1], background[2]);
+                }
+                rgba[size_t(y) * width + x] = pixel;
+            }
+        }
+    });
+    jobs->run(graph);
+}
+
+} // end namespace
@@ -0,0 +1,69 @@
+// CPU reference raymarcher. Traces rays through the same two-level
+// raycast volumes (volume.hh) with the same DDA as raycast.frag, so it
+// can serve as a correctness oracle for the GPU raycast path, and be
+// used to benchmark traversal without a GPU. Whole frames are rendered
+// in bands of rows, as jobs on a JobSystem.
+#ifndef MYRICUBE_RAYMARCH_HH_
+#define MYRICUBE_RAYMARCH_HH_
+
+#include <stdint.h>
+#include <unordered_map>
+
+#include "camera.hh"
+#include "chunk.hh"
+#include "jobs.hh"
+#include "volume.hh"
+
+namespace myricube {
+
+struct RayHit
+{
+    // Distance along the (unit) ray direction to the hit.
+    float t = 0;
+
+    // Voxel's packed color (as in Voxel).
+    uint32_t packed_color = 0;
+
+    // Axis (0, 1, 2 for x, y, z) of the voxel face that was hit.
+    int axis = 0;
+};
+
+// March a ray through a volume, with the origin in residue coordinates
+// of the volume's chunk group and a normalized direction. Step for
+// step the same as raycast.frag. Returns false on a miss.
+bool raymarch_volume(
+    const RaycastVolume& volume,
+    glm::vec3 origin, glm::vec3 dir,
+    RayHit* out);
+
+// Rows of pixels per job of CpuRaymarcher::render.
+constexpr int raymarch_rows_per_job = 8;
+
+class CpuRaymarcher
+{
+    std::unordered_map<GroupCoord, RaycastVolume, GroupCoordHash> volumes;
+
+  public:
+    CpuRaymarcher() = default;
+
+    // Snapshot the chunk groups of the world.
+    explicit CpuRaymarcher(const VoxelWorld& world);
+
+    // Add (or replace) one chunk group.
+    void add_group(const ChunkGroup& group);
+
+    // Trace a ray given in world coordinates (dir normalized) through
+    // all chunk groups in its path, up to max_distance. Returns false
+    // on a miss.
+    bool trace(glm::dvec3 origin, glm::vec3 dir, double max_distance, RayHit* out) const;
+
+    // Render the camera's view (up to its far plane) to width x height
+    // RGBA8 pixels, top row first. Each pixel is packed as
+    // R | G << 8 | B << 16 | A << 24 (bytes R, G, B, A in memory). The
+    // rows are traced in raymarch_rows_per_job bands, as jobs on the
+    // job system.
+    void render(Camera camera, int width, int height, uint32_t* rgba, JobSystem* jobs) const;
+};
+
+} // end namespace
+#endif /* !MYRICUBE_RAYMARCH_HH_ */
@@ -0,0 +1,276 @@
+#include "region.hh"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace myricube {
+
+static const char region_magic[8] = { 'M', 'Y', 'R', 'I', 'C', 'U', 'B', 'E' };
+
+static inline bool coord_less(GroupCoord a, GroupCoord b)
+{
+    if (a.x != b.x) return a.x < b.x;
+    if (a.y != b.y) return a.y < b.y;
+    return a.z < b.z;
+}
+
+static inline uint64_t round_up_to_page(uint64_t bytes)
+{
+    return (bytes + region_page_size - 1) / region_page_size * region_page_size;
+}
+
+RegionFile::~RegionFile()
+{
+    if (data != nullptr) munmap(const_cast<uint8_t*>(data), size);
+}
+
+bool RegionFile::open(const std::string& filename)
+{
+    int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        int stat_errno = errno;
+        close(fd);
+        errno = stat_errno;
+        return false;
+    }
+    if (size_t(st.st_size) < sizeof(RegionHeader)) {
+        close(fd);
+        errno = EINVAL;
+        return false;
+    }
+
+    // The mapping outlives the descriptor.
+    void* mapping = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    int mmap_errno = errno;
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        errno = mmap_errno;
+        return false;
+    }
+    // Groups are loaded in whatever order the camera needs them.
+    madvise(mapping, size_t(st.st_size), MADV_RANDOM);
+
+    const uint8_t* new_data = static_cast<const uint8_t*>(mapping);
+    size_t new_size = size_t(st.st_size);
+    const RegionHeader* header = reinterpret_cast<const RegionHeader*>(new_data);
+    bool valid = memcmp(header->magic, region_magic, sizeof region_magic) == 0
+        && header->version == region_version
+        && header->page_size == region_page_size
+        && header->index_offset % region_page_size == 0
+        && header->index_offset <= new_size
+        && header->group_count <= (new_size - header->index_offset) / sizeof(RegionIndexEntry);
+    if (!valid) {
+        munmap(mapping, new_size);
+        errno = EINVAL;
+        return false;
+    }
+
+    if (data != nullptr) munmap(const_cast<uint8_t*>(data), size);
+    data = new_data;
+    size = new_size;
+    index = reinterpret_cast<const RegionIndexEntry*>(data + header->index_offset);
+    count = size_t(header->group_count);
+    return true;
+}
+
+const RegionIndexEntry* RegionFile::find(GroupCoord c) const
+{
+    const RegionIndexEntry* end = index + count;
+    const RegionIndexEntry* it = std::lower_bound(index, end, c,
+        [] (const RegionIndexEntry& entry, GroupCoord key) {
+            return coord_less(GroupCoord{ entry.x, entry.y, entry.z }, key);
+        });
+    if (it == end || GroupCoord{ it->x, it->y, it->z } != c) return nullptr;
+    return it;
+}
+
+const uint8_t* RegionFile::payload(const RegionIndexEntry& entry) const
+{
+    uint64_t bytes = region_payload_bytes(entry.chunk_count);
+    if (entry.payload_offset % region_page_size != 0) return nullptr;
+    if (entry.payload_offset > size || bytes > size - entry.payload_offset) return nullptr;
+    return data + entry.payload_offset;
+}
+
+std::unique_ptr<ChunkGroup> RegionFile::load_group(GroupCoord c) const
+{
+    const RegionIndexEntry* entry = find(c);
+    if (entry == nullptr) return nullptr;
+    const uint8_t* bytes = payload(*entry);
+    if (bytes == nullptr) {
+        fprintf(stderr, "Region chunk group (%i, %i, %i) out of bounds\n", int(c.x), int(c.y), int(c.z));
+        return nullptr;
+    }
+    size_t payload_size = size_t(region_payload_bytes(entry->chunk_count));
+    void* range = const_cast<uint8_t*>(bytes);
+    madvise(range, payload_size, MADV_WILLNEED);
+
+    const RegionGroupHeader* group_header = reinterpret_cast<const RegionGroupHeader*>(bytes);
+    uint32_t stored = 0;
+    for (uint64_t word : group_header->chunk_bits) stored += uint32_t(__builtin_popcountll(word));
+    if (stored != entry->chunk_count) {
+        fprintf(stderr, "Region chunk group (%i, %i, %i) corrupt\n", int(c.x), int(c.y), int(c.z));
+        return nullptr;
+    }
+
+    auto group = std::make_unique<ChunkGroup>(c);
+    const Voxel* voxels = reinterpret_cast<const Voxel*>(bytes + region_page_size);
+    for (int i = 0; i < edge_chunks * edge_chunks * edge_chunks; ++i) {
+        if (!(group_header->chunk_bits[i / 64] >> (i % 64) & 1)) continue;
+        auto chunk = std::make_unique<Chunk>();
+        chunk->assign(voxels);
+        chunk->compress();      // Nothing has edited it yet.
+        voxels += chunk_voxels;
+        group->set_chunk(i % edge_chunks, i / edge_chunks % edge_chunks, i / (edge_chunks * edge_chunks), std::move(chunk));
+    }
+
+    // The group is copied; its pages can go (they are clean).
+    madvise(range, payload_size, MADV_DONTNEED);
+    return group;
+}
+
+void VoxelWorld::set_region(const RegionFile* region_)
+{
+    region = region_;
+    load_region_group = [] (const RegionFile* file, GroupCoord c)
+    {
+        return file->load_group(c);
+    };
+}
+
+// Write zeros up to the next page boundary after the given number of
+// bytes (written so far).
+static bool pad_to_page(FILE* file, uint64_t bytes)
+{
+    static const uint8_t zeros[region_page_size] = {};
+    size_t padding = size_t(round_up_to_page(bytes) - bytes);
+    return fwrite(zeros, 1, padding, file) == padding;
+}
+
+bool write_region(const std::string& filename, const VoxelWorld& world)
+{
+    // Chunk groups in memory, then those only in the region file.
+    struct Group
+    {
+        GroupCoord coord;
+        const ChunkGroup* loaded;
+        const RegionIndexEntry* stored;
+        uint32_t chunk_count;
+    };
+    std::vector<Group> groups;
+
+    for (const auto& pair : world.get_groups()) {
+        const ChunkGroup& group = *pair.second;
+        if (group.empty()) continue;
+        uint32_t chunk_count = 0;
+        for (int cz = 0; cz < edge_chunks; ++cz) {
+            for (int cy = 0; cy < edge_chunks; ++cy) {
+                for (int cx = 0; cx < edge_chunks; ++cx) {
+                    chunk_count += group.get_chunk(cx, cy, cz) != nullptr;
+                }
+            }
+        }
+        groups.push_back(Group{ pair.first, &group, nullptr, chunk_count });
+    }
+    if (const RegionFile* region = world.get_region()) {
+        for (size_t i = 0; i < region->group_count(); ++i) {
+            GroupCoord c = region->group_coord(i);
+            if (world.get_groups().count(c) != 0) continue;
+            const RegionIndexEntry* entry = region->find(c);
+            if (entry == nullptr || region->payload(*entry) == nullptr) continue;
+            groups.push_back(Group{ c, nullptr, entry, entry->chunk_count });
+        }
+    }
+    std::sort(groups.begin(), groups.end(), [] (const Group& a, const Group& b) {
+        return coord_less(a.coord, b.coord);
+    });
+
+    RegionHeader header{};
+    memcpy(header.magic, region_magic, sizeof region_magic);
+    header.version = region_version;
+    header.page_size = region_page_size;
+    header.group_count = groups.size();
+    header.index_offset = region_page_size;
+
+    std::vector<RegionIndexEntry> index(groups.size());
+    uint64_t offset = header.index_offset + round_up_to_page(sizeof(RegionIndexEntry) * groups.size());
+    for (size_t i = 0; i < groups.size(); ++i) {
+        index[i].x = groups[i].coord.x;
+        index[i].y = groups[i].coord.y;
+        index[i].z = groups[i].coord.z;
+        index[i].chunk_count = groups[i].chunk_count;
+        index[i].payload_offset = offset;
+        offset += region_payload_bytes(groups[i].chunk_count);
+    }
+
+    std::string temp_filename = filename + ".tmp";
+    FILE* file = fopen(temp_filename.c_str(), "wb");
+    if (file == nullptr) return false;
+
+    std::vector<Voxel> scratch(chunk_voxels);
+    bool okay = fwrite(&header, sizeof header, 1, file) == 1
+        && pad_to_page(file, sizeof header)
+        && fwrite(index.data(), sizeof(RegionIndexEntry), index.size(), file) == index.size()
+        && pad_to_page(file, sizeof(RegionIndexEntry) * index.size());
+
+    for (size_t i = 0; okay && i < groups.size(); ++i) {
+        const Group& g = groups[i];
+        if (g.stored != nullptr) {
+            const uint8_t* bytes = world.get_region()->payload(*g.stored);
+            size_t payload_size = size_t(region_payload_bytes(g.chunk_count));
+            okay = fwrite(bytes, 1, payload_size, file) == payload_size;
+            continue;
+        }
+
+        RegionGroupHeader group_header{};
+        for (int cz = 0; cz < edge_chunks; ++cz) {
+            for (int cy = 0; cy < edge_chunks; ++cy) {
+                for (int cx = 0; cx < edge_chunks; ++cx) {
+                    int c = (cz * edge_chunks + cy) * edge_chunks + cx;
+                    if (g.loaded->get_chunk(cx, cy, cz) != nullptr) group_header.chunk_bits[c / 64] |= uint64_t(1) << (c % 64);
+                }
+            }
+        }
+        okay = fwrite(&group_header, sizeof group_header, 1, file) == 1
+            && pad_to_page(file, sizeof group_header);
+
+        for (int cz = 0; okay && cz < edge_chunks; ++cz) {
+            for (int cy = 0; okay && cy < edge_chunks; ++cy) {
+                for (int cx = 0; okay && cx < edge_chunks; ++cx) {
+                    const Chunk* chunk = g.loaded->get_chunk(cx, cy, cz);
+                    if (chunk == nullptr) continue;
+                    chunk->decode(scratch.data());
+                    okay = fwrite(scratch.data(), sizeof(Voxel), scratch.size(), file) == scratch.size();
+                }
+            }
+        }
+    }
+
+    int write_errno = errno;
+    if (fclose(file) != 0 && okay) {
+        okay = false;
+        write_errno = errno;
+    }
+    if (okay && rename(temp_filename.c_str(), filename.c_str()) != 0) {
+        okay = false;
+        write_errno = errno;
+    }
+    if (!okay) {
+        remove(temp_filename.c_str());
+        errno = write_errno;
+    }
+    return okay;
+}
+
+} // end namespace
@@ -0,0 +1,111 @@
+// Region files: a whole voxel world on disk, laid out so that it can
+// be memory-mapped and its chunk groups loaded one at a time, with no
+// parsing beyond a binary search of the index table. Only the pages of
+// the groups actually loaded are ever read from disk.
+//
+// Layout (little-endian, page_size = 4096 bytes):
+//
+//   * RegionHeader, padded to a page.
+//   * RegionIndexEntry for each chunk group, sorted by (x, y, z), at
+//     RegionHeader::index_offset, padded to a page.
+//   * For each chunk group, at its page-aligned payload_offset: a page
+//     holding RegionGroupHeader, then the group's non-empty chunks in
+//     the order of its chunk bits, each its chunk_voxels voxels in
+//     [z][y][x] order (16 KiB, so every chunk is page-aligned too).
+#ifndef MYRICUBE_REGION_HH_
+#define MYRICUBE_REGION_HH_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <string>
+
+#include "chunk.hh"
+
+namespace myricube {
+
+constexpr uint32_t region_version = 1;
+constexpr uint64_t region_page_size = 4096;
+constexpr uint64_t region_chunk_bytes = sizeof(Voxel) * chunk_voxels;
+static_assert(region_chunk_bytes % region_page_size == 0, "chunks must stay page-aligned");
+
+struct RegionHeader
+{
+    char magic[8];              // "MYRICUBE"
+    uint32_t version;           // region_version
+    uint32_t page_size;         // region_page_size
+    uint64_t group_count;
+    uint64_t index_offset;
+};
+
+struct RegionIndexEntry
+{
+    int32_t x, y, z;
+    uint32_t chunk_count;
+    uint64_t payload_offset;
+};
+
+// Bit i (of word i / 64) is set iff the chunk with index
+// i = (cz * edge_chunks + cy) * edge_chunks + cx is stored.
+struct RegionGroupHeader
+{
+    uint64_t chunk_bits[edge_chunks * edge_chunks * edge_chunks / 64];
+};
+
+static_assert(sizeof(RegionHeader) == 32, "RegionHeader layout");
+static_assert(sizeof(RegionIndexEntry) == 24, "RegionIndexEntry layout");
+static_assert(sizeof(RegionGroupHeader) <= region_page_size, "RegionGroupHeader must fit a page");
+
+// Bytes of a chunk group's payload.
+inline uint64_t region_payload_bytes(uint32_t chunk_count)
+{
+    return region_page_size + chunk_count * region_chunk_bytes;
+}
+
+// Read-only memory mapping of a region file.
+class RegionFile
+{
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+    const RegionIndexEntry* index = nullptr;
+    size_t count = 0;
+
+  public:
+    RegionFile() = default;
+    RegionFile(RegionFile&&) = delete;
+    ~RegionFile();
+
+    // Map the file. Returns true iff successful (check errno on false;
+    // EINVAL if it isn't a valid region file).
+    bool open(const std::string& filename);
+
+    size_t group_count() const
+    {
+        return count;
+    }
+
+    GroupCoord group_coord(size_t i) const
+    {
+        return GroupCoord{ index[i].x, index[i].y, index[i].z };
+    }
+
+    // Index entry of the chunk group, or nullptr if it isn't stored.
+    const RegionIndexEntry* find(GroupCoord c) const;
+
+    // The group's payload bytes (region_payload_bytes of its chunk
+    // count), or nullptr if they are out of the file's bounds.
+    const uint8_t* payload(const RegionIndexEntry& entry) const;
+
+    // Copy the chunk group out of the mapping, faulting in its pages;
+    // nullptr if it isn't stored (or its payload is corrupt).
+    std::unique_ptr<ChunkGroup> load_group(GroupCoord c) const;
+};
+
+// Write all chunk groups of the world, including those of its region
+// file not loaded yet, to a new region file. It is written under a
+// temporary name and renamed, so it may replace the world's own region
+// file. Returns true iff successful (check errno on false).
+bool write_region(const std::string& filename, const VoxelWorld& world);
+
+} // end namespace
+#endif /* !MYRICUBE_REGION_HH_ */
@@ -20,31 +20,31 @@
 #include <chrono>
 #include <vector>
 #include <cstring>
+#include <cstdio>
 #include <cstdlib>
 #include <cstdint>
+#include <cmath>
 #include <array>
+#include <memory>
 #include <optional>
 #include <set>
+#include <unordered_map>
+#include <unordered_set>
 
+#include "buddy.hh"
 #include "camera.hh"
+#include "chunk.hh"
+#include "cull.hh"
+#include "faces.hh"
+#include "greedy.hh"
+#include "jobs.hh"
+#include "lod.hh"
+#include "occlusion.hh"
+#include "region.hh"
 #include "util.hh"
+#include "volume.hh"
 #include "window.hh"
 
-#define NEG_X_FACE_BIT (1 << 24)
-#define POS_X_FACE_BIT (1 << 25)
-#define NEG_Y_FACE_BIT (1 << 26)
-#define POS_Y_FACE_BIT (1 << 27)
-#define NEG_Z_FACE_BIT (1 << 28)
-#define POS_Z_FACE_BIT (1 << 29)
-
-#define X_SHIFT 0
-#define Y_SHIFT 8
-#define Z_SHIFT 16
-
-#define RED_SHIFT 24
-#define GREEN_SHIFT 16
-#define BLUE_SHIFT 8
-
 const uint32_t WIDTH = 800;
 const uint32_t HEIGHT = 600;
 
@@ -84,6 +84,10 @@ struct QueueFamilyIndices {
     std::optional<uint32_t> graphicsFamily;
     std::optional<uint32_t> presentFamily;
 
+    // A family with transfer but no graphics support, if any (see
+    // Renderer::TransferBatch).
+    std::optional<uint32_t> transferFamily;
+
     bool isComplete() {
         return graphicsFamily.has_value() && presentFamily.has_value();
     }
@@ -125,10 +129,7 @@ struct Vertex {
     }
 };
 
-struct VoxelVertex {
-    uint32_t packed_residue_face_bits;
-    uint32_t packed_color;
-
+struct VoxelVertex : myricube::VoxelInstance {
     static VkVertexInputBindingDescription getBindingDescription() {
         VkVertexInputBindingDescription bindingDescription{};
         bindingDescription.binding = 0;
@@ -155,11 +156,131 @@ struct VoxelVertex {
     }
 };
 
+// Instance lists from the face generator are uploaded as-is.
+static_assert(sizeof(VoxelVertex) == sizeof(myricube::VoxelInstance), "VoxelVertex layout");
+
+// Vertex of a greedy mesh (per-vertex, not instanced).
+struct GreedyVertex : myricube::MeshVertex {
+    static VkVertexInputBindingDescription getBindingDescription() {
+        VkVertexInputBindingDescription bindingDescription{};
+        bindingDescription.binding = 0;
+        bindingDescription.stride = sizeof(GreedyVertex);
+        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+        return bindingDescription;
+    }
+
+    static std::array<VkVertexInputAttributeDescription, 2> getAttributeDescriptions() {
+        std::array<VkVertexInputAttributeDescription, 2> attributeDescriptions{};
+
+        attributeDescriptions[0].binding = 0;
+        attributeDescriptions[0].location = 0;
+        attributeDescriptions[0].format = VK_FORMAT_R32_UINT;
+        attributeDescriptions[0].offset = offsetof(GreedyVertex, packed_position);
+
+        attributeDescriptions[1].binding = 0;
+        attributeDescriptions[1].location = 1;
+        attributeDescriptions[1].format = VK_FORMAT_R32_UINT;
+        attributeDescriptions[1].offset = offsetof(GreedyVertex, packed_color);
+
+        return attributeDescriptions;
+    }
+};
+
+static_assert(sizeof(GreedyVertex) == sizeof(myricube::MeshVertex), "GreedyVertex layout");
+
 struct PushConstant {
     glm::mat4 mvp;
     glm::vec4 color;
 };
 
+// Uniform block of the chunk group shaders (std140): the camera of
+// the frame. Positions are made relative to the eye before the
+// view-projection, so they stay precise far from the world's origin.
+struct CameraUniform {
+    glm::mat4 viewProjection;   // Eye-relative (the view without translation).
+    glm::ivec4 eyeGroup;        // Chunk group the eye is in,
+    glm::vec4 eyeResidue;       // and the eye's position within it.
+};
+
+static_assert(sizeof(CameraUniform) == 96, "CameraUniform layout (std140)");
+
+// Split the eye's position into its chunk group and its position
+// within that group, as CameraUniform (and the GPU culling) has them.
+static void splitEye(glm::dvec3 eye, glm::ivec4* group, glm::vec4* residue)
+{
+    glm::dvec3 eyeGroup = glm::floor(eye / double(myricube::group_size));
+    *group = glm::ivec4(glm::ivec3(eyeGroup), 0);
+    *residue = glm::vec4(glm::vec3(eye - eyeGroup * double(myricube::group_size)), 1);
+}
+
+// Push constants of voxel.vert, face.vert and greedy.vert: all they
+// need of the chunk group drawn.
+struct GroupPushConstant {
+    glm::ivec4 group;       // Group coordinate; w is the level of detail.
+};
+
+// Push constants of raycast.vert and raycast.frag.
+struct RaycastPushConstant {
+    glm::ivec4 group;       // As in GroupPushConstant.
+    glm::ivec4 boxMin;      // Bounding box of the RaycastVolume.
+    glm::ivec4 boxMax;
+};
+
+// GPU culling (cull.comp and face.vert built with INDIRECT); keep
+// these in sync with the shaders. One GpuCullRecord per uploaded chunk
+// group, with its group coordinate (its box is the whole group) and
+// level of detail, as in GroupPushConstant, and the device address of
+// its instance buffer. Like the CameraUniform, the shaders only ever
+// use positions relative to the eye, given as a group and residue.
+struct GpuCullRecord {
+    glm::ivec4 group;       // Group coordinate; w is the level of detail.
+    uint32_t instanceCount;  // 0 if the group isn't drawn from instances.
+    uint32_t padding;
+    VkDeviceAddress instanceAddress;
+};
+
+// One per visible group, appended by cull.comp; the draw command
+// followed by what face.vert needs to find the group's instances.
+struct GpuDraw {
+    VkDrawIndirectCommand command;
+    glm::ivec4 group;       // As in GpuCullRecord.
+    VkDeviceAddress instanceAddress;
+    uint64_t padding;
+};
+
+static_assert(sizeof(GpuCullRecord) == 32, "GpuCullRecord layout (std430)");
+static_assert(sizeof(GpuDraw) == 48, "GpuDraw layout (std430)");
+
+// Push constants of cull.comp; the planes and far distance of a
+// CullFrustum, and the eye as in CameraUniform.
+struct GpuCullPushConstant {
+    glm::vec4 planes[6];    // Eye-relative.
+    glm::ivec4 eyeGroup;
+    glm::vec4 eyeResidue;   // w is the far distance squared.
+    uint32_t recordCount;
+};
+
+// Uniform block of cull.comp for its Hi-Z test (std140).
+struct GpuHiZParams {
+    glm::mat4 viewProjection;   // Eye-relative, of the frame in the pyramid.
+    glm::ivec4 eyeGroup;        // That frame's eye, as in CameraUniform.
+    glm::vec4 eyeResidue;
+    glm::ivec2 depthSize;
+    glm::ivec2 baseSize;
+    int32_t levelCount;
+    int32_t enabled;
+    int32_t padding[2];
+};
+
+static_assert(sizeof(GpuHiZParams) == 128, "GpuHiZParams layout (std140)");
+
+// Push constants of hiz.comp.
+struct HiZPushConstant {
+    glm::ivec2 sourceSize;
+    int32_t fromDepth;
+};
+
 const std::vector<Vertex> vertices = {
     {{-0.5f, -0.5f, 0.0f}, {1.0f, 0.0f}},
     {{0.5f, -0.5f, 0.0f}, {0.0f, 0.0f}},
@@ -177,24 +298,58 @@ const std::vector<uint16_t> indices = {
     4, 5, 6, 6, 7, 4
 };
 
-const std::vector<VoxelVertex> voxels = [] {
-    std::vector<VoxelVertex> result;
-    result.push_back({ 0xFF000002 & ~POS_X_FACE_BIT, 0x0080FF00 });
-    result.push_back({ 0xFF000003 & ~NEG_X_FACE_BIT & ~POS_Y_FACE_BIT, 0xFF800000 });
-    result.push_back({ 0xFF000103 & ~NEG_Y_FACE_BIT, 0x80808000 });
-    return result;
-} ();
-
 using myricube::Window;
+using myricube::BuddyAllocator;
 using myricube::Camera;
+using myricube::ChunkGroup;
+using myricube::CullBoxes;
+using myricube::CullFrustum;
+using myricube::GroupCoord;
+using myricube::GroupCoordHash;
+using myricube::GreedyMesh;
+using myricube::GroupLod;
+using myricube::RaycastVolume;
+using myricube::RegionFile;
+using myricube::InstanceList;
+using myricube::JobGraph;
+using myricube::JobId;
+using myricube::JobSystem;
+using myricube::OccluderBox;
+using myricube::OcclusionBuffer;
+using myricube::OccupancyGrid;
+using myricube::Voxel;
+using myricube::VoxelInstance;
+using myricube::VoxelLayout;
+using myricube::VoxelWorld;
 
 class Renderer {
-    friend Renderer* new_renderer(Window&);
+    friend Renderer* new_renderer(Window&, VoxelWorld&);
     friend void delete_renderer(Renderer*);
     friend void draw_frame(Renderer*, const Camera&);
-
-    Renderer(Window& w)
+    friend void set_voxel(Renderer*, int32_t, int32_t, int32_t, Voxel);
+    friend void set_voxel_layout(Renderer*, VoxelLayout);
+    friend VoxelLayout get_voxel_layout(const Renderer*);
+    friend void set_present_mode(Renderer*, PresentMode);
+    friend PresentMode get_present_mode(const Renderer*);
+    friend uint64_t get_voxel_vertex_count(const Renderer*);
+    friend void set_group_greedy(Renderer*, GroupCoord, bool);
+    friend bool get_group_greedy(const Renderer*, GroupCoord);
+    friend StreamStats get_stream_stats(const Renderer*);
+    friend CullStats get_cull_stats(const Renderer*);
+    friend DrawStats get_draw_stats(const Renderer*);
+    friend GpuTimeStats get_gpu_time_stats(const Renderer*);
+    friend LodStats get_lod_stats(const Renderer*);
+    friend MemoryStats get_memory_stats(const Renderer*);
+    friend void set_gpu_culling(Renderer*, bool);
+    friend bool get_gpu_culling(const Renderer*);
+    friend void set_hiz_culling(Renderer*, bool);
+    friend bool get_hiz_culling(const Renderer*);
+    friend std::vector<JobStats> get_job_stats(const Renderer*);
+    friend int get_job_threads(const Renderer*);
+
+    Renderer(Window& w, VoxelWorld& world_) : world(world_)
     {
+        workerOccupancy.resize(jobSystem.thread_count());
         window = w.get_glfw_window();
         initVulkan();
     }
@@ -215,6 +370,46 @@ class Renderer {
 
     VkQueue graphicsQueue;
     VkQueue presentQueue;
+    uint32_t graphicsFamily = 0;
+
+    // Device memory of all buffers and images is suballocated from
+    // memoryBlockSize blocks (see allocateMemory), so there are only a
+    // few vkAllocateMemory allocations (which maxMemoryAllocationCount
+    // limits, to as few as 4096) however many chunk groups are
+    // uploaded. A pool holds the blocks of one memory type, either for
+    // buffers or for optimal tiling images; keeping the two apart means
+    // bufferImageGranularity never matters. Each block places its
+    // allocations with a buddy allocator. Allocations of more than a
+    // quarter block get memory of their own (dedicated).
+    static constexpr VkDeviceSize memoryBlockSize = VkDeviceSize(64) << 20;
+    static constexpr VkDeviceSize memoryMinAllocation = 256;
+
+    struct MemoryBlock
+    {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        std::unique_ptr<BuddyAllocator> allocator;
+    };
+
+    struct MemoryPool
+    {
+        uint32_t memoryType;
+        bool optimalImages;
+        std::vector<MemoryBlock> blocks;
+    };
+    std::vector<MemoryPool> memoryPools;
+    size_t dedicatedAllocations = 0;
+    VkDeviceSize dedicatedBytes = 0;
+
+    // Bytes [offset, offset + size) of memory, from memoryPools[pool]
+    // unless dedicated. Bind resources with the offset.
+    struct MemoryAllocation
+    {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize offset = 0;
+        VkDeviceSize size = 0;
+        uint32_t pool = 0;
+        bool dedicated = false;
+    };
 
     // Data that is duplicated per swap chain image (e.g. framebuffers)
     struct PerImage
@@ -237,6 +432,12 @@ class Renderer {
     VkFormat swapChainImageFormat;
     VkExtent2D swapChainExtent;
 
+    // Present mode asked for by set_present_mode (the swap chain falls
+    // back to FIFO if it's unsupported), and whether the swap chain
+    // must be recreated for it.
+    PresentMode presentMode = PresentMode::fifo;
+    bool presentModeChanged = false;
+
     VkRenderPass renderPass;
     VkDescriptorSetLayout descriptorSetLayout;
     VkPipelineLayout pipelineLayout;
@@ -244,17 +445,133 @@ class Renderer {
 
     // My stuff for voxel drawing test.
     VkPipelineLayout voxelPipelineLayout;
-    VkPipeline voxelPipeline;
+    VkPipeline voxelPipeline;       // VoxelLayout::box
+    VkPipeline faceVoxelPipeline;   // VoxelLayout::face
+    VkPipeline greedyPipeline;      // Greedy meshed chunk groups
+
+    // Camera of the frame for the chunk group shaders (set 0 of
+    // voxelPipelineLayout and raycastPipelineLayout). There's one
+    // buffer for all frames, updated at the start of each (see
+    // recordCameraUpdate) once the previous frame is done reading it,
+    // so the groups' draws don't depend on the frame.
+    VkBuffer cameraBuffer = VK_NULL_HANDLE;
+    MemoryAllocation cameraMemory;
+    VkDescriptorSetLayout cameraDescriptorSetLayout = VK_NULL_HANDLE;
+    VkDescriptorPool cameraDescriptorPool = VK_NULL_HANDLE;
+    VkDescriptorSet cameraDescriptorSet = VK_NULL_HANDLE;
+
+    // Each chunk group is drawn by a secondary command buffer of its
+    // own, recorded once and executed by every frame it is visible in
+    // (see addGroupDrawJobs). They're recorded by jobs, each from the
+    // pool of the thread running it (indexed by job worker). The
+    // statistics of the last frame.
+    std::vector<VkCommandPool> drawCommandPools;
+    DrawStats drawStats;
+
+    // The group draws the frame executes, in the order of DrawRange
+    // (see gatherGroupDraws); the raycast groups' start at
+    // raycastDrawBegin.
+    std::vector<VkCommandBuffer> groupDrawCommands;
+    size_t raycastDrawBegin = 0;
+
+    // Raycasting far chunk groups; one descriptor set (the volume's
+    // storage buffer) per raycast group. The sets come from a chain of
+    // pools of raycastPoolSets each, added to as they fill up (see
+    // allocateRaycastDescriptorSet), so there's no limit on the number
+    // of raycast groups.
+    struct RaycastDescriptorPool
+    {
+        VkDescriptorPool pool = VK_NULL_HANDLE;
+        uint32_t sets = 0;
+    };
+    VkDescriptorSetLayout raycastDescriptorSetLayout;
+    std::vector<RaycastDescriptorPool> raycastDescriptorPools;
+    VkPipelineLayout raycastPipelineLayout;
+    VkPipeline raycastPipeline;
+    static constexpr uint32_t raycastPoolSets = 1024;
+
+    // GPU-driven drawing of VoxelLayout::face groups (see
+    // recordGpuCulling): cull.comp culls every group's box and appends
+    // a GpuDraw per visible group, all drawn by one
+    // vkCmdDrawIndirectCount. face.vert (built with INDIRECT) reads the
+    // instances through buffer device addresses, so the groups keep
+    // their own instance buffers. Needs Vulkan 1.2 (bufferDeviceAddress,
+    // drawIndirectCount, shaderDrawParameters); without it, groups are
+    // drawn one by one after CPU culling. Off until turned on (see
+    // set_gpu_culling): cull.comp and the INDIRECT face.vert have yet
+    // to be run under the validation layers.
+    uint32_t instanceApiVersion = VK_API_VERSION_1_0;
+    bool gpuCullingSupported = false;
+    bool gpuCulling = false;
+    VkDescriptorSetLayout gpuCullDescriptorSetLayout = VK_NULL_HANDLE;
+    VkDescriptorPool gpuCullDescriptorPool = VK_NULL_HANDLE;
+    VkDescriptorSet gpuCullDescriptorSet = VK_NULL_HANDLE;
+    VkPipelineLayout gpuCullPipelineLayout = VK_NULL_HANDLE;
+    VkPipeline gpuCullPipeline = VK_NULL_HANDLE;
+    VkPipelineLayout indirectFacePipelineLayout = VK_NULL_HANDLE;
+    VkPipeline indirectFacePipeline = VK_NULL_HANDLE;
+
+    // Device local GpuCullRecords (mirrored by gpuRecords, indexed like
+    // cullGroups), GpuDraws, and the draw count, with room for
+    // gpuRecordCapacity groups. Changed records are listed in
+    // dirtyGpuRecords until uploaded.
+    VkBuffer gpuRecordBuffer = VK_NULL_HANDLE;
+    MemoryAllocation gpuRecordMemory;
+    VkBuffer gpuDrawBuffer = VK_NULL_HANDLE;
+    MemoryAllocation gpuDrawMemory;
+    VkBuffer gpuCountBuffer = VK_NULL_HANDLE;
+    MemoryAllocation gpuCountMemory;
+    uint32_t gpuRecordCapacity = 0;
+    std::vector<GpuCullRecord> gpuRecords;
+    std::vector<uint32_t> dirtyGpuRecords;
+
+    // Uniform buffer of GpuHiZParams for cull.comp.
+    VkBuffer gpuHiZParamsBuffer = VK_NULL_HANDLE;
+    MemoryAllocation gpuHiZParamsMemory;
+
+    // Hi-Z occlusion culling, for the GPU culling path. Before culling,
+    // the depth image left by the previous frame is reduced by hiz.comp
+    // into a pyramid of min and max depths, whose level 0 is the largest
+    // power of two size within the depth image. cull.comp then drops
+    // groups whose box, as the previous frame's camera saw it, was
+    // behind the max depth. Needs a depth format that can be sampled,
+    // and rg32f storage images (shaderStorageImageExtendedFormats). Off
+    // until turned on (see set_hiz_culling), like GPU culling.
+    bool hiZSupported = false;
+    bool hiZCulling = false;
+    VkDescriptorSetLayout hiZDescriptorSetLayout = VK_NULL_HANDLE;
+    VkPipelineLayout hiZPipelineLayout = VK_NULL_HANDLE;
+    VkPipeline hiZPipeline = VK_NULL_HANDLE;
+
+    // The pyramid (in VK_IMAGE_LAYOUT_GENERAL) and a view of all of it
+    // for cull.comp; a view and a hiz.comp descriptor set per level.
+    // Recreated with the swap chain.
+    VkImage hiZImage = VK_NULL_HANDLE;
+    MemoryAllocation hiZImageMemory;
+    bool hiZLayoutUndefined = false;
+    VkImageView hiZView = VK_NULL_HANDLE;
+    VkExtent2D hiZExtent{};
+    std::vector<VkImageView> hiZLevelViews;
+    VkSampler hiZSampler = VK_NULL_HANDLE;
+    VkDescriptorPool hiZDescriptorPool = VK_NULL_HANDLE;
+    std::vector<VkDescriptorSet> hiZDescriptorSets;
+
+    // Eye-relative view-projection and eye of the last recorded frame,
+    // whose depth the next frame's pyramid is built from; false until a
+    // frame has rendered into the current depthImage.
+    glm::mat4 hiZViewProjection = glm::mat4(1);
+    glm::dvec3 hiZEye = glm::dvec3(0);
+    bool hiZDepthValid = false;
 
     VkCommandPool commandPool;
 
     VkImage depthImage;
-    VkDeviceMemory depthImageMemory;
+    MemoryAllocation depthImageMemory;
     VkImageView depthImageView;
 
     struct TextureInfo {
         VkImage image;
-        VkDeviceMemory memory;
+        MemoryAllocation memory;
         VkImageView view;
         VkSampler sampler;
     };
@@ -263,25 +580,381 @@ class Renderer {
     TextureInfo endivesTexture;
 
     VkBuffer vertexBuffer;
-    VkDeviceMemory vertexBufferMemory;
+    MemoryAllocation vertexBufferMemory;
     VkBuffer indexBuffer;
-    VkDeviceMemory indexBufferMemory;
+    MemoryAllocation indexBufferMemory;
+
+    // Voxel storage: one instance buffer per non-empty chunk group.
+    VoxelWorld& world;
 
-    // Voxel storage.
-    VkBuffer voxelVertexBuffer;
-    VkDeviceMemory voxelVertexBufferMemory;
+    // Instance layout of all chunk groups (see setVoxelLayout).
+    VoxelLayout voxelLayout = VoxelLayout::face;
+
+    // Vertex shader invocations of the voxel draws recorded last frame.
+    uint64_t voxelVertexCount = 0;
+
+    struct GroupBuffer
+    {
+        GroupCoord coord;
+        VkBuffer buffer = VK_NULL_HANDLE;
+        MemoryAllocation memory;
+
+        // Index of the group in cullGroups (and gpuRecords), and the
+        // device address of buffer, if gpuCullingSupported. True iff
+        // cullIndex is in dirtyGpuRecords.
+        uint32_t cullIndex = 0;
+        VkDeviceAddress bufferAddress = 0;
+        bool gpuRecordDirty = false;
+
+        // Size of buffer in instances. Larger than the instance count
+        // so that edits can usually be patched in without reallocating.
+        size_t capacity = 0;
+
+        // CPU copy of the instances, patched in place by setVoxel.
+        InstanceList instances;
+
+        // True iff this is in editedGroups, and true while a job's
+        // rebuild of its mesh after edits is waiting to be swapped in
+        // (see recordVoxelPatches).
+        bool edited = false;
+        bool remeshPending = false;
+
+        // If true, the group is drawn from a greedy mesh (see
+        // setGroupGreedy) instead of the instance buffer, which is
+        // then left empty. Edits regenerate the whole mesh.
+        bool greedy = false;
+        VkBuffer meshVertexBuffer = VK_NULL_HANDLE;
+        MemoryAllocation meshVertexMemory;
+        VkBuffer meshIndexBuffer = VK_NULL_HANDLE;
+        MemoryAllocation meshIndexMemory;
+        uint32_t meshIndexCount = 0;
+
+        // If true, the group is beyond the camera's raycast threshold
+        // and drawn by raycasting its volume (see updateRaycastGroups).
+        // Neither the instances nor the greedy mesh are kept then.
+        bool raycast = false;
+        VkBuffer volumeBuffer = VK_NULL_HANDLE;
+        MemoryAllocation volumeMemory;
+        VkDescriptorSet volumeDescriptorSet = VK_NULL_HANDLE;
+        uint32_t volumeDescriptorPool = 0;
+        glm::ivec4 volumeBoxMin = glm::ivec4(0);
+        glm::ivec4 volumeBoxMax = glm::ivec4(0);
+
+        // Secondary command buffer drawing the group, and the pipeline
+        // and instance (or index) count it was recorded with: it is
+        // re-recorded when they change, and retired with the buffers
+        // it draws (see retireGroupDraw).
+        VkCommandBuffer drawCommands = VK_NULL_HANDLE;
+        int drawPool = 0;
+        VkPipeline drawPipeline = VK_NULL_HANDLE;
+        uint32_t drawCount = 0;
+
+        // Boxes of the group's fully solid chunks (residue coordinates),
+        // used as occluders whatever way the group is drawn.
+        std::vector<OccluderBox> occluders;
+
+        // Level of detail the group is drawn at (see updateGroupLods):
+        // its instances, greedy mesh or volume are made from that level,
+        // and drawn scaled up by 2^lodLevel. The coarser levels are
+        // created when first needed, then kept up-to-date by edits.
+        int lodLevel = 0;
+        std::unique_ptr<GroupLod> lod;
+    };
+    std::unordered_map<GroupCoord, GroupBuffer, GroupCoordHash> groupBuffers;
+
+    // Groups with instance changes not yet uploaded to the GPU.
+    std::vector<GroupCoord> editedGroups;
+
+    // Job system for the CPU side of streaming, meshing and culling,
+    // the job graph being built, and the statistics of this frame's
+    // jobs (see runJobs).
+    JobSystem jobSystem;
+    JobGraph frameJobs;
+    std::vector<JobStats> jobStats;
+
+    // Occupancy grid scratch space of each job system worker,
+    // allocated on first use (they are 2 MiB each).
+    std::vector<std::unique_ptr<OccupancyGrid>> workerOccupancy;
+
+    // Scratch space for the face generator and for voxel patches.
+    std::unique_ptr<OccupancyGrid> occupancyScratch = std::make_unique<OccupancyGrid>();
+    std::vector<uint32_t> dirtyScratch;
+    GreedyMesh meshScratch;
+    RaycastVolume volumeScratch;
+
+    // Chunk groups of the world (in memory or in the region file) that
+    // have no GroupBuffer, and of those, the ones within the load
+    // radius (the far plane) of the eye, for streamChunkGroups to
+    // upload nearest first. The queue is rebuilt from pendingGroups
+    // only when that gains groups or the eye's group or the far plane
+    // changes, so streaming doesn't visit every group every frame.
+    std::unordered_set<GroupCoord, GroupCoordHash> pendingGroups;
+    std::vector<GroupCoord> uploadQueue;
+    bool uploadQueueDirty = true;
+    glm::ivec3 queueEyeGroup = glm::ivec3(0);
+    int queueFarPlane = 0;
+
+    // Whether the groups in memory when streaming started have been
+    // added to pendingGroups (setVoxel adds those created later), and
+    // the region file whose groups have been (they are loaded from it
+    // when their turn comes).
+    bool pendingWorldAdded = false;
+    const RegionFile* pendingRegion = nullptr;
+
+    // Uploaded groups further than the load radius plus evictMargin
+    // from the eye are evicted, and pending again (see
+    // evictDistantGroups). The margin keeps groups at the edge from
+    // being uploaded and evicted over and over.
+    static constexpr double evictMargin = myricube::group_size;
+
+    // The chunk groups streamChunkGroups is adding this frame: loaded
+    // from the region file (if not in memory yet) and meshed by jobs,
+    // then uploaded on this thread.
+    struct StreamedGroup
+    {
+        GroupCoord coord;
+        const ChunkGroup* group = nullptr;
+        std::unique_ptr<ChunkGroup> loaded;
+        bool raycast = false;
+        int lodLevel = 0;
+        std::unique_ptr<GroupLod> lod;
+        InstanceList instances;
+        RaycastVolume volume;
+        std::vector<OccluderBox> occluders;
+    };
+    std::vector<StreamedGroup> streamedGroups;
+
+    // Edited groups whose meshes (or volumes) are rebuilt whole: the
+    // greedy, raycast and coarser level of detail ones. The rebuilds
+    // run as jobs along with the frame's other jobs, and are uploaded
+    // by the next frame's recordVoxelPatches; meanwhile the old mesh
+    // is drawn. How the group was drawn is kept, since a result is
+    // dropped if that has changed (then the group was rebuilt already).
+    struct RemeshedGroup
+    {
+        GroupCoord coord;
+        bool greedy = false;
+        bool raycast = false;
+        int lodLevel = 0;
+        InstanceList instances;
+        GreedyMesh mesh;
+        RaycastVolume volume;
+    };
+    std::vector<RemeshedGroup> remeshedGroups;
+
+    // Groups switching level of detail this frame (see updateGroupLods),
+    // chunks of levels regenerated since the last frame (by jobs too,
+    // hence atomic), and the level of detail statistics of the last
+    // frame.
+    std::vector<GroupBuffer*> lodSwitchGroups;
+    std::atomic<int> lodUpdatedChunks { 0 };
+    LodStats lodStats;
+
+    // Bytes uploaded to the GPU since the last frame was recorded, and
+    // the streaming statistics of the last frame.
+    uint64_t frameUploadBytes = 0;
+    StreamStats streamStats;
+
+    // Bounding boxes of all uploaded chunk groups (cullGroups[i] is the
+    // group of box i; evicting a group moves the last one into its
+    // place, see removeCullGroup), and the indices of those that passed
+    // culling this frame. The boxes' origin follows the eye (see
+    // rebaseCullBoxes).
+    CullBoxes cullBoxes;
+    static constexpr double cullRebaseDistance = 4096;
+    std::vector<GroupBuffer*> cullGroups;
+    std::vector<uint32_t> visibleGroups;
+    CullStats cullStats;
+
+    // Culling runs as jobs over ranges of cullRangeSize boxes; the
+    // visible boxes of each range.
+    static constexpr size_t cullRangeSize = 4096;
+    std::vector<std::vector<uint32_t>> visibleRanges;
+
+    // Depth buffer for occlusion culling (see rasterizeOccluders), and
+    // scratch space for the visible groups that contribute occluders.
+    std::unique_ptr<OcclusionBuffer> occlusionBuffer = std::make_unique<OcclusionBuffer>();
+    std::vector<uint32_t> occluderGroups;
+
+    // Only groups this near the eye contribute occluders, and at most
+    // this many occluder boxes are rasterized per frame.
+    static constexpr double occluderDistance = 2.0 * myricube::group_size;
+    static constexpr size_t maxFrameOccluders = 4096;
 
     VkDescriptorPool descriptorPool;
 
+    // All pipelines are created through this cache, loaded from
+    // pipelineCacheFilename in the data directory at startup and saved
+    // back at cleanup, so only the first run (or one after a driver
+    // update) compiles shaders for real.
+    VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+    static constexpr const char* pipelineCacheFilename = "pipeline.cache";
+
+    // Staging memory of all uploads to device local buffers and images:
+    // one persistently mapped, host coherent buffer used as a ring (see
+    // allocateStaging), so uploads don't allocate memory. stagingHead
+    // and stagingTail count bytes since creation (so the ring offset is
+    // modulo stagingRingSize); the bytes between them may still be read
+    // by the GPU, until the transfer batch that copies them is done.
+    static constexpr VkDeviceSize stagingRingSize = VkDeviceSize(64) << 20;
+    static constexpr VkDeviceSize stagingAlignment = 256;
+    VkBuffer stagingRingBuffer = VK_NULL_HANDLE;
+    MemoryAllocation stagingRingMemory;
+    uint8_t* stagingRingData = nullptr;
+    VkDeviceSize stagingHead = 0;
+    VkDeviceSize stagingTail = 0;
+
+    // Times since the last frame an upload had to wait for the GPU to
+    // finish a transfer batch, to free up room in the staging ring or
+    // to reuse the batch.
+    int stagingStalls = 0;
+
+    // Uploads (copies out of the staging ring, and the layout
+    // transitions of uploaded images) are recorded into a transfer
+    // batch, submitted once per frame by flushTransfers (or sooner, if
+    // the staging ring fills up). Where there is a transfer-only queue
+    // family (often a DMA engine), batches go on a queue of it, and the
+    // buffers and images they touch are shared concurrently with the
+    // graphics family. Each batch signals the next transferTimeline
+    // value, which the frame's graphics submit waits on, so neither
+    // queue is ever idled for an upload. Timeline semaphores need
+    // Vulkan 1.2; without them, batches go on the graphics queue, ahead
+    // of the frame, and signal a fence each instead.
+    struct TransferBatch
+    {
+        VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+        VkFence fence = VK_NULL_HANDLE;
+
+        // transferTimeline value signaled when done, and stagingHead
+        // when submitted (the staging ring is free up to there then).
+        uint64_t value = 0;
+        VkDeviceSize stagingEnd = 0;
+    };
+    static constexpr size_t transferBatchCount = 4;
+    TransferBatch transferBatches[transferBatchCount];
+    size_t transferBatchIndex = 0;
+    bool transferRecording = false;
+    bool timelineSupported = false;
+    uint32_t transferFamily = 0;
+    VkQueue transferQueue = VK_NULL_HANDLE;
+    VkCommandPool transferCommandPool = VK_NULL_HANDLE;
+    VkSemaphore transferTimeline = VK_NULL_HANDLE;
+    uint64_t transferValue = 0;
+    uint64_t transferCompleted = 0;
+
+    // Buffers replaced or dropped while frames in flight (or transfer
+    // batches) may still use them, with their memory and raycast
+    // descriptor set (see retireBuffer), the groups' draw command
+    // buffers recorded with them, and the cull.comp descriptor sets
+    // replaced by createGpuCullBuffers. Those retired since the last
+    // frame was submitted go to that frame, and are destroyed once its
+    // fence is waited on.
+    struct RetiredBuffer
+    {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        MemoryAllocation memory;
+        VkDescriptorSet raycastDescriptorSet = VK_NULL_HANDLE;
+        uint32_t raycastDescriptorPool = 0;
+        VkCommandBuffer drawCommands = VK_NULL_HANDLE;
+        int drawPool = 0;
+        VkDescriptorSet gpuCullDescriptorSet = VK_NULL_HANDLE;
+    };
+    std::vector<RetiredBuffer> retiredBuffers;
+
+    // The visible groups' draws are gathered (and recorded as needed)
+    // by jobs over ranges of drawRangeSize groups, each with its own
+    // results: the draws in order instanced, greedy meshed, then
+    // raycast, and the draws it replaced, to retire.
+    struct DrawRange
+    {
+        std::vector<VkCommandBuffer> commands[3];
+        std::vector<RetiredBuffer> retired;
+        uint64_t vertexCount = 0;
+        int recordedGroups = 0;
+    };
+    static constexpr size_t drawRangeSize = 512;
+    std::vector<DrawRange> drawRanges;
+
+    // The swap chain and everything sized to it, replaced by
+    // recreateSwapChain while frames in flight may still use them (see
+    // retireSwapChain): the views, framebuffers, command buffers and
+    // descriptor sets of its images, the depth image, and the Hi-Z
+    // pyramid with its cull.comp descriptor set. Handed to frames and
+    // destroyed like retiredBuffers.
+    struct RetiredSwapChain
+    {
+        VkSwapchainKHR swapChain = VK_NULL_HANDLE;
+        std::vector<PerImage> perImage;
+        VkDescriptorPool descriptorPool = VK_NULL_HANDLE;
+        VkImage depthImage = VK_NULL_HANDLE;
+        MemoryAllocation depthImageMemory;
+        VkImageView depthImageView = VK_NULL_HANDLE;
+        VkImage hiZImage = VK_NULL_HANDLE;
+        MemoryAllocation hiZImageMemory;
+        VkImageView hiZView = VK_NULL_HANDLE;
+        std::vector<VkImageView> hiZLevelViews;
+        VkSampler hiZSampler = VK_NULL_HANDLE;
+        VkDescriptorPool hiZDescriptorPool = VK_NULL_HANDLE;
+        VkDescriptorSet gpuCullDescriptorSet = VK_NULL_HANDLE;
+    };
+    std::vector<RetiredSwapChain> retiredSwapChains;
+
     // Data that is duplicated per in-flight frame.
     struct PerFrame
     {
         VkSemaphore imageAvailableSemaphore;
         VkSemaphore renderFinishedSemaphore;
         VkFence inFlightFence;
+
+        // Secondary command buffer of the frame's draws that aren't
+        // per group: the tutorial quads and the GPU-driven draw. Its
+        // pool is the frame's own, reset as a whole once the frame's
+        // fence is waited on, so that a job can record it while the
+        // groups' draws are recorded on other threads.
+        VkCommandPool commandPool;
+        VkCommandBuffer frameCommands;
+        std::vector<RetiredBuffer> retiredBuffers;
+        std::vector<RetiredSwapChain> retiredSwapChains;
+
+        // The frame's GpuTimestamp queries, if timestampsSupported, and
+        // whether they were written since last read. The timestamps
+        // between group draws are written by secondary command buffers
+        // of their own (from commandPool), since a render pass run with
+        // secondaries can only execute them.
+        VkQueryPool queryPool = VK_NULL_HANDLE;
+        bool timestampsWritten = false;
+        VkCommandBuffer voxelEndCommands = VK_NULL_HANDLE;
+        VkCommandBuffer raycastEndCommands = VK_NULL_HANDLE;
     };
     std::vector<PerFrame> perFrame;
 
+    // GPU timestamps of each frame, in order. Each is written once all
+    // earlier commands are done, so a part of the frame lasts from the
+    // timestamp before it to the one after it. They're read back once
+    // the frame's fence is waited on (MAX_FRAMES_IN_FLIGHT frames
+    // later), so that reading them never waits.
+    enum GpuTimestamp : uint32_t
+    {
+        timestampFrameBegin,
+        timestampComputeBegin,  // GPU culling and the Hi-Z pyramid
+        timestampComputeEnd,
+        timestampQuadsBegin,    // Tutorial textured quads
+        timestampQuadsEnd,      // then the voxel draws,
+        timestampVoxelEnd,      // then the raycast groups
+        timestampRaycastEnd,
+        timestampFrameEnd,
+        timestampCount
+    };
+    bool timestampsSupported = false;
+    double timestampPeriod = 0;     // Nanoseconds per tick
+    uint64_t timestampMask = 0;     // Valid bits of the timestamps
+
+    // Times of the last gpuTimeSampleCount frames read back (a ring,
+    // next written at gpuTimeSampleIndex), averaged by getGpuTimeStats.
+    static constexpr size_t gpuTimeSampleCount = 60;
+    std::vector<GpuTimeStats> gpuTimeSamples;
+    size_t gpuTimeSampleIndex = 0;
+
     size_t currentFrame = 0;
 
     Camera camera;
@@ -292,53 +965,128 @@ class Renderer {
         createSurface();
         pickPhysicalDevice();
         createLogicalDevice();
+        createPipelineCache();
         createSwapChain();
         createImageViews();
         createRenderPass();
         createDescriptorSetLayout();
+        createCameraDescriptorSetLayout();
+        createRaycastDescriptorSetLayout();
+        createGpuCullDescriptorSetLayout();
+        createHiZDescriptorSetLayout();
         createGraphicsPipeline();
         createVoxelPipeline();
+        createRaycastPipeline();
+        createGpuCullPipeline();
+        createHiZPipeline();
         createCommandPool();
+        createTransferContext();
+        createStagingRing();
         createDepthResources();
         createFramebuffers();
         createVertexBuffer();
-        createVoxelVertexBuffer();
         createIndexBuffer();
         createDescriptorPool();
+        createCameraUniform();
+        createRaycastDescriptorPool();
+        createGpuCullDescriptorPool();
+        createHiZResources();
         faceTexture = createTexture(expand_filename("texture.jpg"));
         endivesTexture = createTexture(expand_filename("endives.jpg"));
         createDescriptorSets();
         createCommandBuffers();
         createSyncObjects();
+        createFrameCommandBuffers();
+        createQueryPools();
     }
 
-    void cleanupSwapChain() {
-        vkDestroyImageView(device, depthImageView, nullptr);
-        vkDestroyImage(device, depthImage, nullptr);
-        vkFreeMemory(device, depthImageMemory, nullptr);
+    // Move the swap chain and the resources sized to it into a
+    // RetiredSwapChain, to be destroyed by destroyRetiredSwapChains once
+    // no frame in flight uses them.
+    RetiredSwapChain retireSwapChain() {
+        RetiredSwapChain retired;
+        retired.swapChain = swapChain;
+        swapChain = VK_NULL_HANDLE;
+        retired.perImage.swap(perImage);
+        retired.descriptorPool = descriptorPool;
+        descriptorPool = VK_NULL_HANDLE;
+        retired.depthImage = depthImage;
+        retired.depthImageMemory = depthImageMemory;
+        retired.depthImageView = depthImageView;
+        depthImage = VK_NULL_HANDLE;
+        depthImageMemory = MemoryAllocation{};
+        depthImageView = VK_NULL_HANDLE;
+
+        if (gpuCullingSupported) {
+            retired.hiZImage = hiZImage;
+            retired.hiZImageMemory = hiZImageMemory;
+            retired.hiZView = hiZView;
+            retired.hiZLevelViews.swap(hiZLevelViews);
+            retired.hiZSampler = hiZSampler;
+            retired.hiZDescriptorPool = hiZDescriptorPool;
+            hiZImage = VK_NULL_HANDLE;
+            hiZImageMemory = MemoryAllocation{};
+            hiZView = VK_NULL_HANDLE;
+            hiZSampler = VK_NULL_HANDLE;
+            hiZDescriptorPool = VK_NULL_HANDLE;
+            hiZDescriptorSets.clear();
+
+            // Still current: createHiZResources copies the buffers from
+            // it into the next set.
+            retired.gpuCullDescriptorSet = gpuCullDescriptorSet;
+        }
+        return retired;
+    }
 
-        for (PerImage& pi : perImage) {
-            vkDestroyFramebuffer(device, pi.framebuffer, nullptr);
-            vkFreeCommandBuffers(device, commandPool, 1, &pi.commandBuffer);
+    void destroyRetiredSwapChains(std::vector<RetiredSwapChain>& retiredList) {
+        for (RetiredSwapChain& retired : retiredList) {
+            for (PerImage& pi : retired.perImage) {
+                vkDestroyFramebuffer(device, pi.framebuffer, nullptr);
+                vkFreeCommandBuffers(device, commandPool, 1, &pi.commandBuffer);
+                vkDestroyImageView(device, pi.view, nullptr);
+            }
+            vkDestroyDescriptorPool(device, retired.descriptorPool, nullptr);
+
+            vkDestroyImageView(device, retired.depthImageView, nullptr);
+            vkDestroyImage(device, retired.depthImage, nullptr);
+            freeMemory(retired.depthImageMemory);
+
+            if (gpuCullingSupported) {
+                vkFreeDescriptorSets(device, gpuCullDescriptorPool, 1, &retired.gpuCullDescriptorSet);
+                vkDestroyDescriptorPool(device, retired.hiZDescriptorPool, nullptr);
+                vkDestroySampler(device, retired.hiZSampler, nullptr);
+                for (VkImageView view : retired.hiZLevelViews) vkDestroyImageView(device, view, nullptr);
+                vkDestroyImageView(device, retired.hiZView, nullptr);
+                vkDestroyImage(device, retired.hiZImage, nullptr);
+                freeMemory(retired.hiZImageMemory);
+            }
+
+            vkDestroySwapchainKHR(device, retired.swapChain, nullptr);
         }
+        retiredList.clear();
+    }
 
+    // The pipelines and their layouts. They only depend on the render
+    // pass, so they live as long as it does.
+    void destroyPipelines() {
         vkDestroyPipeline(device, graphicsPipeline, nullptr);
         vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
         vkDestroyPipeline(device, voxelPipeline, nullptr);
+        vkDestroyPipeline(device, faceVoxelPipeline, nullptr);
+        vkDestroyPipeline(device, greedyPipeline, nullptr);
         vkDestroyPipelineLayout(device, voxelPipelineLayout, nullptr);
-        vkDestroyRenderPass(device, renderPass, nullptr);
-
-        for (PerImage& pi : perImage) {
-            vkDestroyImageView(device, pi.view, nullptr);
-        }
-
-        vkDestroySwapchainKHR(device, swapChain, nullptr);
-
-        vkDestroyDescriptorPool(device, descriptorPool, nullptr);
+        vkDestroyPipeline(device, indirectFacePipeline, nullptr);
+        vkDestroyPipelineLayout(device, indirectFacePipelineLayout, nullptr);
+        vkDestroyPipeline(device, raycastPipeline, nullptr);
+        vkDestroyPipelineLayout(device, raycastPipelineLayout, nullptr);
     }
 
     void cleanup() {
-        cleanupSwapChain();
+        retiredSwapChains.push_back(retireSwapChain());
+        for (PerFrame& pf : perFrame) destroyRetiredSwapChains(pf.retiredSwapChains);
+        destroyRetiredSwapChains(retiredSwapChains);
+        destroyPipelines();
+        vkDestroyRenderPass(device, renderPass, nullptr);
 
         cleanupTexture(faceTexture);
         cleanupTexture(endivesTexture);
@@ -346,21 +1094,59 @@ class Renderer {
         vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
 
         vkDestroyBuffer(device, indexBuffer, nullptr);
-        vkFreeMemory(device, indexBufferMemory, nullptr);
+        freeMemory(indexBufferMemory);
 
         vkDestroyBuffer(device, vertexBuffer, nullptr);
-        vkFreeMemory(device, vertexBufferMemory, nullptr);
+        freeMemory(vertexBufferMemory);
+
+        vkUnmapMemory(device, stagingRingMemory.memory);
+        vkDestroyBuffer(device, stagingRingBuffer, nullptr);
+        freeMemory(stagingRingMemory);
+
+        for (auto& pair : groupBuffers) {
+            retireGroupDraw(pair.second);
+            retireBuffer(pair.second.buffer, pair.second.memory);
+            retireGreedyMesh(pair.second);
+            retireRaycastVolume(pair.second);
+        }
+        retireGpuCullBuffers();
+        for (PerFrame& pf : perFrame) destroyRetiredBuffers(pf.retiredBuffers);
+        destroyRetiredBuffers(retiredBuffers);
+        for (RaycastDescriptorPool& pool : raycastDescriptorPools) {
+            vkDestroyDescriptorPool(device, pool.pool, nullptr);
+        }
+        vkDestroyDescriptorSetLayout(device, raycastDescriptorSetLayout, nullptr);
 
-        vkDestroyBuffer(device, voxelVertexBuffer, nullptr);
-        vkFreeMemory(device, voxelVertexBufferMemory, nullptr);
+        vkDestroyBuffer(device, cameraBuffer, nullptr);
+        freeMemory(cameraMemory);
+        vkDestroyDescriptorPool(device, cameraDescriptorPool, nullptr);
+        vkDestroyDescriptorSetLayout(device, cameraDescriptorSetLayout, nullptr);
+
+        vkDestroyPipeline(device, gpuCullPipeline, nullptr);
+        vkDestroyPipelineLayout(device, gpuCullPipelineLayout, nullptr);
+        vkDestroyDescriptorPool(device, gpuCullDescriptorPool, nullptr);
+        vkDestroyDescriptorSetLayout(device, gpuCullDescriptorSetLayout, nullptr);
+        vkDestroyPipeline(device, hiZPipeline, nullptr);
+        vkDestroyPipelineLayout(device, hiZPipelineLayout, nullptr);
+        vkDestroyDescriptorSetLayout(device, hiZDescriptorSetLayout, nullptr);
 
         for (PerFrame& pf : perFrame) {
             vkDestroySemaphore(device, pf.renderFinishedSemaphore, nullptr);
             vkDestroySemaphore(device, pf.imageAvailableSemaphore, nullptr);
             vkDestroyFence(device, pf.inFlightFence, nullptr);
+            vkDestroyCommandPool(device, pf.commandPool, nullptr);
+            if (pf.queryPool != VK_NULL_HANDLE) vkDestroyQueryPool(device, pf.queryPool, nullptr);
         }
 
         vkDestroyCommandPool(device, commandPool, nullptr);
+        for (VkCommandPool pool : drawCommandPools) vkDestroyCommandPool(device, pool, nullptr);
+        vkDestroyCommandPool(device, transferCommandPool, nullptr);
+        vkDestroySemaphore(device, transferTimeline, nullptr);
+        for (TransferBatch& batch : transferBatches) vkDestroyFence(device, batch.fence, nullptr);
+
+        destroyMemoryPools();
+        savePipelineCache();
+        vkDestroyPipelineCache(device, pipelineCache, nullptr);
 
         vkDestroyDevice(device, nullptr);
 
@@ -377,9 +1163,15 @@ class Renderer {
         vkDestroyImageView(device, textureInfo.view, nullptr);
 
         vkDestroyImage(device, textureInfo.image, nullptr);
-        vkFreeMemory(device, textureInfo.memory, nullptr);
+        freeMemory(textureInfo.memory);
     }
 
+    // Recreate the swap chain for the new window size without idling
+    // the device: the new swap chain is created from the old one, and
+    // the old one and the resources sized to it are retired until the
+    // frames in flight are done with them. The render pass and the
+    // pipelines (whose viewport and scissor are dynamic) are kept,
+    // unless the surface format changed.
     void recreateSwapChain() {
         int width = 0, height = 0;
         glfwGetFramebufferSize(window, &width, &height);
@@ -388,16 +1180,46 @@ class Renderer {
             glfwWaitEvents();
         }
 
-        vkDeviceWaitIdle(device);
-
-        cleanupSwapChain();
+        // No frame was submitted since the last recreation (the new
+        // swap chain was out of date already); rather than pile up
+        // swap chains, wait for the frames in flight.
+        if (!retiredSwapChains.empty()) {
+            for (PerFrame& pf : perFrame) {
+                vkWaitForFences(device, 1, &pf.inFlightFence, VK_TRUE, UINT64_MAX);
+                destroyRetiredSwapChains(pf.retiredSwapChains);
+            }
+            destroyRetiredSwapChains(retiredSwapChains);
+        }
 
-        createSwapChain();
+        VkFormat oldFormat = swapChainImageFormat;
+        VkExtent2D oldExtent = swapChainExtent;
+        RetiredSwapChain retired = retireSwapChain();
+        createSwapChain(retired.swapChain);
+        retiredSwapChains.push_back(std::move(retired));
         createImageViews();
-        createRenderPass();
-        createGraphicsPipeline();
-        createVoxelPipeline();
+
+        // Rare (the window moved to a different kind of display), so
+        // this may wait.
+        if (swapChainImageFormat != oldFormat) {
+            vkDeviceWaitIdle(device);
+            destroyPipelines();
+            vkDestroyRenderPass(device, renderPass, nullptr);
+            createRenderPass();
+            createGraphicsPipeline();
+            createVoxelPipeline();
+            createRaycastPipeline();
+        }
+
+        // The groups' draws have the viewport (and the pipelines) baked
+        // in.
+        if (swapChainImageFormat != oldFormat || swapChainExtent.width != oldExtent.width || swapChainExtent.height != oldExtent.height) {
+            for (auto& pair : groupBuffers) {
+                retireGroupDraw(pair.second);
+            }
+        }
+
         createDepthResources();
+        createHiZResources();
         createFramebuffers();
         createDescriptorPool();
         createDescriptorSets();
@@ -415,7 +1237,12 @@ class Renderer {
         appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
         appInfo.pEngineName = "No Engine";
         appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-        appInfo.apiVersion = VK_API_VERSION_1_0;
+        // Vulkan 1.2 if the loader has it, for GPU culling.
+        auto enumerateInstanceVersion = (PFN_vkEnumerateInstanceVersion) vkGetInstanceProcAddr(nullptr, "vkEnumerateInstanceVersion");
+        uint32_t loaderVersion = VK_API_VERSION_1_0;
+        if (enumerateInstanceVersion != nullptr) enumerateInstanceVersion(&loaderVersion);
+        instanceApiVersion = loaderVersion >= VK_API_VERSION_1_2 ? VK_API_VERSION_1_2 : VK_API_VERSION_1_0;
+        appInfo.apiVersion = instanceApiVersion;
 
         VkInstanceCreateInfo createInfo{};
         createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -489,6 +1316,88 @@ class Renderer {
         if (physicalDevice == VK_NULL_HANDLE) {
             throw std::runtime_error("failed to find a suitable GPU!");
         }
+
+        gpuCullingSupported = checkGpuCullingSupport(physicalDevice);
+        timelineSupported = checkTimelineSupport(physicalDevice);
+        hiZSupported = checkHiZSupport();
+        timestampsSupported = checkTimestampSupport();
+    }
+
+    bool checkGpuCullingSupport(VkPhysicalDevice device) {
+        if (instanceApiVersion < VK_API_VERSION_1_2) return false;
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(device, &properties);
+        if (properties.apiVersion < VK_API_VERSION_1_2) return false;
+
+        // cull.comp runs on the graphics queue.
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+        if (!(queueFamilies.at(findQueueFamilies(device).graphicsFamily.value()).queueFlags & VK_QUEUE_COMPUTE_BIT)) return false;
+
+        VkPhysicalDeviceVulkan12Features features12{};
+        features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        VkPhysicalDeviceVulkan11Features features11{};
+        features11.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
+        features11.pNext = &features12;
+        VkPhysicalDeviceFeatures2 features{};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = &features11;
+        vkGetPhysicalDeviceFeatures2(device, &features);
+
+        return features11.shaderDrawParameters && features12.bufferDeviceAddress && features12.drawIndirectCount;
+    }
+
+    // Timeline semaphores, for asynchronous transfers (see
+    // TransferBatch). Core in Vulkan 1.2.
+    bool checkTimelineSupport(VkPhysicalDevice device) {
+        if (instanceApiVersion < VK_API_VERSION_1_2) return false;
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(device, &properties);
+        if (properties.apiVersion < VK_API_VERSION_1_2) return false;
+
+        VkPhysicalDeviceVulkan12Features features12{};
+        features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        VkPhysicalDeviceFeatures2 features{};
+        features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features.pNext = &features12;
+        vkGetPhysicalDeviceFeatures2(device, &features);
+
+        return features12.timelineSemaphore;
+    }
+
+    // Timestamps on the graphics queue, for GpuTimeStats; sets
+    // timestampPeriod and timestampMask.
+    bool checkTimestampSupport() {
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        if (properties.limits.timestampPeriod <= 0) return false;
+
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, nullptr);
+        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &queueFamilyCount, queueFamilies.data());
+        uint32_t validBits = queueFamilies.at(findQueueFamilies(physicalDevice).graphicsFamily.value()).timestampValidBits;
+        if (validBits == 0) return false;
+
+        timestampPeriod = properties.limits.timestampPeriod;
+        timestampMask = validBits >= 64 ? ~uint64_t(0) : (uint64_t(1) << validBits) - 1;
+        return true;
+    }
+
+    // Hi-Z culling is part of GPU culling, samples the depth image, and
+    // writes the pyramid as an rg32f storage image.
+    bool checkHiZSupport() {
+        if (!gpuCullingSupported) return false;
+        VkPhysicalDeviceFeatures features;
+        vkGetPhysicalDeviceFeatures(physicalDevice, &features);
+        if (!features.shaderStorageImageExtendedFormats) return false;
+        VkFormatProperties props;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, findDepthFormat(), &props);
+        return (props.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) != 0;
     }
 
     void createLogicalDevice() {
@@ -496,6 +1405,12 @@ class Renderer {
 
         std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
         std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(), indices.presentFamily.value()};
+        graphicsFamily = indices.graphicsFamily.value();
+        transferFamily = graphicsFamily;
+        if (timelineSupported && indices.transferFamily.has_value()) {
+            transferFamily = indices.transferFamily.value();
+            uniqueQueueFamilies.insert(transferFamily);
+        }
 
         float queuePriority = 1.0f;
         for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -509,6 +1424,7 @@ class Renderer {
 
         VkPhysicalDeviceFeatures deviceFeatures{};
         deviceFeatures.samplerAnisotropy = VK_TRUE;
+        deviceFeatures.shaderStorageImageExtendedFormats = hiZSupported;
 
         VkDeviceCreateInfo createInfo{};
         createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -518,6 +1434,17 @@ class Renderer {
 
         createInfo.pEnabledFeatures = &deviceFeatures;
 
+        VkPhysicalDeviceVulkan12Features features12{};
+        features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+        features12.bufferDeviceAddress = gpuCullingSupported;
+        features12.drawIndirectCount = gpuCullingSupported;
+        features12.timelineSemaphore = timelineSupported;
+        VkPhysicalDeviceVulkan11Features features11{};
+        features11.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES;
+        features11.pNext = &features12;
+        features11.shaderDrawParameters = gpuCullingSupported;
+        if (gpuCullingSupported || timelineSupported) createInfo.pNext = &features11;
+
         createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
         createInfo.ppEnabledExtensionNames = deviceExtensions.data();
 
@@ -534,9 +1461,12 @@ class Renderer {
 
         vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
         vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+        vkGetDeviceQueue(device, transferFamily, 0, &transferQueue);
     }
 
-    void createSwapChain() {
+    // Presentation carries on from oldSwapChain (if any) while the new
+    // swap chain is set up.
+    void createSwapChain(VkSwapchainKHR oldSwapChain = VK_NULL_HANDLE) {
         SwapChainSupportDetails swapChainSupport = querySwapChainSupport(physicalDevice);
 
         VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
@@ -574,6 +1504,7 @@ class Renderer {
         createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
         createInfo.presentMode = presentMode;
         createInfo.clipped = VK_TRUE;
+        createInfo.oldSwapchain = oldSwapChain;
 
         if (vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain) != VK_SUCCESS) {
             throw std::runtime_error("failed to create swap chain!");
@@ -613,7 +1544,8 @@ class Renderer {
         depthAttachment.format = findDepthFormat();
         depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
         depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-        depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        // Kept for the next frame's Hi-Z pyramid.
+        depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
         depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
         depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
         depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
@@ -636,10 +1568,12 @@ class Renderer {
         VkSubpassDependency dependency{};
         dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
         dependency.dstSubpass = 0;
-        dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        dependency.srcAccessMask = 0;
-        dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-        dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        // Depth too: the clear must wait for the previous frame's depth
+        // writes and for the Hi-Z pyramid build reading them.
+        dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+        dependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
+        dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
 
         std::array<VkAttachmentDescription, 2> attachments = {colorAttachment, depthAttachment};
         VkRenderPassCreateInfo renderPassInfo{};
@@ -675,6 +1609,70 @@ class Renderer {
         }
     }
 
+    // Create pipelineCache, with the data saved by the last run if it
+    // was made on this device and driver. The header (see
+    // VkPipelineCacheHeaderVersionOne) is checked here rather than left
+    // to the driver, which might not reject data from another device.
+    void createPipelineCache() {
+        std::vector<char> data;
+        std::ifstream file(expand_filename(pipelineCacheFilename), std::ios::ate | std::ios::binary);
+        if (file.is_open()) {
+            data.resize((size_t) file.tellg());
+            file.seekg(0);
+            file.read(data.data(), data.size());
+            if (!file) data.clear();
+        }
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+        // headerSize, headerVersion, vendorID, deviceID, then the UUID.
+        const size_t headerSize = 16 + VK_UUID_SIZE;
+        if (data.size() >= headerSize) {
+            uint32_t header[4];
+            memcpy(header, data.data(), sizeof header);
+            bool valid = header[0] >= headerSize
+                      && header[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE
+                      && header[2] == properties.vendorID
+                      && header[3] == properties.deviceID
+                      && memcmp(data.data() + 16, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+            if (!valid) data.clear();
+        }
+        else {
+            data.clear();
+        }
+
+        VkPipelineCacheCreateInfo cacheInfo{};
+        cacheInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        cacheInfo.initialDataSize = data.size();
+        cacheInfo.pInitialData = data.empty() ? nullptr : data.data();
+
+        if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &pipelineCache) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create pipeline cache!");
+        }
+    }
+
+    // Write pipelineCache to the data directory (through a temporary
+    // file, so a crash can't leave a truncated cache). Failure only
+    // costs recompiling next time, so it's just reported.
+    void savePipelineCache() {
+        size_t size = 0;
+        if (vkGetPipelineCacheData(device, pipelineCache, &size, nullptr) != VK_SUCCESS) return;
+        std::vector<char> data(size);
+        if (vkGetPipelineCacheData(device, pipelineCache, &size, data.data()) != VK_SUCCESS) return;
+        data.resize(size);
+
+        std::string filename = expand_filename(pipelineCacheFilename);
+        std::string tempFilename = filename + ".tmp";
+        std::ofstream file(tempFilename, std::ios::binary | std::ios::trunc);
+        file.write(data.data(), data.size());
+        file.close();
+        if (!file || std::rename(tempFilename.c_str(), filename.c_str()) != 0) {
+            std::cerr << "failed to save pipeline cache to " << filename << std::endl;
+            std::remove(tempFilename.c_str());
+        }
+    }
+
     void createGraphicsPipeline() {
         auto vertShaderCode = readFile(expand_filename("vert.spv"));
         auto fragShaderCode = readFile(expand_filename("frag.spv"));
@@ -712,24 +1710,19 @@ class Renderer {
         inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
         inputAssembly.primitiveRestartEnable = VK_FALSE;
 
-        VkViewport viewport{};
-        viewport.x = 0.0f;
-        viewport.y = 0.0f;
-        viewport.width = (float) swapChainExtent.width;
-        viewport.height = (float) swapChainExtent.height;
-        viewport.minDepth = 0.0f;
-        viewport.maxDepth = 1.0f;
-
-        VkRect2D scissor{};
-        scissor.offset = {0, 0};
-        scissor.extent = swapChainExtent;
-
+        // The viewport and scissor are set when recording (see
+        // recordOneTimeFrameCommandBuffer), so the pipeline is kept when
+        // the swap chain is resized.
         VkPipelineViewportStateCreateInfo viewportState{};
         viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
         viewportState.viewportCount = 1;
-        viewportState.pViewports = &viewport;
         viewportState.scissorCount = 1;
-        viewportState.pScissors = &scissor;
+
+        std::array<VkDynamicState, 2> dynamicStates = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+        VkPipelineDynamicStateCreateInfo dynamicState{};
+        dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+        dynamicState.pDynamicStates = dynamicStates.data();
 
         VkPipelineRasterizationStateCreateInfo rasterizer{};
         rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
@@ -793,6 +1786,7 @@ class Renderer {
         pipelineInfo.pVertexInputState = &vertexInputInfo;
         pipelineInfo.pInputAssemblyState = &inputAssembly;
         pipelineInfo.pViewportState = &viewportState;
+        pipelineInfo.pDynamicState = &dynamicState;
         pipelineInfo.pRasterizationState = &rasterizer;
         pipelineInfo.pMultisampleState = &multisampling;
         pipelineInfo.pDepthStencilState = &depthStencil;
@@ -802,7 +1796,7 @@ class Renderer {
         pipelineInfo.subpass = 0;
         pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
-        if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS) {
+        if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS) {
             throw std::runtime_error("failed to create graphics pipeline!");
         }
 
@@ -810,17 +1804,16 @@ class Renderer {
         vkDestroyShaderModule(device, vertShaderModule, nullptr);
     }
 
+    // Creates the voxel pipelines for both VoxelLayouts and for greedy
+    // meshes. They share everything except the vertex shader and input.
     void createVoxelPipeline() {
-        auto vertShaderCode = readFile(expand_filename("voxel.vert.spv"));
         auto fragShaderCode = readFile(expand_filename("voxel.frag.spv"));
 
-        VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
         VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
 
         VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
         vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
         vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-        vertShaderStageInfo.module = vertShaderModule;
         vertShaderStageInfo.pName = "main";
 
         VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
@@ -842,29 +1835,33 @@ class Renderer {
         vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
         vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
 
+        VkPipelineVertexInputStateCreateInfo greedyVertexInputInfo{};
+        greedyVertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+        auto greedyBindingDescription = GreedyVertex::getBindingDescription();
+        auto greedyAttributeDescriptions = GreedyVertex::getAttributeDescriptions();
+
+        greedyVertexInputInfo.vertexBindingDescriptionCount = 1;
+        greedyVertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(greedyAttributeDescriptions.size());
+        greedyVertexInputInfo.pVertexBindingDescriptions = &greedyBindingDescription;
+        greedyVertexInputInfo.pVertexAttributeDescriptions = greedyAttributeDescriptions.data();
+
         VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
         inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
         inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
         inputAssembly.primitiveRestartEnable = VK_FALSE;
 
-        VkViewport viewport{};
-        viewport.x = 0.0f;
-        viewport.y = 0.0f;
-        viewport.width = (float) swapChainExtent.width;
-        viewport.height = (float) swapChainExtent.height;
-        viewport.minDepth = 0.0f;
-        viewport.maxDepth = 1.0f;
-
-        VkRect2D scissor{};
-        scissor.offset = {0, 0};
-        scissor.extent = swapChainExtent;
-
+        // Dynamic viewport and scissor, as in createGraphicsPipeline.
         VkPipelineViewportStateCreateInfo viewportState{};
         viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
         viewportState.viewportCount = 1;
-        viewportState.pViewports = &viewport;
         viewportState.scissorCount = 1;
-        viewportState.pScissors = &scissor;
+
+        std::array<VkDynamicState, 2> dynamicStates = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+        VkPipelineDynamicStateCreateInfo dynamicState{};
+        dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+        dynamicState.pDynamicStates = dynamicStates.data();
 
         VkPipelineRasterizationStateCreateInfo rasterizer{};
         rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
@@ -916,10 +1913,42 @@ class Renderer {
         pipelineLayoutInfo.pushConstantRangeCount = 1;
         pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
 
-        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &voxelPipelineLayout) != VK_SUCCESS) {
+        // The camera comes from the uniform buffer, and the push
+        // constants are just the group's.
+        VkPushConstantRange groupPushConstantRange{};
+        groupPushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+        groupPushConstantRange.offset = 0;
+        groupPushConstantRange.size = sizeof(GroupPushConstant);
+
+        VkPipelineLayoutCreateInfo voxelPipelineLayoutInfo{};
+        voxelPipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        voxelPipelineLayoutInfo.setLayoutCount = 1;
+        voxelPipelineLayoutInfo.pSetLayouts = &cameraDescriptorSetLayout;
+        voxelPipelineLayoutInfo.pushConstantRangeCount = 1;
+        voxelPipelineLayoutInfo.pPushConstantRanges = &groupPushConstantRange;
+
+        if (vkCreatePipelineLayout(device, &voxelPipelineLayoutInfo, nullptr, &voxelPipelineLayout) != VK_SUCCESS) {
             throw std::runtime_error("failed to create pipeline layout!");
         }
 
+        // GPU culling: the camera as for the other groups, and the
+        // draws written by cull.comp, read by the vertex shader.
+        if (gpuCullingSupported) {
+            VkDescriptorSetLayout setLayouts[] = {cameraDescriptorSetLayout, gpuCullDescriptorSetLayout};
+            VkPipelineLayoutCreateInfo indirectPipelineLayoutInfo{};
+            indirectPipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+            indirectPipelineLayoutInfo.setLayoutCount = 2;
+            indirectPipelineLayoutInfo.pSetLayouts = setLayouts;
+
+            if (vkCreatePipelineLayout(device, &indirectPipelineLayoutInfo, nullptr, &indirectFacePipelineLayout) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create indirect pipeline layout!");
+            }
+        }
+
+        // Instances are fetched by address, not as vertex input.
+        VkPipelineVertexInputStateCreateInfo indirectVertexInputInfo{};
+        indirectVertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
         VkGraphicsPipelineCreateInfo pipelineInfo{};
         pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
         pipelineInfo.stageCount = 2;
@@ -927,6 +1956,7 @@ class Renderer {
         pipelineInfo.pVertexInputState = &vertexInputInfo;
         pipelineInfo.pInputAssemblyState = &inputAssembly;
         pipelineInfo.pViewportState = &viewportState;
+        pipelineInfo.pDynamicState = &dynamicState;
         pipelineInfo.pRasterizationState = &rasterizer;
         pipelineInfo.pMultisampleState = &multisampling;
         pipelineInfo.pDepthStencilState = &depthStencil;
@@ -936,70 +1966,395 @@ class Renderer {
         pipelineInfo.subpass = 0;
         pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
 
-        if (vkCreateGraphicsPipelines(device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &voxelPipeline) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create graphics pipeline!");
+        // Variants with a null layout aren't supported by the device.
+        struct {
+            const char* vertShaderFilename;
+            const VkPipelineVertexInputStateCreateInfo* vertexInput;
+            VkPipelineLayout layout;
+            VkPipeline* pipeline;
+        } variants[] = {
+            { "voxel.vert.spv", &vertexInputInfo, voxelPipelineLayout, &voxelPipeline },
+            { "face.vert.spv", &vertexInputInfo, voxelPipelineLayout, &faceVoxelPipeline },
+            { "greedy.vert.spv", &greedyVertexInputInfo, voxelPipelineLayout, &greedyPipeline },
+            { "face-indirect.vert.spv", &indirectVertexInputInfo, indirectFacePipelineLayout, &indirectFacePipeline },
+        };
+
+        for (auto& variant : variants) {
+            if (variant.layout == VK_NULL_HANDLE) continue;
+            auto vertShaderCode = readFile(expand_filename(variant.vertShaderFilename));
+            VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
+            shaderStages[0].module = vertShaderModule;
+            pipelineInfo.pVertexInputState = variant.vertexInput;
+            pipelineInfo.layout = variant.layout;
+
+            if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, variant.pipeline) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create graphics pipeline!");
+            }
+
+            vkDestroyShaderModule(device, vertShaderModule, nullptr);
         }
 
         vkDestroyShaderModule(device, fragShaderModule, nullptr);
-        vkDestroyShaderModule(device, vertShaderModule, nullptr);
     }
 
-    void createFramebuffers() {
-        for (PerImage& pi : perImage) {
-            std::array<VkImageView, 2> attachments = {
-                pi.view,
-                depthImageView
-            };
+    void createCameraDescriptorSetLayout() {
+        VkDescriptorSetLayoutBinding cameraLayoutBinding{};
+        cameraLayoutBinding.binding = 0;
+        cameraLayoutBinding.descriptorCount = 1;
+        cameraLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        cameraLayoutBinding.pImmutableSamplers = nullptr;
+        cameraLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
 
-            VkFramebufferCreateInfo framebufferInfo{};
-            framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-            framebufferInfo.renderPass = renderPass;
-            framebufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
-            framebufferInfo.pAttachments = attachments.data();
-            framebufferInfo.width = swapChainExtent.width;
-            framebufferInfo.height = swapChainExtent.height;
-            framebufferInfo.layers = 1;
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = 1;
+        layoutInfo.pBindings = &cameraLayoutBinding;
 
-            if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &pi.framebuffer) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create framebuffer!");
-            }
+        if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &cameraDescriptorSetLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create camera descriptor set layout!");
         }
     }
 
-    void createCommandPool() {
-        QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
+    void createRaycastDescriptorSetLayout() {
+        VkDescriptorSetLayoutBinding volumeLayoutBinding{};
+        volumeLayoutBinding.binding = 0;
+        volumeLayoutBinding.descriptorCount = 1;
+        volumeLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        volumeLayoutBinding.pImmutableSamplers = nullptr;
+        volumeLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-        VkCommandPoolCreateInfo poolInfo{};
-        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-        poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
-        poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = 1;
+        layoutInfo.pBindings = &volumeLayoutBinding;
 
-        if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create graphics command pool!");
+        if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &raycastDescriptorSetLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create raycast descriptor set layout!");
         }
     }
 
-    void createDepthResources() {
-        VkFormat depthFormat = findDepthFormat();
-
-        createImage(swapChainExtent.width, swapChainExtent.height, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImage, depthImageMemory);
-        depthImageView = createImageView(depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
-    }
-
-    VkFormat findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features) {
-        for (VkFormat format : candidates) {
-            VkFormatProperties props;
-            vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &props);
+    // Pipeline for raycast chunk groups: draws the back faces of the
+    // volume's bounding box (so it still works with the eye inside),
+    // and raycast.frag marches the ray through the volume, writing the
+    // depth of the hit voxel.
+    void createRaycastPipeline() {
+        auto vertShaderCode = readFile(expand_filename("raycast.vert.spv"));
+        auto fragShaderCode = readFile(expand_filename("raycast.frag.spv"));
 
-            if (tiling == VK_IMAGE_TILING_LINEAR && (props.linearTilingFeatures & features) == features) {
-                return format;
-            } else if (tiling == VK_IMAGE_TILING_OPTIMAL && (props.optimalTilingFeatures & features) == features) {
-                return format;
-            }
-        }
+        VkShaderModule vertShaderModule = createShaderModule(vertShaderCode);
+        VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
 
-        throw std::runtime_error("failed to find supported format!");
-    }
+        VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
+        vertShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        vertShaderStageInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
+        vertShaderStageInfo.module = vertShaderModule;
+        vertShaderStageInfo.pName = "main";
+
+        VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
+        fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+        fragShaderStageInfo.module = fragShaderModule;
+        fragShaderStageInfo.pName = "main";
+
+        VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
+
+        // No vertex input; the box is generated from gl_VertexIndex.
+        VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
+        vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+
+        VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+        inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+        inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+        inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+        // Dynamic viewport and scissor, as in createGraphicsPipeline.
+        VkPipelineViewportStateCreateInfo viewportState{};
+        viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+        viewportState.viewportCount = 1;
+        viewportState.scissorCount = 1;
+
+        std::array<VkDynamicState, 2> dynamicStates = {VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR};
+        VkPipelineDynamicStateCreateInfo dynamicState{};
+        dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
+        dynamicState.pDynamicStates = dynamicStates.data();
+
+        VkPipelineRasterizationStateCreateInfo rasterizer{};
+        rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+        rasterizer.depthClampEnable = VK_FALSE;
+        rasterizer.rasterizerDiscardEnable = VK_FALSE;
+        rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+        rasterizer.lineWidth = 1.0f;
+        rasterizer.cullMode = VK_CULL_MODE_FRONT_BIT;
+        rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+        rasterizer.depthBiasEnable = VK_FALSE;
+
+        VkPipelineMultisampleStateCreateInfo multisampling{};
+        multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+        multisampling.sampleShadingEnable = VK_FALSE;
+        multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+        VkPipelineDepthStencilStateCreateInfo depthStencil{};
+        depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+        depthStencil.depthTestEnable = VK_TRUE;
+        depthStencil.depthWriteEnable = VK_TRUE;
+        depthStencil.depthCompareOp = VK_COMPARE_OP_LESS;
+        depthStencil.depthBoundsTestEnable = VK_FALSE;
+        depthStencil.stencilTestEnable = VK_FALSE;
+
+        VkPipelineColorBlendAttachmentState colorBlendAttachment{};
+        colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+        colorBlendAttachment.blendEnable = VK_FALSE;
+
+        VkPipelineColorBlendStateCreateInfo colorBlending{};
+        colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+        colorBlending.logicOpEnable = VK_FALSE;
+        colorBlending.logicOp = VK_LOGIC_OP_COPY;
+        colorBlending.attachmentCount = 1;
+        colorBlending.pAttachments = &colorBlendAttachment;
+        colorBlending.blendConstants[0] = 0.0f;
+        colorBlending.blendConstants[1] = 0.0f;
+        colorBlending.blendConstants[2] = 0.0f;
+        colorBlending.blendConstants[3] = 0.0f;
+
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(RaycastPushConstant);
+
+        // The camera, then the volume.
+        std::array<VkDescriptorSetLayout, 2> setLayouts = {cameraDescriptorSetLayout, raycastDescriptorSetLayout};
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(setLayouts.size());
+        pipelineLayoutInfo.pSetLayouts = setLayouts.data();
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &raycastPipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create raycast pipeline layout!");
+        }
+
+        VkGraphicsPipelineCreateInfo pipelineInfo{};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        pipelineInfo.stageCount = 2;
+        pipelineInfo.pStages = shaderStages;
+        pipelineInfo.pVertexInputState = &vertexInputInfo;
+        pipelineInfo.pInputAssemblyState = &inputAssembly;
+        pipelineInfo.pViewportState = &viewportState;
+        pipelineInfo.pDynamicState = &dynamicState;
+        pipelineInfo.pRasterizationState = &rasterizer;
+        pipelineInfo.pMultisampleState = &multisampling;
+        pipelineInfo.pDepthStencilState = &depthStencil;
+        pipelineInfo.pColorBlendState = &colorBlending;
+        pipelineInfo.layout = raycastPipelineLayout;
+        pipelineInfo.renderPass = renderPass;
+        pipelineInfo.subpass = 0;
+        pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+
+        if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &raycastPipeline) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create raycast pipeline!");
+        }
+
+        vkDestroyShaderModule(device, fragShaderModule, nullptr);
+        vkDestroyShaderModule(device, vertShaderModule, nullptr);
+    }
+
+    // Records (read by cull.comp), draws (written by cull.comp, read by
+    // the indirect face.vert) and the draw count.
+    void createGpuCullDescriptorSetLayout() {
+        if (!gpuCullingSupported) return;
+
+        std::array<VkDescriptorSetLayoutBinding, 5> bindings{};
+        for (uint32_t i = 0; i < bindings.size(); ++i) {
+            bindings[i].binding = i;
+            bindings[i].descriptorCount = 1;
+            bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            bindings[i].pImmutableSamplers = nullptr;
+            bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        }
+        bindings[1].stageFlags |= VK_SHADER_STAGE_VERTEX_BIT;
+        bindings[3].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        bindings[4].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+        layoutInfo.pBindings = bindings.data();
+
+        if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &gpuCullDescriptorSetLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create GPU culling descriptor set layout!");
+        }
+    }
+
+    // hiz.comp: the source level (or depth image) to sample, and the
+    // level to write.
+    void createHiZDescriptorSetLayout() {
+        if (!gpuCullingSupported) return;
+
+        std::array<VkDescriptorSetLayoutBinding, 2> bindings{};
+        bindings[0].binding = 0;
+        bindings[0].descriptorCount = 1;
+        bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        bindings[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        bindings[1].binding = 1;
+        bindings[1].descriptorCount = 1;
+        bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        bindings[1].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+        layoutInfo.pBindings = bindings.data();
+
+        if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &hiZDescriptorSetLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create Hi-Z descriptor set layout!");
+        }
+    }
+
+    void createGpuCullPipeline() {
+        if (!gpuCullingSupported) return;
+
+        auto compShaderCode = readFile(expand_filename("cull.comp.spv"));
+        VkShaderModule compShaderModule = createShaderModule(compShaderCode);
+
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(GpuCullPushConstant);
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = &gpuCullDescriptorSetLayout;
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &gpuCullPipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create GPU culling pipeline layout!");
+        }
+
+        VkComputePipelineCreateInfo pipelineInfo{};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipelineInfo.stage.module = compShaderModule;
+        pipelineInfo.stage.pName = "main";
+        pipelineInfo.layout = gpuCullPipelineLayout;
+
+        if (vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &gpuCullPipeline) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create GPU culling pipeline!");
+        }
+
+        vkDestroyShaderModule(device, compShaderModule, nullptr);
+    }
+
+    void createHiZPipeline() {
+        if (!gpuCullingSupported) return;
+
+        auto compShaderCode = readFile(expand_filename("hiz.comp.spv"));
+        VkShaderModule compShaderModule = createShaderModule(compShaderCode);
+
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(HiZPushConstant);
+
+        VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+        pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        pipelineLayoutInfo.setLayoutCount = 1;
+        pipelineLayoutInfo.pSetLayouts = &hiZDescriptorSetLayout;
+        pipelineLayoutInfo.pushConstantRangeCount = 1;
+        pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+        if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &hiZPipelineLayout) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create Hi-Z pipeline layout!");
+        }
+
+        VkComputePipelineCreateInfo pipelineInfo{};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipelineInfo.stage.module = compShaderModule;
+        pipelineInfo.stage.pName = "main";
+        pipelineInfo.layout = hiZPipelineLayout;
+
+        if (vkCreateComputePipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &hiZPipeline) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create Hi-Z pipeline!");
+        }
+
+        vkDestroyShaderModule(device, compShaderModule, nullptr);
+    }
+
+    void createFramebuffers() {
+        for (PerImage& pi : perImage) {
+            std::array<VkImageView, 2> attachments = {
+                pi.view,
+                depthImageView
+            };
+
+            VkFramebufferCreateInfo framebufferInfo{};
+            framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+            framebufferInfo.renderPass = renderPass;
+            framebufferInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+            framebufferInfo.pAttachments = attachments.data();
+            framebufferInfo.width = swapChainExtent.width;
+            framebufferInfo.height = swapChainExtent.height;
+            framebufferInfo.layers = 1;
+
+            if (vkCreateFramebuffer(device, &framebufferInfo, nullptr, &pi.framebuffer) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create framebuffer!");
+            }
+        }
+    }
+
+    void createCommandPool() {
+        QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
+
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+        if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create graphics command pool!");
+        }
+
+        // The groups' command buffers are recorded once each, one
+        // pool per job thread.
+        poolInfo.flags = 0;
+        drawCommandPools.resize(jobSystem.thread_count());
+        for (VkCommandPool& pool : drawCommandPools) {
+            if (vkCreateCommandPool(device, &poolInfo, nullptr, &pool) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create draw command pool!");
+            }
+        }
+    }
+
+    void createDepthResources() {
+        VkFormat depthFormat = findDepthFormat();
+
+        VkImageUsageFlags usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
+        if (hiZSupported) usage |= VK_IMAGE_USAGE_SAMPLED_BIT;
+        createImage(swapChainExtent.width, swapChainExtent.height, depthFormat, VK_IMAGE_TILING_OPTIMAL, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, depthImage, depthImageMemory);
+        depthImageView = createImageView(depthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
+        hiZDepthValid = false;
+    }
+
+    VkFormat findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features) {
+        for (VkFormat format : candidates) {
+            VkFormatProperties props;
+            vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &props);
+
+            if (tiling == VK_IMAGE_TILING_LINEAR && (props.linearTilingFeatures & features) == features) {
+                return format;
+            } else if (tiling == VK_IMAGE_TILING_OPTIMAL && (props.optimalTilingFeatures & features) == features) {
+                return format;
+            }
+        }
+
+        throw std::runtime_error("failed to find supported format!");
+    }
 
     VkFormat findDepthFormat() {
         return findSupportedFormat(
@@ -1025,26 +2380,17 @@ class Renderer {
             throw std::runtime_error("failed to load texture image " + filename);
         }
 
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
-        createBuffer(imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
-
-        void* data;
-        vkMapMemory(device, stagingBufferMemory, 0, imageSize, 0, &data);
-            memcpy(data, pixels, static_cast<size_t>(imageSize));
-        vkUnmapMemory(device, stagingBufferMemory);
+        VkDeviceSize stagingOffset = allocateStaging(imageSize);
+        memcpy(stagingRingData + stagingOffset, pixels, static_cast<size_t>(imageSize));
 
         stbi_image_free(pixels);
 
         createImage(texWidth, texHeight, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureInfo.image, textureInfo.memory);
 
         transitionImageLayout(textureInfo.image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-            copyBufferToImage(stagingBuffer, textureInfo.image, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
+            copyBufferToImage(stagingRingBuffer, stagingOffset, textureInfo.image, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
         transitionImageLayout(textureInfo.image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
-        vkDestroyBuffer(device, stagingBuffer, nullptr);
-        vkFreeMemory(device, stagingBufferMemory, nullptr);
-
         textureInfo.view = createImageView(textureInfo.image, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT);
 
         VkSamplerCreateInfo samplerInfo{};
@@ -1069,15 +2415,15 @@ class Renderer {
         return textureInfo;
     }
 
-    VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags) {
+    VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t baseMipLevel = 0, uint32_t levelCount = 1) {
         VkImageViewCreateInfo viewInfo{};
         viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
         viewInfo.image = image;
         viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
         viewInfo.format = format;
         viewInfo.subresourceRange.aspectMask = aspectFlags;
-        viewInfo.subresourceRange.baseMipLevel = 0;
-        viewInfo.subresourceRange.levelCount = 1;
+        viewInfo.subresourceRange.baseMipLevel = baseMipLevel;
+        viewInfo.subresourceRange.levelCount = levelCount;
         viewInfo.subresourceRange.baseArrayLayer = 0;
         viewInfo.subresourceRange.layerCount = 1;
 
@@ -1089,14 +2435,14 @@ class Renderer {
         return imageView;
     }
 
-    void createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory) {
+    void createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, MemoryAllocation& imageMemory, uint32_t mipLevels = 1) {
         VkImageCreateInfo imageInfo{};
         imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
         imageInfo.imageType = VK_IMAGE_TYPE_2D;
         imageInfo.extent.width = width;
         imageInfo.extent.height = height;
         imageInfo.extent.depth = 1;
-        imageInfo.mipLevels = 1;
+        imageInfo.mipLevels = mipLevels;
         imageInfo.arrayLayers = 1;
         imageInfo.format = format;
         imageInfo.tiling = tiling;
@@ -1105,6 +2451,14 @@ class Renderer {
         imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
         imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
+        // Uploaded by transfer batches, maybe on another queue family.
+        uint32_t queueFamilyIndices[] = {graphicsFamily, transferFamily};
+        if (transferFamily != graphicsFamily && (usage & VK_IMAGE_USAGE_TRANSFER_DST_BIT)) {
+            imageInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+            imageInfo.queueFamilyIndexCount = 2;
+            imageInfo.pQueueFamilyIndices = queueFamilyIndices;
+        }
+
         if (vkCreateImage(device, &imageInfo, nullptr, &image) != VK_SUCCESS) {
             throw std::runtime_error("failed to create image!");
         }
@@ -1112,20 +2466,12 @@ class Renderer {
         VkMemoryRequirements memRequirements;
         vkGetImageMemoryRequirements(device, image, &memRequirements);
 
-        VkMemoryAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocInfo.allocationSize = memRequirements.size;
-        allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-        if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate image memory!");
-        }
-
-        vkBindImageMemory(device, image, imageMemory, 0);
+        imageMemory = allocateMemory(memRequirements, properties, tiling == VK_IMAGE_TILING_OPTIMAL);
+        vkBindImageMemory(device, image, imageMemory.memory, imageMemory.offset);
     }
 
     void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout) {
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+        VkCommandBuffer commandBuffer = transferCommandBuffer();
 
         VkImageMemoryBarrier barrier{};
         barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
@@ -1155,6 +2501,13 @@ class Renderer {
 
             sourceStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
             destinationStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+
+            // A transfer-only queue has no fragment shader stage; the
+            // frame's wait on transferTimeline makes the copy visible.
+            if (transferQueue != graphicsQueue) {
+                barrier.dstAccessMask = 0;
+                destinationStage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+            }
         } else {
             throw std::invalid_argument("unsupported layout transition!");
         }
@@ -1167,15 +2520,13 @@ class Renderer {
             0, nullptr,
             1, &barrier
         );
-
-        endSingleTimeCommands(commandBuffer);
     }
 
-    void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height) {
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    void copyBufferToImage(VkBuffer buffer, VkDeviceSize offset, VkImage image, uint32_t width, uint32_t height) {
+        VkCommandBuffer commandBuffer = transferCommandBuffer();
 
         VkBufferImageCopy region{};
-        region.bufferOffset = 0;
+        region.bufferOffset = offset;
         region.bufferRowLength = 0;
         region.bufferImageHeight = 0;
         region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
@@ -1190,83 +2541,1503 @@ class Renderer {
         };
 
         vkCmdCopyBufferToImage(commandBuffer, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-
-        endSingleTimeCommands(commandBuffer);
     }
 
     void createVertexBuffer() {
         VkDeviceSize bufferSize = sizeof(vertices[0]) * vertices.size();
+        uploadDeviceLocalBuffer(vertices.data(), bufferSize, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vertexBuffer, vertexBufferMemory);
+    }
 
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
-        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+    void createIndexBuffer() {
+        VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
+        uploadDeviceLocalBuffer(indices.data(), bufferSize, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, indexBuffer, indexBufferMemory);
+    }
 
+    // Create stagingRingBuffer and map it for good.
+    void createStagingRing() {
+        createBuffer(stagingRingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingRingBuffer, stagingRingMemory);
         void* data;
-        vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-            memcpy(data, vertices.data(), (size_t) bufferSize);
-        vkUnmapMemory(device, stagingBufferMemory);
-
-        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, vertexBuffer, vertexBufferMemory);
+        if (vkMapMemory(device, stagingRingMemory.memory, stagingRingMemory.offset, stagingRingSize, 0, &data) != VK_SUCCESS) {
+            throw std::runtime_error("failed to map staging ring!");
+        }
+        stagingRingData = static_cast<uint8_t*>(data);
+    }
 
-        copyBuffer(stagingBuffer, vertexBuffer, bufferSize);
+    // Allocate size bytes (at most stagingRingSize) of the staging ring,
+    // returning their offset in stagingRingBuffer. Allocations don't
+    // wrap around the end of the ring. If the bytes still in use leave
+    // no room, submits the transfer batch being recorded and waits for
+    // batches, oldest first, until enough of the ring is free.
+    VkDeviceSize allocateStaging(VkDeviceSize size) {
+        if (size > stagingRingSize) {
+            throw std::runtime_error("upload too large for the staging ring!");
+        }
+        VkDeviceSize begin = (stagingHead + stagingAlignment - 1) / stagingAlignment * stagingAlignment;
+        if (begin % stagingRingSize + size > stagingRingSize) {
+            begin = (begin / stagingRingSize + 1) * stagingRingSize;
+        }
+        if (begin + size - stagingTail > stagingRingSize) {
+            flushTransfers();
+            pollTransfers();
+            bool waited = false;
+            uint64_t value = transferCompleted;
+            while (begin + size - stagingTail > stagingRingSize && value < transferValue) {
+                waited |= waitTransfers(++value);
+            }
+            if (waited) ++stagingStalls;
 
-        vkDestroyBuffer(device, stagingBuffer, nullptr);
-        vkFreeMemory(device, stagingBufferMemory, nullptr);
+            // All batches done: the whole ring is free.
+            if (begin + size - stagingTail > stagingRingSize) {
+                begin = (stagingHead / stagingRingSize + 1) * stagingRingSize;
+                stagingTail = begin;
+            }
+        }
+        stagingHead = begin + size;
+        return begin % stagingRingSize;
     }
 
-    void createIndexBuffer() {
-        VkDeviceSize bufferSize = sizeof(indices[0]) * indices.size();
+    // Create the transfer batches' command pool and command buffers,
+    // and transferTimeline.
+    void createTransferContext() {
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.queueFamilyIndex = transferFamily;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
-        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+        if (vkCreateCommandPool(device, &poolInfo, nullptr, &transferCommandPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create transfer command pool!");
+        }
 
-        void* data;
-        vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-            memcpy(data, indices.data(), (size_t) bufferSize);
-        vkUnmapMemory(device, stagingBufferMemory);
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = transferCommandPool;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        allocInfo.commandBufferCount = 1;
+
+        for (TransferBatch& batch : transferBatches) {
+            if (vkAllocateCommandBuffers(device, &allocInfo, &batch.commandBuffer) != VK_SUCCESS) {
+                throw std::runtime_error("failed to allocate transfer command buffer!");
+            }
+        }
+
+        if (!timelineSupported) {
+            VkFenceCreateInfo fenceInfo{};
+            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+            for (TransferBatch& batch : transferBatches) {
+                if (vkCreateFence(device, &fenceInfo, nullptr, &batch.fence) != VK_SUCCESS) {
+                    throw std::runtime_error("failed to create transfer fence!");
+                }
+            }
+            return;
+        }
 
-        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, indexBuffer, indexBufferMemory);
+        VkSemaphoreTypeCreateInfo typeInfo{};
+        typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+        typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+        typeInfo.initialValue = 0;
 
-        copyBuffer(stagingBuffer, indexBuffer, bufferSize);
+        VkSemaphoreCreateInfo semaphoreInfo{};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        semaphoreInfo.pNext = &typeInfo;
 
-        vkDestroyBuffer(device, stagingBuffer, nullptr);
-        vkFreeMemory(device, stagingBufferMemory, nullptr);
+        if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &transferTimeline) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create transfer timeline semaphore!");
+        }
     }
 
-    void createVoxelVertexBuffer() {
-        VkDeviceSize bufferSize = sizeof(voxels[0]) * voxels.size();
+    // The command buffer of the transfer batch being recorded, begun
+    // if need be.
+    VkCommandBuffer transferCommandBuffer() {
+        TransferBatch& batch = transferBatches[transferBatchIndex];
+        if (!transferRecording) {
+            // Normally done frames ago.
+            if (waitTransfers(batch.value)) ++stagingStalls;
+            vkResetCommandBuffer(batch.commandBuffer, 0);
+
+            VkCommandBufferBeginInfo beginInfo{};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            vkBeginCommandBuffer(batch.commandBuffer, &beginInfo);
+            transferRecording = true;
+        }
+        return batch.commandBuffer;
+    }
 
-        VkBuffer stagingBuffer;
-        VkDeviceMemory stagingBufferMemory;
-        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+    // Submit the transfer batch being recorded, if any, signaling the
+    // next transferTimeline value (or the batch's fence). On the
+    // graphics queue, a barrier at the end of the batch makes its
+    // copies visible to the frames submitted after it.
+    void flushTransfers() {
+        if (!transferRecording) return;
+        TransferBatch& batch = transferBatches[transferBatchIndex];
+        if (transferQueue == graphicsQueue) {
+            VkMemoryBarrier barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+            vkCmdPipelineBarrier(batch.commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+        }
+        vkEndCommandBuffer(batch.commandBuffer);
+        batch.value = ++transferValue;
+        batch.stagingEnd = stagingHead;
 
-        void* data;
-        vkMapMemory(device, stagingBufferMemory, 0, bufferSize, 0, &data);
-            memcpy(data, voxels.data(), (size_t) bufferSize);
-        vkUnmapMemory(device, stagingBufferMemory);
+        VkTimelineSemaphoreSubmitInfo timelineInfo{};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineInfo.signalSemaphoreValueCount = 1;
+        timelineInfo.pSignalSemaphoreValues = &batch.value;
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &batch.commandBuffer;
+        if (timelineSupported) {
+            submitInfo.pNext = &timelineInfo;
+            submitInfo.signalSemaphoreCount = 1;
+            submitInfo.pSignalSemaphores = &transferTimeline;
+        }
+
+        if (batch.fence != VK_NULL_HANDLE) vkResetFences(device, 1, &batch.fence);
+        if (vkQueueSubmit(transferQueue, 1, &submitInfo, batch.fence) != VK_SUCCESS) {
+            throw std::runtime_error("failed to submit transfer batch!");
+        }
+        transferRecording = false;
+        transferBatchIndex = (transferBatchIndex + 1) % transferBatchCount;
+    }
+
+    // The batch signaling the given value: batches are submitted in
+    // turn, each with the next value.
+    TransferBatch& transferBatchOf(uint64_t value) {
+        return transferBatches[(value - 1) % transferBatchCount];
+    }
+
+    // Catch up with the transfer batches the GPU has finished, freeing
+    // the staging ring up to the end of the last one.
+    void pollTransfers() {
+        if (timelineSupported) {
+            vkGetSemaphoreCounterValue(device, transferTimeline, &transferCompleted);
+        }
+        else {
+            while (transferCompleted < transferValue
+                   && vkGetFenceStatus(device, transferBatchOf(transferCompleted + 1).fence) == VK_SUCCESS) {
+                ++transferCompleted;
+            }
+        }
+        for (const TransferBatch& batch : transferBatches) {
+            if (batch.value != 0 && batch.value <= transferCompleted) {
+                stagingTail = std::max(stagingTail, batch.stagingEnd);
+            }
+        }
+    }
+
+    // Wait for the transfer batch that signals the given value (and all
+    // before it). Returns true iff it wasn't done yet.
+    bool waitTransfers(uint64_t value) {
+        if (value <= transferCompleted) return false;
+        pollTransfers();
+        if (value <= transferCompleted) return false;
+
+        if (timelineSupported) {
+            VkSemaphoreWaitInfo waitInfo{};
+            waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+            waitInfo.semaphoreCount = 1;
+            waitInfo.pSemaphores = &transferTimeline;
+            waitInfo.pValues = &value;
+            vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+        }
+        else {
+            while (transferCompleted < value) {
+                vkWaitForFences(device, 1, &transferBatchOf(transferCompleted + 1).fence, VK_TRUE, UINT64_MAX);
+                ++transferCompleted;
+            }
+        }
+        pollTransfers();
+        return true;
+    }
+
+    // Destroy the buffer, free its memory, and free the raycast
+    // descriptor set (if given, with the index of its pool) once the
+    // frames in flight and transfer batches are done with them. Resets
+    // the handles.
+    void retireBuffer(VkBuffer& buffer, MemoryAllocation& memory, VkDescriptorSet raycastDescriptorSet = VK_NULL_HANDLE, uint32_t raycastDescriptorPool = 0) {
+        if (buffer != VK_NULL_HANDLE || memory.memory != VK_NULL_HANDLE || raycastDescriptorSet != VK_NULL_HANDLE) {
+            retiredBuffers.push_back(RetiredBuffer{ buffer, memory, raycastDescriptorSet, raycastDescriptorPool });
+        }
+        buffer = VK_NULL_HANDLE;
+        memory = MemoryAllocation{};
+    }
+
+    // Retire the group's draw command buffer, so that the next frame
+    // the group is visible in records a new one.
+    void retireGroupDraw(GroupBuffer& gb) {
+        if (gb.drawCommands != VK_NULL_HANDLE) {
+            RetiredBuffer retired;
+            retired.drawCommands = gb.drawCommands;
+            retired.drawPool = gb.drawPool;
+            retiredBuffers.push_back(retired);
+        }
+        gb.drawCommands = VK_NULL_HANDLE;
+        gb.drawPipeline = VK_NULL_HANDLE;
+        gb.drawCount = 0;
+    }
+
+    void destroyRetiredBuffers(std::vector<RetiredBuffer>& retired) {
+        for (RetiredBuffer& r : retired) {
+            vkDestroyBuffer(device, r.buffer, nullptr);
+            freeMemory(r.memory);
+            if (r.raycastDescriptorSet != VK_NULL_HANDLE) {
+                RaycastDescriptorPool& pool = raycastDescriptorPools[r.raycastDescriptorPool];
+                vkFreeDescriptorSets(device, pool.pool, 1, &r.raycastDescriptorSet);
+                --pool.sets;
+            }
+            if (r.drawCommands != VK_NULL_HANDLE) {
+                vkFreeCommandBuffers(device, drawCommandPools[r.drawPool], 1, &r.drawCommands);
+            }
+            if (r.gpuCullDescriptorSet != VK_NULL_HANDLE) {
+                vkFreeDescriptorSets(device, gpuCullDescriptorPool, 1, &r.gpuCullDescriptorSet);
+            }
+        }
+        retired.clear();
+    }
+
+    // Copy size bytes from src to the device local buffer, at the given
+    // offset, through the staging ring. Uploads larger than half the
+    // ring go in pieces, so they don't need all of it free at once.
+    void uploadToBuffer(const void* src, VkDeviceSize size, VkBuffer buffer, VkDeviceSize offset = 0) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(src);
+        while (size != 0) {
+            VkDeviceSize pieceSize = std::min(size, stagingRingSize / 2);
+            VkDeviceSize stagingOffset = allocateStaging(pieceSize);
+            memcpy(stagingRingData + stagingOffset, bytes, (size_t) pieceSize);
+            copyBuffer(stagingRingBuffer, stagingOffset, buffer, offset, pieceSize);
+            frameUploadBytes += pieceSize;
+            bytes += pieceSize;
+            offset += pieceSize;
+            size -= pieceSize;
+        }
+    }
+
+    // Upload chunk groups of the world within the far plane that aren't
+    // on the GPU yet, nearest to the camera first, and at most
+    // Camera::max_frame_new_chunk_groups per frame, so loading a large
+    // world is spread over many frames instead of one long stall. The
+    // queue is re-prioritized every frame since the eye moves; only the
+    // front of it needs to be sorted. Groups of a region file are
+    // queued without loading them. The groups taken from the queue are
+    // loaded, meshed, and searched for occluders by jobs (so in
+    // parallel); only the uploads are left for this thread. When the
+    // eye enters another group, distant groups are evicted first.
+    void streamChunkGroups() {
+        if (!pendingWorldAdded) {
+            for (const auto& pair : world.get_groups()) {
+                if (!pair.second->empty()) addPendingGroup(pair.first);
+            }
+            pendingWorldAdded = true;
+        }
+        const RegionFile* region = world.get_region();
+        if (region != pendingRegion) {
+            for (size_t i = 0; region != nullptr && i < region->group_count(); ++i) {
+                addPendingGroup(region->group_coord(i));
+            }
+            pendingRegion = region;
+        }
+
+        glm::dvec3 eye = camera.get_eye();
+        glm::ivec3 eyeGroup = glm::ivec3(glm::floor(eye / double(myricube::group_size)));
+        int farPlane = camera.get_far_plane();
+        if (eyeGroup != queueEyeGroup || farPlane != queueFarPlane) {
+            evictDistantGroups();
+            uploadQueueDirty = true;
+            queueEyeGroup = eyeGroup;
+            queueFarPlane = farPlane;
+        }
+        if (uploadQueueDirty) {
+            uploadQueue.clear();
+            for (GroupCoord coord : pendingGroups) {
+                if (groupDistance(coord, eye) <= farPlane) uploadQueue.push_back(coord);
+            }
+            uploadQueueDirty = false;
+        }
+
+        double threshold = camera.get_raycast_threshold();
+        size_t count = std::min(uploadQueue.size(), size_t(std::max(camera.get_max_frame_new_chunk_groups(), 0)));
+        auto nearer = [eye] (GroupCoord a, GroupCoord b) {
+            return groupDistance(a, eye) < groupDistance(b, eye);
+        };
+        std::partial_sort(uploadQueue.begin(), uploadQueue.begin() + count, uploadQueue.end(), nearer);
+
+        // Groups not in memory yet are loaded by a job (RegionFile is
+        // safe to read from any thread; the world isn't).
+        streamedGroups.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            StreamedGroup& sg = streamedGroups[i];
+            sg.coord = uploadQueue[i];
+            pendingGroups.erase(sg.coord);
+            auto it = world.get_groups().find(sg.coord);
+            bool resident = it != world.get_groups().end();
+            sg.group = resident && !it->second->empty() ? it->second.get() : nullptr;
+            if (resident ? sg.group == nullptr : region == nullptr) continue;
+            sg.raycast = groupDistance(sg.coord, eye) >= threshold;
+            sg.lodLevel = lodLevelAt(groupDistance(sg.coord, eye));
+            sg.instances = InstanceList(voxelLayout);
+
+            JobId load = 0;
+            if (!resident) {
+                load = frameJobs.add("load", [&sg, region] (int) {
+                    sg.loaded = region->load_group(sg.coord);
+                    sg.group = sg.loaded.get();
+                });
+            }
+            JobId mesh = frameJobs.add("mesh", [this, &sg] (int worker) {
+                if (sg.group == nullptr) return;
+                const ChunkGroup& drawn = updateLod(sg.lod, sg.lodLevel, *sg.group);
+                if (sg.raycast) myricube::make_raycast_volume(drawn, &sg.volume);
+                else sg.instances.rebuild(drawn, getWorkerOccupancy(worker));
+            });
+            JobId occluders = frameJobs.add("occluders", [&sg] (int) {
+                if (sg.group != nullptr) myricube::find_occluders(*sg.group, &sg.occluders);
+            });
+            if (!resident) {
+                frameJobs.depend(mesh, load);
+                frameJobs.depend(occluders, load);
+            }
+        }
+        runJobs();
+
+        int newGroups = 0;
+        for (StreamedGroup& sg : streamedGroups) {
+            if (sg.loaded != nullptr) sg.group = world.add_loaded_group(std::move(sg.loaded));
+            if (sg.group == nullptr) continue;
+
+            GroupBuffer& gb = groupBuffers[sg.coord];
+            gb.coord = sg.coord;
+            addCullGroup(gb);
+            gb.occluders = std::move(sg.occluders);
+            gb.raycast = sg.raycast;
+            gb.lodLevel = sg.lodLevel;
+            gb.lod = std::move(sg.lod);
+            if (gb.raycast) {
+                uploadRaycastVolume(gb, sg.volume);
+            }
+            else {
+                gb.instances = std::move(sg.instances);
+                createVoxelVertexBuffer(gb);
+            }
+            ++newGroups;
+        }
+        // Keep the volumes' memory for next time.
+        for (StreamedGroup& sg : streamedGroups) {
+            sg.group = nullptr;
+            sg.lod.reset();
+            sg.instances = InstanceList();
+            sg.occluders.clear();
+        }
+        uploadQueue.erase(uploadQueue.begin(), uploadQueue.begin() + count);
+
+        streamStats.queueDepth = uploadQueue.size();
+        streamStats.newGroups = newGroups;
+    }
+
+    // Add the group to pendingGroups, unless it is uploaded.
+    void addPendingGroup(GroupCoord coord) {
+        if (groupBuffers.count(coord) != 0) return;
+        if (pendingGroups.insert(coord).second) uploadQueueDirty = true;
+    }
+
+    // Retire the buffers of the uploaded groups beyond the far plane
+    // plus evictMargin, and drop their GroupBuffers. They are pending
+    // again, to be streamed back in if the eye comes near. The voxels
+    // stay in the world.
+    void evictDistantGroups() {
+        glm::dvec3 eye = camera.get_eye();
+        double distance = camera.get_far_plane() + evictMargin;
+        int evicted = 0;
+        for (auto it = groupBuffers.begin(); it != groupBuffers.end(); ) {
+            GroupBuffer& gb = it->second;
+            if (groupDistance(gb.coord, eye) <= distance) {
+                ++it;
+                continue;
+            }
+            retireGroupDraw(gb);
+            retireBuffer(gb.buffer, gb.memory);
+            retireGreedyMesh(gb);
+            retireRaycastVolume(gb);
+            removeCullGroup(gb);
+            if (gb.edited) {
+                editedGroups.erase(std::find(editedGroups.begin(), editedGroups.end(), gb.coord));
+            }
+            pendingGroups.insert(gb.coord);
+            it = groupBuffers.erase(it);
+            ++evicted;
+        }
+        streamStats.evictedGroups = evicted;
+    }
+
+    // Remove the group's bounding box (and GPU culling record), moving
+    // the last group's into its place.
+    void removeCullGroup(GroupBuffer& gb) {
+        uint32_t i = gb.cullIndex;
+        uint32_t last = static_cast<uint32_t>(cullGroups.size() - 1);
+        GroupBuffer* moved = cullGroups[last];
+        cullBoxes.remove(i);
+        cullGroups[i] = moved;
+        cullGroups.pop_back();
+        moved->cullIndex = i;
+        if (!gpuCullingSupported) return;
+
+        // Records i and last change; the moved one needs uploading.
+        gpuRecords[i] = gpuRecords[last];
+        gpuRecords.pop_back();
+        dirtyGpuRecords.erase(std::remove_if(dirtyGpuRecords.begin(), dirtyGpuRecords.end(),
+            [i, last] (uint32_t d) { return d == i || d == last; }), dirtyGpuRecords.end());
+        if (moved != &gb) {
+            moved->gpuRecordDirty = false;
+            markGpuRecordDirty(*moved);
+        }
+    }
+
+    // (Re)create the GPU copy of the group's instance list, with
+    // headroom for instances added by later edits.
+    void createVoxelVertexBuffer(GroupBuffer& gb) {
+        const std::vector<VoxelInstance>& voxels = gb.instances.get_instances();
+        retireGroupDraw(gb);
+        retireBuffer(gb.buffer, gb.memory);
+
+        gb.capacity = voxels.size() + voxels.size() / 2 + 64;
+        VkDeviceSize bufferSize = sizeof(VoxelInstance) * gb.capacity;
+        VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+        if (gpuCullingSupported) usage |= VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+        createBuffer(bufferSize, usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, gb.buffer, gb.memory);
+
+        if (gpuCullingSupported) {
+            VkBufferDeviceAddressInfo addressInfo{};
+            addressInfo.sType = VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO;
+            addressInfo.buffer = gb.buffer;
+            gb.bufferAddress = vkGetBufferDeviceAddress(device, &addressInfo);
+        }
+
+        VkDeviceSize dataSize = sizeof(VoxelInstance) * voxels.size();
+        uploadToBuffer(voxels.data(), dataSize, gb.buffer);
+        updateGpuRecord(gb);
+    }
+
+    // Add the (new) group's bounding box for culling.
+    void addCullGroup(GroupBuffer& gb) {
+        glm::dvec3 lo = glm::dvec3(gb.coord.x, gb.coord.y, gb.coord.z) * double(myricube::group_size);
+        glm::dvec3 hi = lo + glm::dvec3(myricube::group_size);
+        gb.cullIndex = static_cast<uint32_t>(cullGroups.size());
+        cullBoxes.push_back(lo, hi);
+        cullGroups.push_back(&gb);
+        if (!gpuCullingSupported) return;
+
+        GpuCullRecord record{};
+        record.group = glm::ivec4(gb.coord.x, gb.coord.y, gb.coord.z, gb.lodLevel);
+        gpuRecords.push_back(record);
+        markGpuRecordDirty(gb);
+    }
+
+    // Move the culling boxes' origin to the eye's group once the eye is
+    // cullRebaseDistance from it, to keep the boxes near the eye precise.
+    void rebaseCullBoxes() {
+        glm::dvec3 eye = camera.get_eye();
+        glm::dvec3 offset = glm::abs(eye - cullBoxes.origin);
+        if (std::max(offset.x, std::max(offset.y, offset.z)) < cullRebaseDistance) return;
+        cullBoxes.rebase(glm::floor(eye / double(myricube::group_size)) * double(myricube::group_size));
+    }
+
+    // Recompute the group's occluders from the world.
+    void updateOccluders(GroupBuffer& gb) {
+        const ChunkGroup* group = world.get_group(gb.coord);
+        if (group != nullptr) myricube::find_occluders(*group, &gb.occluders);
+        else gb.occluders.clear();
+    }
+
+    // Cull the groups against the frustum and far plane, and then
+    // against the occluders of the visible groups, leaving the visible
+    // ones in visibleGroups. Runs as jobs: frustum culling of each
+    // range of cullRangeSize boxes, then rasterizing the occluders,
+    // then the occlusion tests of each range.
+    void cullVisibleGroups(const CullFrustum& frustum) {
+        size_t rangeCount = (cullBoxes.size() + cullRangeSize - 1) / cullRangeSize;
+        visibleRanges.resize(rangeCount);
+
+        JobId culled = frameJobs.add_range("frustum cull", cullBoxes.size(), cullRangeSize, [this, &frustum] (size_t begin, size_t end, int) {
+            myricube::cull_boxes(cullBoxes, frustum, begin, end, &visibleRanges[begin / cullRangeSize]);
+        });
+        JobId rasterized = frameJobs.add("occluders", [this] (int) {
+            gatherVisibleRanges();
+            cullStats.visible = visibleGroups.size();
+            cullStats.culled = cullBoxes.size() - visibleGroups.size();
+            rasterizeOccluders();
+        }, { culled });
+        frameJobs.add_range("occlusion test", rangeCount, 1, [this] (size_t begin, size_t end, int) {
+            auto occluded = [this] (uint32_t i) {
+                return occlusionBuffer->occluded(cullBoxes.get_min(i), cullBoxes.get_max(i));
+            };
+            for (size_t r = begin; r < end; ++r) {
+                std::vector<uint32_t>& range = visibleRanges[r];
+                range.erase(std::remove_if(range.begin(), range.end(), occluded), range.end());
+            }
+        }, { rasterized });
+        runJobs();
+
+        size_t before = visibleGroups.size();
+        gatherVisibleRanges();
+        cullStats.occluded = before - visibleGroups.size();
+        cullStats.visible = visibleGroups.size();
+    }
+
+    // Concatenate visibleRanges into visibleGroups.
+    void gatherVisibleRanges() {
+        visibleGroups.clear();
+        for (const std::vector<uint32_t>& range : visibleRanges) {
+            visibleGroups.insert(visibleGroups.end(), range.begin(), range.end());
+        }
+    }
+
+    // Rasterize the fully solid chunks of the visible groups near the
+    // eye, nearest first, into the occlusion buffer. Groups are never
+    // hidden by their own occluders, since those are no nearer than
+    // the group's box.
+    void rasterizeOccluders() {
+        glm::dvec3 eye = camera.get_eye();
+        occlusionBuffer->begin(camera.get_view(), camera.get_projection(), eye);
+
+        occluderGroups.clear();
+        for (uint32_t i : visibleGroups) {
+            const GroupBuffer& gb = *cullGroups[i];
+            if (!gb.occluders.empty() && groupDistance(gb.coord, eye) < occluderDistance) occluderGroups.push_back(i);
+        }
+        std::sort(occluderGroups.begin(), occluderGroups.end(), [this, eye] (uint32_t a, uint32_t b) {
+            return groupDistance(cullGroups[a]->coord, eye) < groupDistance(cullGroups[b]->coord, eye);
+        });
+
+        size_t occluderCount = 0;
+        for (uint32_t i : occluderGroups) {
+            const GroupBuffer& gb = *cullGroups[i];
+            glm::dvec3 origin = glm::dvec3(gb.coord.x, gb.coord.y, gb.coord.z) * double(myricube::group_size);
+            for (const OccluderBox& box : gb.occluders) {
+                if (occluderCount++ >= maxFrameOccluders) break;
+                occlusionBuffer->add_occluder(
+                    origin + glm::dvec3(box.lo[0], box.lo[1], box.lo[2]),
+                    origin + glm::dvec3(box.hi[0], box.hi[1], box.hi[2]));
+            }
+        }
+    }
+
+    OccupancyGrid* getWorkerOccupancy(int worker) {
+        std::unique_ptr<OccupancyGrid>& grid = workerOccupancy.at(worker);
+        if (grid == nullptr) grid = std::make_unique<OccupancyGrid>();
+        return grid.get();
+    }
+
+    // Run frameJobs (and clear it), adding the times of its jobs to
+    // jobStats.
+    void runJobs() {
+        jobSystem.run(frameJobs);
+
+        // Earliest start and latest end of each kind of job.
+        std::vector<std::pair<double, double>> spans(jobStats.size(), { HUGE_VAL, -HUGE_VAL });
+        for (const myricube::JobTiming& timing : frameJobs.timings()) {
+            if (timing.name[0] == '\0') continue;
+            size_t i = 0;
+            while (i < jobStats.size() && strcmp(jobStats[i].name, timing.name) != 0) ++i;
+            if (i == jobStats.size()) {
+                jobStats.emplace_back();
+                jobStats[i].name = timing.name;
+                spans.emplace_back(HUGE_VAL, -HUGE_VAL);
+            }
+            double ms = timing.end_ms - timing.start_ms;
+            JobStats& stats = jobStats[i];
+            ++stats.count;
+            stats.totalMs += ms;
+            stats.maxMs = std::max(stats.maxMs, ms);
+            spans[i].first = std::min(spans[i].first, timing.start_ms);
+            spans[i].second = std::max(spans[i].second, timing.end_ms);
+        }
+        for (size_t i = 0; i < spans.size(); ++i) {
+            if (spans[i].second >= spans[i].first) jobStats[i].wallMs += spans[i].second - spans[i].first;
+        }
+        frameJobs.clear();
+    }
+
+    void markGpuRecordDirty(GroupBuffer& gb) {
+        if (gb.gpuRecordDirty) return;
+        gb.gpuRecordDirty = true;
+        dirtyGpuRecords.push_back(gb.cullIndex);
+    }
+
+    // Update the group's GpuCullRecord after its instance buffer,
+    // instance count or level of detail changed.
+    void updateGpuRecord(GroupBuffer& gb) {
+        if (!gpuCullingSupported) return;
+        GpuCullRecord& record = gpuRecords.at(gb.cullIndex);
+        bool instanced = !gb.greedy && !gb.raycast && gb.buffer != VK_NULL_HANDLE;
+        uint32_t instanceCount = instanced ? static_cast<uint32_t>(gb.instances.size()) : 0;
+        VkDeviceAddress address = instanced ? gb.bufferAddress : 0;
+        if (record.instanceCount == instanceCount && record.instanceAddress == address && record.group.w == gb.lodLevel) return;
+
+        record.group.w = gb.lodLevel;
+        record.instanceCount = instanceCount;
+        record.instanceAddress = address;
+        markGpuRecordDirty(gb);
+    }
+
+    // Edit one voxel of the world, and patch the face bits of it and
+    // its neighbors in the CPU instance list (of groups drawn at level
+    // of detail 0; coarser ones are re-meshed whole, by jobs). The
+    // changed instances are uploaded by the next recordVoxelPatches.
+    // Groups that aren't uploaded (including ones created by this edit)
+    // are left pending for streamChunkGroups. If the edited chunk is
+    // compressed, world.set decompresses it right here: that is one
+    // 16 KiB chunk, cheaper than scheduling a job for it. (Reading
+    // compressed chunks, the bulk of the decoding, happens in the load
+    // and mesh jobs.)
+    void setVoxel(int32_t x, int32_t y, int32_t z, Voxel v) {
+        if (!world.set(x, y, z, v)) return;
+
+        GroupCoord coord = GroupCoord::from_world(x, y, z);
+        const ChunkGroup* group = world.get_group(coord);
+        auto it = groupBuffers.find(coord);
+        if (it == groupBuffers.end()) {
+            if (group != nullptr) addPendingGroup(coord);
+            return;
+        }
+
+        GroupBuffer& gb = it->second;
+        constexpr int32_t mask = myricube::group_size - 1;
+        if (gb.lod != nullptr) gb.lod->mark_dirty(x & mask, y & mask, z & mask);
+        if (!gb.greedy && !gb.raycast && gb.lodLevel == 0) gb.instances.update_voxel(group, x & mask, y & mask, z & mask);
+        if (!gb.edited) {
+            gb.edited = true;
+            editedGroups.push_back(coord);
+        }
+    }
+
+    // Switch every chunk group to the given instance layout,
+    // regenerating and re-uploading all instance buffers.
+    void setVoxelLayout(VoxelLayout layout) {
+        if (layout == voxelLayout) return;
+        voxelLayout = layout;
+
+        for (auto& pair : groupBuffers) {
+            GroupBuffer& gb = pair.second;
+            gb.instances = InstanceList(layout);
+            if (gb.greedy || gb.raycast) continue;
+            const ChunkGroup* group = world.get_group(gb.coord);
+            if (group == nullptr) continue;
+            frameJobs.add("mesh", [this, &gb, group] (int worker) {
+                gb.instances.rebuild(updateLod(gb.lod, gb.lodLevel, *group), getWorkerOccupancy(worker));
+            });
+        }
+        runJobs();
+
+        for (auto& pair : groupBuffers) {
+            GroupBuffer& gb = pair.second;
+            if (!gb.greedy && !gb.raycast) createVoxelVertexBuffer(gb);
+        }
+    }
+
+    // Switch the chunk group between the instanced path (in the current
+    // VoxelLayout) and a greedy mesh. For raycast groups, this takes
+    // effect once they come near again.
+    void setGroupGreedy(GroupCoord coord, bool greedy) {
+        auto it = groupBuffers.find(coord);
+        if (it == groupBuffers.end()) return;
+        GroupBuffer& gb = it->second;
+        if (gb.greedy == greedy) return;
+
+        gb.greedy = greedy;
+        if (gb.raycast) return;
+        createGroupMesh(gb);
+    }
+
+    // (Re)build the GPU mesh of a non-raycast group: its greedy mesh or
+    // its instances, depending on gb.greedy, freeing the other.
+    void createGroupMesh(GroupBuffer& gb) {
+        gb.instances = InstanceList(voxelLayout);
+        if (gb.greedy) {
+            createGreedyMesh(gb);
+        }
+        else {
+            retireGreedyMesh(gb);
+            const ChunkGroup* group = getDrawnGroup(gb);
+            if (group != nullptr) gb.instances.rebuild(*group, occupancyScratch.get());
+        }
+        // Shrinks the instance buffer to the minimum for greedy groups.
+        createVoxelVertexBuffer(gb);
+    }
+
+    // Minimum distance from the eye to any point of the chunk group.
+    static double groupDistance(GroupCoord coord, glm::dvec3 eye) {
+        constexpr double size = myricube::group_size;
+        glm::dvec3 lo = glm::dvec3(coord.x, coord.y, coord.z) * size;
+        glm::dvec3 nearest = glm::clamp(eye, lo, lo + size);
+        return glm::length(eye - nearest);
+    }
+
+    // Move chunk groups between the mesh and raycast paths according
+    // to their distance from the camera (Camera::raycast_threshold).
+    // There is a chunk's width of hysteresis so that groups right at
+    // the threshold don't get rebuilt every frame.
+    void updateRaycastGroups() {
+        glm::dvec3 eye = camera.get_eye();
+        double threshold = camera.get_raycast_threshold();
+
+        for (auto& pair : groupBuffers) {
+            GroupBuffer& gb = pair.second;
+            double distance = groupDistance(gb.coord, eye);
+            bool raycast = distance >= (gb.raycast ? threshold - myricube::chunk_size : threshold);
+            if (raycast == gb.raycast) continue;
+
+            gb.raycast = raycast;
+            if (raycast) {
+                gb.instances = InstanceList(voxelLayout);
+                retireGreedyMesh(gb);
+                retireGroupDraw(gb);
+                retireBuffer(gb.buffer, gb.memory);
+                gb.capacity = 0;
+                gb.bufferAddress = 0;
+                updateGpuRecord(gb);
+                createRaycastVolume(gb);
+            }
+            else {
+                retireRaycastVolume(gb);
+                createGroupMesh(gb);
+            }
+        }
+    }
+
+    // Level of detail for chunk groups at the given distance from the
+    // eye: 0 nearer than Camera::lod_distance, and one more each time
+    // the distance doubles, so that coarse voxels stay about the same
+    // size on screen.
+    int lodLevelAt(double distance) {
+        double lodDistance = camera.get_lod_distance();
+        int level = 0;
+        while (level < myricube::max_lod_level && distance >= lodDistance) {
+            ++level;
+            lodDistance *= 2;
+        }
+        return level;
+    }
+
+    // Move chunk groups to the level of detail for their distance from
+    // the camera, with a chunk's width of hysteresis (like
+    // updateRaycastGroups). The levels of the groups that switch are
+    // brought up-to-date, and their instances rebuilt, by jobs; then
+    // the groups are re-uploaded at the new level.
+    void updateGroupLods() {
+        glm::dvec3 eye = camera.get_eye();
+        lodStats = LodStats();
+        lodSwitchGroups.clear();
+
+        for (auto& pair : groupBuffers) {
+            GroupBuffer& gb = pair.second;
+            double distance = groupDistance(gb.coord, eye);
+            int level = lodLevelAt(distance);
+            if (level < gb.lodLevel) level = std::min(gb.lodLevel, lodLevelAt(distance + myricube::chunk_size));
+            ++lodStats.groups[level];
+            if (level == gb.lodLevel) continue;
+
+            gb.lodLevel = level;
+            gb.instances = InstanceList(voxelLayout);
+            lodSwitchGroups.push_back(&gb);
+            const ChunkGroup* group = world.get_group(gb.coord);
+            if (group == nullptr) continue;
+            frameJobs.add("lod", [this, &gb, group] (int worker) {
+                const ChunkGroup& drawn = updateLod(gb.lod, gb.lodLevel, *group);
+                if (!gb.greedy && !gb.raycast) gb.instances.rebuild(drawn, getWorkerOccupancy(worker));
+            });
+        }
+        runJobs();
+
+        for (GroupBuffer* gb : lodSwitchGroups) {
+            if (gb->raycast) createRaycastVolume(*gb);
+            else if (gb->greedy) createGreedyMesh(*gb);
+            else createVoxelVertexBuffer(*gb);
+        }
+    }
+
+    // Return the given level of detail of the chunk group (the group
+    // itself for level 0), creating *lod or regenerating its dirty
+    // chunks as needed. Safe to call from jobs (for different lods).
+    const ChunkGroup& updateLod(std::unique_ptr<GroupLod>& lod, int level, const ChunkGroup& group) {
+        if (level == 0) return group;
+        if (lod == nullptr) lod = std::make_unique<GroupLod>(group.get_coord());
+        lodUpdatedChunks += lod->update(group);
+        return lod->get_level(level);
+    }
+
+    // The chunk group at the level of detail it is drawn at, or nullptr
+    // if it is empty.
+    const ChunkGroup* getDrawnGroup(GroupBuffer& gb) {
+        const ChunkGroup* group = world.get_group(gb.coord);
+        return group == nullptr ? nullptr : &updateLod(gb.lod, gb.lodLevel, *group);
+    }
+
+    // (Re)generate and upload the group's raycast volume, with its
+    // descriptor set.
+    void createRaycastVolume(GroupBuffer& gb) {
+        const ChunkGroup* group = getDrawnGroup(gb);
+        if (group != nullptr) myricube::make_raycast_volume(*group, &volumeScratch);
+        else volumeScratch = RaycastVolume();
+        uploadRaycastVolume(gb, volumeScratch);
+    }
+
+    // Upload the given raycast volume as the group's, with its
+    // descriptor set.
+    void uploadRaycastVolume(GroupBuffer& gb, const RaycastVolume& volume) {
+        retireRaycastVolume(gb);
+        if (volume.empty()) return;
+
+        uploadDeviceLocalBuffer(volume.words.data(), sizeof(uint32_t) * volume.words.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, gb.volumeBuffer, gb.volumeMemory);
+        gb.volumeBoxMin = glm::ivec4(volume.box_min[0], volume.box_min[1], volume.box_min[2], 0);
+        gb.volumeBoxMax = glm::ivec4(volume.box_max[0], volume.box_max[1], volume.box_max[2], 0);
+
+        gb.volumeDescriptorSet = allocateRaycastDescriptorSet(gb.volumeDescriptorPool);
+
+        VkDescriptorBufferInfo bufferInfo{};
+        bufferInfo.buffer = gb.volumeBuffer;
+        bufferInfo.offset = 0;
+        bufferInfo.range = VK_WHOLE_SIZE;
+
+        VkWriteDescriptorSet descriptorWrite{};
+        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrite.dstSet = gb.volumeDescriptorSet;
+        descriptorWrite.dstBinding = 0;
+        descriptorWrite.dstArrayElement = 0;
+        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrite.descriptorCount = 1;
+        descriptorWrite.pBufferInfo = &bufferInfo;
+
+        vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+    }
+
+    void retireRaycastVolume(GroupBuffer& gb) {
+        retireGroupDraw(gb);
+        retireBuffer(gb.volumeBuffer, gb.volumeMemory, gb.volumeDescriptorSet, gb.volumeDescriptorPool);
+        gb.volumeDescriptorSet = VK_NULL_HANDLE;
+    }
+
+    // Allocate a raycast descriptor set from the first pool with room
+    // for it, adding a pool if all are full, and set pool to its index.
+    VkDescriptorSet allocateRaycastDescriptorSet(uint32_t& pool) {
+        pool = 0;
+        while (pool < raycastDescriptorPools.size() && raycastDescriptorPools[pool].sets == raycastPoolSets) ++pool;
+        if (pool == raycastDescriptorPools.size()) createRaycastDescriptorPool();
+
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = raycastDescriptorPools[pool].pool;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts = &raycastDescriptorSetLayout;
+
+        VkDescriptorSet descriptorSet;
+        if (vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate raycast descriptor set!");
+        }
+        ++raycastDescriptorPools[pool].sets;
+        return descriptorSet;
+    }
+
+    // (Re)generate and upload the group's greedy mesh.
+    void createGreedyMesh(GroupBuffer& gb) {
+        const ChunkGroup* group = getDrawnGroup(gb);
+        if (group != nullptr) myricube::make_greedy_mesh(*group, occupancyScratch.get(), &meshScratch);
+        else meshScratch = GreedyMesh();
+        uploadGreedyMesh(gb, meshScratch);
+    }
+
+    // Upload the given greedy mesh as the group's.
+    void uploadGreedyMesh(GroupBuffer& gb, const GreedyMesh& mesh) {
+        retireGreedyMesh(gb);
+        if (mesh.indices.empty()) return;
+
+        uploadDeviceLocalBuffer(mesh.vertices.data(), sizeof(GreedyVertex) * mesh.vertices.size(), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, gb.meshVertexBuffer, gb.meshVertexMemory);
+        uploadDeviceLocalBuffer(mesh.indices.data(), sizeof(uint32_t) * mesh.indices.size(), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, gb.meshIndexBuffer, gb.meshIndexMemory);
+        gb.meshIndexCount = static_cast<uint32_t>(mesh.indices.size());
+    }
+
+    void retireGreedyMesh(GroupBuffer& gb) {
+        retireGroupDraw(gb);
+        retireBuffer(gb.meshVertexBuffer, gb.meshVertexMemory);
+        retireBuffer(gb.meshIndexBuffer, gb.meshIndexMemory);
+        gb.meshIndexCount = 0;
+    }
+
+    // Create a device local buffer with the given usage (plus transfer
+    // dst) and copy the data into it through the staging ring.
+    void uploadDeviceLocalBuffer(const void* src, VkDeviceSize bufferSize, VkBufferUsageFlags usage, VkBuffer& buffer, MemoryAllocation& bufferMemory) {
+        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, bufferMemory);
+        uploadToBuffer(src, bufferSize, buffer);
+    }
+
+    // Upload the instances changed by setVoxel since the last frame.
+    // These are written with vkCmdUpdateBuffer into this frame's
+    // command buffer (outside the render pass), so there is no staging
+    // buffer or queue wait. Groups that outgrew their buffer are
+    // re-uploaded whole instead. Groups remeshed whole (see
+    // RemeshedGroup) get jobs added to frameJobs, which run with this
+    // frame's culling (see cullVisibleGroups); the meshes rebuilt last
+    // frame are uploaded first.
+    void recordVoxelPatches(VkCommandBuffer commandBuffer) {
+        bool anyPatches = false;
+        uploadRemeshedGroups();
+
+        for (GroupCoord coord : editedGroups) {
+            GroupBuffer& gb = groupBuffers.at(coord);
+            gb.edited = false;
+            updateOccluders(gb);
+            if (gb.raycast || gb.greedy || gb.lodLevel > 0) {
+                RemeshedGroup rg;
+                rg.coord = coord;
+                rg.greedy = gb.greedy;
+                rg.raycast = gb.raycast;
+                rg.lodLevel = gb.lodLevel;
+                rg.instances = InstanceList(voxelLayout);
+                remeshedGroups.push_back(std::move(rg));
+                gb.remeshPending = true;
+                continue;
+            }
+            gb.instances.take_dirty(&dirtyScratch);
+
+            if (gb.instances.size() > gb.capacity) {
+                createVoxelVertexBuffer(gb);
+                continue;
+            }
+            updateGpuRecord(gb);
+            if (dirtyScratch.empty()) continue;
+
+            if (!anyPatches) {
+                // Don't overwrite instances earlier frames are still
+                // reading (as vertex input, or by address with GPU culling).
+                VkMemoryBarrier barrier{};
+                barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+                barrier.srcAccessMask = 0;
+                barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+                vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+                anyPatches = true;
+            }
+
+            // Coalesce runs of consecutive dirty instances into one
+            // update each (at most 65536 bytes per vkCmdUpdateBuffer).
+            const VoxelInstance* instances = gb.instances.get_instances().data();
+            constexpr size_t maxRun = 65536 / sizeof(VoxelInstance);
+            size_t i = 0;
+            while (i < dirtyScratch.size()) {
+                size_t j = i + 1;
+                while (j < dirtyScratch.size() && dirtyScratch[j] == dirtyScratch[j-1] + 1 && j - i < maxRun) ++j;
+
+                uint32_t first = dirtyScratch[i];
+                vkCmdUpdateBuffer(commandBuffer, gb.buffer, first * sizeof(VoxelInstance), (j - i) * sizeof(VoxelInstance), &instances[first]);
+                frameUploadBytes += (j - i) * sizeof(VoxelInstance);
+                i = j;
+            }
+        }
+        editedGroups.clear();
+
+        // The world isn't edited, nor groups evicted, while jobs run.
+        for (RemeshedGroup& rg : remeshedGroups) {
+            GroupBuffer* gb = &groupBuffers.at(rg.coord);
+            const ChunkGroup* group = world.get_group(rg.coord);
+            if (group == nullptr) continue;
+            frameJobs.add("remesh", [this, &rg, gb, group] (int worker) {
+                const ChunkGroup& drawn = updateLod(gb->lod, rg.lodLevel, *group);
+                if (rg.raycast) myricube::make_raycast_volume(drawn, &rg.volume);
+                else if (rg.greedy) myricube::make_greedy_mesh(drawn, getWorkerOccupancy(worker), &rg.mesh);
+                else rg.instances.rebuild(drawn, getWorkerOccupancy(worker));
+            });
+        }
+
+        if (anyPatches) {
+            VkMemoryBarrier barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+        }
+    }
+
+    // Upload the groups rebuilt by last frame's remesh jobs, unless
+    // they have been evicted, or are now drawn another way, at another
+    // level of detail or in another layout, since then they were
+    // rebuilt already. Edits since the jobs ran are remeshed again.
+    void uploadRemeshedGroups() {
+        for (RemeshedGroup& rg : remeshedGroups) {
+            auto it = groupBuffers.find(rg.coord);
+            if (it == groupBuffers.end() || !it->second.remeshPending) continue;
+            GroupBuffer& gb = it->second;
+            gb.remeshPending = false;
+            if (gb.greedy != rg.greedy || gb.raycast != rg.raycast || gb.lodLevel != rg.lodLevel) continue;
+            if (rg.instances.get_layout() != voxelLayout) continue;
+
+            if (gb.raycast) {
+                uploadRaycastVolume(gb, rg.volume);
+            }
+            else if (gb.greedy) {
+                uploadGreedyMesh(gb, rg.mesh);
+            }
+            else {
+                gb.instances = std::move(rg.instances);
+                createVoxelVertexBuffer(gb);
+            }
+        }
+        remeshedGroups.clear();
+    }
+
+    // (Re)allocate the GPU culling buffers with room for the given
+    // number of groups, upload all records, and make a new cull.comp
+    // descriptor set pointing at them (frames in flight may still use
+    // the old one, which is retired with the old buffers).
+    void createGpuCullBuffers(uint32_t capacity) {
+        retireGpuCullBuffers();
+
+        std::vector<GpuCullRecord> records(capacity);
+        std::copy(gpuRecords.begin(), gpuRecords.end(), records.begin());
+        uploadDeviceLocalBuffer(records.data(), sizeof(GpuCullRecord) * capacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, gpuRecordBuffer, gpuRecordMemory);
+        for (uint32_t i : dirtyGpuRecords) cullGroups[i]->gpuRecordDirty = false;
+        dirtyGpuRecords.clear();
+
+        createBuffer(sizeof(GpuDraw) * capacity, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, gpuDrawBuffer, gpuDrawMemory);
+        createBuffer(sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, gpuCountBuffer, gpuCountMemory);
+        createBuffer(sizeof(GpuHiZParams), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, gpuHiZParamsBuffer, gpuHiZParamsMemory);
+        gpuRecordCapacity = capacity;
+
+        // The Hi-Z pyramid is that of the previous set.
+        VkDescriptorSet previousSet = gpuCullDescriptorSet;
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = gpuCullDescriptorPool;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts = &gpuCullDescriptorSetLayout;
+        if (vkAllocateDescriptorSets(device, &allocInfo, &gpuCullDescriptorSet) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate GPU culling descriptor set!");
+        }
+        if (previousSet != VK_NULL_HANDLE) {
+            VkCopyDescriptorSet descriptorCopy{};
+            descriptorCopy.sType = VK_STRUCTURE_TYPE_COPY_DESCRIPTOR_SET;
+            descriptorCopy.srcSet = previousSet;
+            descriptorCopy.srcBinding = 4;
+            descriptorCopy.dstSet = gpuCullDescriptorSet;
+            descriptorCopy.dstBinding = 4;
+            descriptorCopy.descriptorCount = 1;
+            vkUpdateDescriptorSets(device, 0, nullptr, 1, &descriptorCopy);
+
+            RetiredBuffer retired;
+            retired.gpuCullDescriptorSet = previousSet;
+            retiredBuffers.push_back(retired);
+        }
+
+        std::array<VkDescriptorBufferInfo, 4> bufferInfos{};
+        bufferInfos[0].buffer = gpuRecordBuffer;
+        bufferInfos[1].buffer = gpuDrawBuffer;
+        bufferInfos[2].buffer = gpuCountBuffer;
+        bufferInfos[3].buffer = gpuHiZParamsBuffer;
+
+        std::array<VkWriteDescriptorSet, 4> descriptorWrites{};
+        for (uint32_t i = 0; i < descriptorWrites.size(); ++i) {
+            bufferInfos[i].offset = 0;
+            bufferInfos[i].range = VK_WHOLE_SIZE;
+
+            descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[i].dstSet = gpuCullDescriptorSet;
+            descriptorWrites[i].dstBinding = i;
+            descriptorWrites[i].dstArrayElement = 0;
+            descriptorWrites[i].descriptorType = i == 3 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            descriptorWrites[i].descriptorCount = 1;
+            descriptorWrites[i].pBufferInfo = &bufferInfos[i];
+        }
+
+        vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+    }
+
+    // The old record buffer may still be written by a transfer batch.
+    void retireGpuCullBuffers() {
+        retireBuffer(gpuRecordBuffer, gpuRecordMemory);
+        retireBuffer(gpuDrawBuffer, gpuDrawMemory);
+        retireBuffer(gpuCountBuffer, gpuCountMemory);
+        retireBuffer(gpuHiZParamsBuffer, gpuHiZParamsMemory);
+        gpuRecordCapacity = 0;
+    }
+
+    // Create the Hi-Z pyramid for the current depth image, the views and
+    // hiz.comp descriptor sets of its levels, and a new cull.comp
+    // descriptor set pointing at it (frames in flight may still use the
+    // old one). The pyramid is made even without hiZSupported (then it's
+    // never built, nor read), as the descriptor set needs it.
+    void createHiZResources() {
+        if (!gpuCullingSupported) return;
+
+        auto floorPowerOfTwo = [] (uint32_t n) {
+            uint32_t p = 1;
+            while (p * 2 <= n) p *= 2;
+            return p;
+        };
+        hiZExtent.width = floorPowerOfTwo(swapChainExtent.width);
+        hiZExtent.height = floorPowerOfTwo(swapChainExtent.height);
+        uint32_t levelCount = 1;
+        while ((std::max(hiZExtent.width, hiZExtent.height) >> levelCount) != 0) ++levelCount;
+
+        const VkFormat format = VK_FORMAT_R32G32_SFLOAT;
+        createImage(hiZExtent.width, hiZExtent.height, format, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, hiZImage, hiZImageMemory, levelCount);
+        hiZView = createImageView(hiZImage, format, VK_IMAGE_ASPECT_COLOR_BIT, 0, levelCount);
+        hiZLevelViews.resize(levelCount);
+        for (uint32_t i = 0; i < levelCount; ++i) {
+            hiZLevelViews[i] = createImageView(hiZImage, format, VK_IMAGE_ASPECT_COLOR_BIT, i, 1);
+        }
+
+        // Moved to the general layout by the next recordGpuCulling.
+        hiZLayoutUndefined = true;
+
+        VkSamplerCreateInfo samplerInfo{};
+        samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerInfo.magFilter = VK_FILTER_NEAREST;
+        samplerInfo.minFilter = VK_FILTER_NEAREST;
+        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+        if (vkCreateSampler(device, &samplerInfo, nullptr, &hiZSampler) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create Hi-Z sampler!");
+        }
+
+        std::array<VkDescriptorPoolSize, 2> poolSizes{};
+        poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        poolSizes[0].descriptorCount = levelCount;
+        poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+        poolSizes[1].descriptorCount = levelCount;
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+        poolInfo.pPoolSizes = poolSizes.data();
+        poolInfo.maxSets = levelCount;
+        if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &hiZDescriptorPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create Hi-Z descriptor pool!");
+        }
+
+        std::vector<VkDescriptorSetLayout> layouts(levelCount, hiZDescriptorSetLayout);
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = hiZDescriptorPool;
+        allocInfo.descriptorSetCount = levelCount;
+        allocInfo.pSetLayouts = layouts.data();
+        hiZDescriptorSets.resize(levelCount);
+        if (vkAllocateDescriptorSets(device, &allocInfo, hiZDescriptorSets.data()) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate Hi-Z descriptor sets!");
+        }
+
+        // Level i is built from level i-1, level 0 from the depth image.
+        for (uint32_t i = 0; i < levelCount; ++i) {
+            VkDescriptorImageInfo sourceInfo{};
+            sourceInfo.sampler = hiZSampler;
+            sourceInfo.imageView = i == 0 ? depthImageView : hiZLevelViews[i-1];
+            sourceInfo.imageLayout = i == 0 ? VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+            VkDescriptorImageInfo destinationInfo{};
+            destinationInfo.imageView = hiZLevelViews[i];
+            destinationInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+            std::array<VkWriteDescriptorSet, 2> descriptorWrites{};
+            for (uint32_t j = 0; j < descriptorWrites.size(); ++j) {
+                descriptorWrites[j].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+                descriptorWrites[j].dstSet = hiZDescriptorSets[i];
+                descriptorWrites[j].dstBinding = j;
+                descriptorWrites[j].descriptorCount = 1;
+            }
+            descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+            descriptorWrites[0].pImageInfo = &sourceInfo;
+            descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            descriptorWrites[1].pImageInfo = &destinationInfo;
+
+            // Level 0 can't sample a depth image without hiZSupported.
+            if (i == 0 && !hiZSupported) {
+                vkUpdateDescriptorSets(device, 1, &descriptorWrites[1], 0, nullptr);
+                continue;
+            }
+            vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+        }
+
+        // The buffers, if any yet, are those of the previous set.
+        VkDescriptorSet previousSet = gpuCullDescriptorSet;
+        VkDescriptorSetAllocateInfo cullAllocInfo{};
+        cullAllocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        cullAllocInfo.descriptorPool = gpuCullDescriptorPool;
+        cullAllocInfo.descriptorSetCount = 1;
+        cullAllocInfo.pSetLayouts = &gpuCullDescriptorSetLayout;
+        if (vkAllocateDescriptorSets(device, &cullAllocInfo, &gpuCullDescriptorSet) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate GPU culling descriptor set!");
+        }
+        if (previousSet != VK_NULL_HANDLE && gpuRecordCapacity != 0) {
+            std::array<VkCopyDescriptorSet, 4> descriptorCopies{};
+            for (uint32_t i = 0; i < descriptorCopies.size(); ++i) {
+                descriptorCopies[i].sType = VK_STRUCTURE_TYPE_COPY_DESCRIPTOR_SET;
+                descriptorCopies[i].srcSet = previousSet;
+                descriptorCopies[i].srcBinding = i;
+                descriptorCopies[i].dstSet = gpuCullDescriptorSet;
+                descriptorCopies[i].dstBinding = i;
+                descriptorCopies[i].descriptorCount = 1;
+            }
+            vkUpdateDescriptorSets(device, 0, nullptr, static_cast<uint32_t>(descriptorCopies.size()), descriptorCopies.data());
+        }
+
+        VkDescriptorImageInfo pyramidInfo{};
+        pyramidInfo.sampler = hiZSampler;
+        pyramidInfo.imageView = hiZView;
+        pyramidInfo.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        VkWriteDescriptorSet descriptorWrite{};
+        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrite.dstSet = gpuCullDescriptorSet;
+        descriptorWrite.dstBinding = 4;
+        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptorWrite.descriptorCount = 1;
+        descriptorWrite.pImageInfo = &pyramidInfo;
+        vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+    }
+
+    // Build the Hi-Z pyramid from the previous frame's depth image,
+    // one hiz.comp dispatch per level. The depth image goes back to
+    // the attachment layout afterwards (its contents are then cleared
+    // by the render pass).
+    void recordHiZPyramid(VkCommandBuffer commandBuffer) {
+        VkImageAspectFlags depthAspect = VK_IMAGE_ASPECT_DEPTH_BIT;
+        if (hasStencilComponent(findDepthFormat())) depthAspect |= VK_IMAGE_ASPECT_STENCIL_BIT;
+
+        VkImageMemoryBarrier depthBarrier{};
+        depthBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        depthBarrier.oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        depthBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        depthBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        depthBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        depthBarrier.image = depthImage;
+        depthBarrier.subresourceRange.aspectMask = depthAspect;
+        depthBarrier.subresourceRange.levelCount = 1;
+        depthBarrier.subresourceRange.layerCount = 1;
+        depthBarrier.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        depthBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+        // The previous frame's culling must be done reading the pyramid.
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 1, &depthBarrier);
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, hiZPipeline);
+        HiZPushConstant pushConstant{};
+        pushConstant.sourceSize = glm::ivec2(swapChainExtent.width, swapChainExtent.height);
+        pushConstant.fromDepth = 1;
+        for (uint32_t i = 0; i < hiZLevelViews.size(); ++i) {
+            glm::ivec2 size = glm::max(glm::ivec2(hiZExtent.width >> i, hiZExtent.height >> i), glm::ivec2(1));
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, hiZPipelineLayout, 0, 1, &hiZDescriptorSets[i], 0, nullptr);
+            vkCmdPushConstants(commandBuffer, hiZPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(HiZPushConstant), &pushConstant);
+            vkCmdDispatch(commandBuffer, (size.x + 7) / 8, (size.y + 7) / 8, 1);
+
+            // Read by the next level, or by cull.comp.
+            barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+            pushConstant.sourceSize = size;
+            pushConstant.fromDepth = 0;
+        }
+
+        depthBarrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        depthBarrier.newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+        depthBarrier.srcAccessMask = 0;
+        depthBarrier.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT, 0, 0, nullptr, 0, nullptr, 1, &depthBarrier);
+    }
+
+    // Record the GPU culling pass (outside the render pass): upload
+    // the changed GpuCullRecords, build the Hi-Z pyramid if enabled,
+    // then cull.comp writes the draws of the visible instanced groups
+    // and their count for vkCmdDrawIndirectCount.
+    void recordGpuCulling(VkCommandBuffer commandBuffer, const CullFrustum& frustum) {
+        uint32_t recordCount = static_cast<uint32_t>(gpuRecords.size());
+        if (recordCount > gpuRecordCapacity) {
+            createGpuCullBuffers(std::max(recordCount * 2, uint32_t(1024)));
+        }
+
+        // Earlier frames' culling and draws must be done with the
+        // buffers before they're overwritten.
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        for (uint32_t i : dirtyGpuRecords) {
+            vkCmdUpdateBuffer(commandBuffer, gpuRecordBuffer, i * sizeof(GpuCullRecord), sizeof(GpuCullRecord), &gpuRecords[i]);
+            frameUploadBytes += sizeof(GpuCullRecord);
+            cullGroups[i]->gpuRecordDirty = false;
+        }
+        dirtyGpuRecords.clear();
+        vkCmdFillBuffer(commandBuffer, gpuCountBuffer, 0, sizeof(uint32_t), 0);
+
+        bool hiZ = hiZCulling && hiZDepthValid;
+        GpuHiZParams hiZParams{};
+        hiZParams.viewProjection = hiZViewProjection;
+        splitEye(hiZEye, &hiZParams.eyeGroup, &hiZParams.eyeResidue);
+        hiZParams.depthSize = glm::ivec2(swapChainExtent.width, swapChainExtent.height);
+        hiZParams.baseSize = glm::ivec2(hiZExtent.width, hiZExtent.height);
+        hiZParams.levelCount = static_cast<int32_t>(hiZLevelViews.size());
+        hiZParams.enabled = hiZ;
+        vkCmdUpdateBuffer(commandBuffer, gpuHiZParamsBuffer, 0, sizeof(GpuHiZParams), &hiZParams);
+
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_UNIFORM_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        // The pyramid stays in the general layout, for both hiz.comp's
+        // writes and the samplers.
+        if (hiZLayoutUndefined) {
+            VkImageMemoryBarrier layoutBarrier{};
+            layoutBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            layoutBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            layoutBarrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+            layoutBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            layoutBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            layoutBarrier.image = hiZImage;
+            layoutBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            layoutBarrier.subresourceRange.levelCount = static_cast<uint32_t>(hiZLevelViews.size());
+            layoutBarrier.subresourceRange.layerCount = 1;
+            layoutBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &layoutBarrier);
+            hiZLayoutUndefined = false;
+        }
+
+        if (hiZ) recordHiZPyramid(commandBuffer);
+
+        GpuCullPushConstant pushConstant{};
+        for (int i = 0; i < 6; ++i) {
+            pushConstant.planes[i] = glm::vec4(frustum.planes[i][0], frustum.planes[i][1], frustum.planes[i][2], frustum.planes[i][3]);
+        }
+        splitEye(frustum.eye, &pushConstant.eyeGroup, &pushConstant.eyeResidue);
+        pushConstant.eyeResidue.w = frustum.far_squared;
+        pushConstant.recordCount = recordCount;
+
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, gpuCullPipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, gpuCullPipelineLayout, 0, 1, &gpuCullDescriptorSet, 0, nullptr);
+        vkCmdPushConstants(commandBuffer, gpuCullPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(GpuCullPushConstant), &pushConstant);
+        vkCmdDispatch(commandBuffer, (recordCount + 63) / 64, 1, 1);
+
+        barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+    }
+
+    void createDescriptorPool() {
+        std::array<VkDescriptorPoolSize, 1> poolSizes{};
+        poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        poolSizes[0].descriptorCount = static_cast<uint32_t>(perImage.size() * 2);
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+        poolInfo.pPoolSizes = poolSizes.data();
+        poolInfo.maxSets = static_cast<uint32_t>(perImage.size() * 2);
+
+        if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create descriptor pool!");
+        }
+    }
+
+    // The camera uniform buffer, and its descriptor set (with a pool of
+    // its own).
+    void createCameraUniform() {
+        createBuffer(sizeof(CameraUniform), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, cameraBuffer, cameraMemory);
+
+        VkDescriptorPoolSize poolSize{};
+        poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        poolSize.descriptorCount = 1;
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.poolSizeCount = 1;
+        poolInfo.pPoolSizes = &poolSize;
+        poolInfo.maxSets = 1;
+
+        if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &cameraDescriptorPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create camera descriptor pool!");
+        }
+
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = cameraDescriptorPool;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts = &cameraDescriptorSetLayout;
+        if (vkAllocateDescriptorSets(device, &allocInfo, &cameraDescriptorSet) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate camera descriptor set!");
+        }
 
-        createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, voxelVertexBuffer, voxelVertexBufferMemory);
+        VkDescriptorBufferInfo bufferInfo{};
+        bufferInfo.buffer = cameraBuffer;
+        bufferInfo.offset = 0;
+        bufferInfo.range = sizeof(CameraUniform);
+
+        VkWriteDescriptorSet descriptorWrite{};
+        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrite.dstSet = cameraDescriptorSet;
+        descriptorWrite.dstBinding = 0;
+        descriptorWrite.dstArrayElement = 0;
+        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        descriptorWrite.descriptorCount = 1;
+        descriptorWrite.pBufferInfo = &bufferInfo;
+
+        vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+    }
 
-        copyBuffer(stagingBuffer, voxelVertexBuffer, bufferSize);
+    // Add a pool for raycast volumes' descriptor sets to the chain.
+    // These come and go as chunk groups cross the raycast threshold, so
+    // they're freeable. All sets have the same layout, so a pool with
+    // fewer than raycastPoolSets sets allocated always has room.
+    void createRaycastDescriptorPool() {
+        VkDescriptorPoolSize poolSize{};
+        poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        poolSize.descriptorCount = raycastPoolSets;
 
-        vkDestroyBuffer(device, stagingBuffer, nullptr);
-        vkFreeMemory(device, stagingBufferMemory, nullptr);
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+        poolInfo.poolSizeCount = 1;
+        poolInfo.pPoolSizes = &poolSize;
+        poolInfo.maxSets = raycastPoolSets;
+
+        RaycastDescriptorPool pool;
+        if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool.pool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create raycast descriptor pool!");
+        }
+        raycastDescriptorPools.push_back(pool);
     }
 
-    void createDescriptorPool() {
-        std::array<VkDescriptorPoolSize, 1> poolSizes{};
-        poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-        poolSizes[0].descriptorCount = static_cast<uint32_t>(perImage.size() * 2);
+    // Pool for the GPU culling descriptor sets. There's one at a time,
+    // but a new one is made whenever the Hi-Z resources are recreated
+    // (see createHiZResources) or the GPU culling buffers reallocated
+    // (see createGpuCullBuffers), and the old one is freed once retired
+    // with the swap chain or the buffers: besides the current one, up
+    // to two per frame in flight, and two more pending.
+    void createGpuCullDescriptorPool() {
+        if (!gpuCullingSupported) return;
+
+        const uint32_t maxSets = 2 * MAX_FRAMES_IN_FLIGHT + 3;
+        std::array<VkDescriptorPoolSize, 3> poolSizes{};
+        poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        poolSizes[0].descriptorCount = 3 * maxSets;
+        poolSizes[1].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        poolSizes[1].descriptorCount = maxSets;
+        poolSizes[2].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        poolSizes[2].descriptorCount = maxSets;
 
         VkDescriptorPoolCreateInfo poolInfo{};
         poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
         poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
         poolInfo.pPoolSizes = poolSizes.data();
-        poolInfo.maxSets = static_cast<uint32_t>(perImage.size() * 2);
+        poolInfo.maxSets = maxSets;
 
-        if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
-            throw std::runtime_error("failed to create descriptor pool!");
+        if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &gpuCullDescriptorPool) != VK_SUCCESS) {
+            throw std::runtime_error("failed to create GPU culling descriptor pool!");
         }
     }
 
@@ -1305,13 +4076,21 @@ class Renderer {
         }
     }
 
-    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
+    void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, MemoryAllocation& bufferMemory) {
         VkBufferCreateInfo bufferInfo{};
         bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
         bufferInfo.size = size;
         bufferInfo.usage = usage;
         bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
+        // Transfer batches may run on another queue family.
+        uint32_t queueFamilyIndices[] = {graphicsFamily, transferFamily};
+        if (transferFamily != graphicsFamily && (usage & (VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT))) {
+            bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+            bufferInfo.queueFamilyIndexCount = 2;
+            bufferInfo.pQueueFamilyIndices = queueFamilyIndices;
+        }
+
         if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
             throw std::runtime_error("failed to create buffer!");
         }
@@ -1319,98 +4098,131 @@ class Renderer {
         VkMemoryRequirements memRequirements;
         vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
 
-        VkMemoryAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocInfo.allocationSize = memRequirements.size;
-        allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+        bufferMemory = allocateMemory(memRequirements, properties, false);
+        vkBindBufferMemory(device, buffer, bufferMemory.memory, bufferMemory.offset);
+    }
 
-        if (vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate buffer memory!");
+    // Allocate memory meeting the given requirements from the pool of
+    // its memory type for buffers and linear images, or for optimal
+    // tiling images. Large requests get memory of their own.
+    MemoryAllocation allocateMemory(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool optimalImage) {
+        MemoryAllocation allocation;
+        allocation.size = requirements.size;
+        uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+
+        if (requirements.size > memoryBlockSize / 4) {
+            allocation.memory = allocateDeviceMemory(requirements.size, memoryType, optimalImage);
+            allocation.dedicated = true;
+            ++dedicatedAllocations;
+            dedicatedBytes += requirements.size;
+            return allocation;
         }
 
-        vkBindBufferMemory(device, buffer, bufferMemory, 0);
-    }
-
-    // Return a vector of [count]-many buffers, all sharing one VkDeviceMemory (created and returned through the VkDeviceMemory reference parameter).
-    // Also gives the stride between consecutive buffers through *outStride, if that pointer is provided.
-    std::vector<VkBuffer> createBuffers(size_t count, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkDeviceMemory& bufferMemory, VkDeviceSize* outStride=nullptr) {
-        assert(count > 0);
-        VkBufferCreateInfo bufferInfo{};
-        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
-        bufferInfo.size = size;
-        bufferInfo.usage = usage;
-        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        uint32_t p = 0;
+        while (p < memoryPools.size() && (memoryPools[p].memoryType != memoryType || memoryPools[p].optimalImages != optimalImage)) ++p;
+        if (p == memoryPools.size()) memoryPools.push_back(MemoryPool{ memoryType, optimalImage, {} });
+        MemoryPool& pool = memoryPools[p];
+        allocation.pool = p;
 
-        std::vector<VkBuffer> buffers(count);
-        for (VkBuffer& buffer : buffers) {
-            if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
-                throw std::runtime_error("failed to create buffer!");
+        for (MemoryBlock& block : pool.blocks) {
+            if (block.allocator->allocate(requirements.size, requirements.alignment, &allocation.offset)) {
+                allocation.memory = block.memory;
+                return allocation;
             }
         }
 
-        VkMemoryRequirements memRequirements;
-        vkGetBufferMemoryRequirements(device, buffers[0], &memRequirements);
-        if (outStride) *outStride = memRequirements.size;
+        MemoryBlock block;
+        block.memory = allocateDeviceMemory(memoryBlockSize, memoryType, optimalImage);
+        block.allocator = std::make_unique<BuddyAllocator>(memoryBlockSize, memoryMinAllocation);
+        bool allocated = block.allocator->allocate(requirements.size, requirements.alignment, &allocation.offset);
+        assert(allocated);
+        (void)allocated;
+        allocation.memory = block.memory;
+        pool.blocks.push_back(std::move(block));
+        return allocation;
+    }
 
+    // The one place that calls vkAllocateMemory. Buffers may need their
+    // device address (see createVoxelVertexBuffer), so with
+    // gpuCullingSupported all buffer memory allows for one.
+    VkDeviceMemory allocateDeviceMemory(VkDeviceSize size, uint32_t memoryType, bool optimalImage) {
         VkMemoryAllocateInfo allocInfo{};
         allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-        allocInfo.allocationSize = memRequirements.size * count;
-        assert(allocInfo.allocationSize / count == memRequirements.size);
-        allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+        allocInfo.allocationSize = size;
+        allocInfo.memoryTypeIndex = memoryType;
 
-        if (vkAllocateMemory(device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-            throw std::runtime_error("failed to allocate buffer memory!");
-        }
+        VkMemoryAllocateFlagsInfo allocFlagsInfo{};
+        allocFlagsInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO;
+        allocFlagsInfo.flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT;
+        if (gpuCullingSupported && !optimalImage) allocInfo.pNext = &allocFlagsInfo;
 
-        VkDeviceSize offset = 0;
-        for (VkBuffer& buffer : buffers) {
-            vkBindBufferMemory(device, buffer, bufferMemory, offset);
-            offset += memRequirements.size;
+        VkDeviceMemory memory;
+        if (vkAllocateMemory(device, &allocInfo, nullptr, &memory) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate device memory!");
         }
-        return buffers;
+        return memory;
     }
 
-    VkCommandBuffer beginSingleTimeCommands() {
-        VkCommandBufferAllocateInfo allocInfo{};
-        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
-        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-        allocInfo.commandPool = commandPool;
-        allocInfo.commandBufferCount = 1;
-
-        VkCommandBuffer commandBuffer;
-        vkAllocateCommandBuffers(device, &allocInfo, &commandBuffer);
-
-        VkCommandBufferBeginInfo beginInfo{};
-        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-
-        vkBeginCommandBuffer(commandBuffer, &beginInfo);
-
-        return commandBuffer;
+    // Free the allocation (if any) and reset it. The resources bound to
+    // it must already be destroyed. A block left empty is freed, unless
+    // it is the last of its pool.
+    void freeMemory(MemoryAllocation& allocation) {
+        if (allocation.memory == VK_NULL_HANDLE) return;
+        if (allocation.dedicated) {
+            vkFreeMemory(device, allocation.memory, nullptr);
+            --dedicatedAllocations;
+            dedicatedBytes -= allocation.size;
+        }
+        else {
+            std::vector<MemoryBlock>& blocks = memoryPools[allocation.pool].blocks;
+            auto it = std::find_if(blocks.begin(), blocks.end(),
+                [&allocation] (const MemoryBlock& block) { return block.memory == allocation.memory; });
+            assert(it != blocks.end());
+            it->allocator->free(allocation.offset);
+            if (it->allocator->empty() && blocks.size() > 1) {
+                vkFreeMemory(device, it->memory, nullptr);
+                blocks.erase(it);
+            }
+        }
+        allocation = MemoryAllocation{};
     }
 
-    void endSingleTimeCommands(VkCommandBuffer commandBuffer) {
-        vkEndCommandBuffer(commandBuffer);
-
-        VkSubmitInfo submitInfo{};
-        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &commandBuffer;
-
-        vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-        vkQueueWaitIdle(graphicsQueue);
-
-        vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
+    // Free the blocks of all pools, at cleanup.
+    void destroyMemoryPools() {
+        for (MemoryPool& pool : memoryPools) {
+            for (MemoryBlock& block : pool.blocks) {
+                vkFreeMemory(device, block.memory, nullptr);
+            }
+        }
+        memoryPools.clear();
     }
 
-    void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
-        VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+    MemoryStats getMemoryStats() const {
+        MemoryStats stats;
+        uint64_t largestFreeBytes = 0;
+        for (const MemoryPool& pool : memoryPools) {
+            for (const MemoryBlock& block : pool.blocks) {
+                ++stats.blocks;
+                stats.blockBytes += block.allocator->get_size();
+                stats.suballocations += block.allocator->allocation_count();
+                stats.usedBytes += block.allocator->get_used_bytes();
+                stats.requestedBytes += block.allocator->get_requested_bytes();
+                largestFreeBytes += block.allocator->largest_free();
+            }
+        }
+        stats.dedicatedAllocations = dedicatedAllocations;
+        stats.dedicatedBytes = dedicatedBytes;
+        uint64_t freeBytes = stats.blockBytes - stats.usedBytes;
+        stats.fragmentation = freeBytes == 0 ? 0.0 : 1.0 - double(largestFreeBytes) / double(freeBytes);
+        return stats;
+    }
 
+    void copyBuffer(VkBuffer srcBuffer, VkDeviceSize srcOffset, VkBuffer dstBuffer, VkDeviceSize dstOffset, VkDeviceSize size) {
         VkBufferCopy copyRegion{};
+        copyRegion.srcOffset = srcOffset;
+        copyRegion.dstOffset = dstOffset;
         copyRegion.size = size;
-        vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-
-        endSingleTimeCommands(commandBuffer);
+        vkCmdCopyBuffer(transferCommandBuffer(), srcBuffer, dstBuffer, 1, &copyRegion);
     }
 
     uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
@@ -1440,6 +4252,138 @@ class Renderer {
         }
     }
 
+    void createFrameCommandBuffers() {
+        QueueFamilyIndices queueFamilyIndices = findQueueFamilies(physicalDevice);
+
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        poolInfo.queueFamilyIndex = queueFamilyIndices.graphicsFamily.value();
+
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        allocInfo.commandBufferCount = 1;
+
+        for (PerFrame& pf : perFrame) {
+            if (vkCreateCommandPool(device, &poolInfo, nullptr, &pf.commandPool) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create frame command pool!");
+            }
+            allocInfo.commandPool = pf.commandPool;
+            if (vkAllocateCommandBuffers(device, &allocInfo, &pf.frameCommands) != VK_SUCCESS) {
+                throw std::runtime_error("failed to allocate command buffers!");
+            }
+        }
+    }
+
+    void createQueryPools() {
+        if (!timestampsSupported) return;
+
+        VkQueryPoolCreateInfo queryPoolInfo{};
+        queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        queryPoolInfo.queryCount = timestampCount;
+
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        allocInfo.commandBufferCount = 1;
+
+        for (PerFrame& pf : perFrame) {
+            if (vkCreateQueryPool(device, &queryPoolInfo, nullptr, &pf.queryPool) != VK_SUCCESS) {
+                throw std::runtime_error("failed to create query pool!");
+            }
+            allocInfo.commandPool = pf.commandPool;
+            if (vkAllocateCommandBuffers(device, &allocInfo, &pf.voxelEndCommands) != VK_SUCCESS ||
+                vkAllocateCommandBuffers(device, &allocInfo, &pf.raycastEndCommands) != VK_SUCCESS) {
+                throw std::runtime_error("failed to allocate command buffers!");
+            }
+        }
+    }
+
+    void writeTimestamp(VkCommandBuffer commandBuffer, PerFrame& pf, GpuTimestamp timestamp) {
+        if (!timestampsSupported) return;
+        vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, pf.queryPool, timestamp);
+    }
+
+    // Record the secondary command buffers writing the timestamps
+    // between the group draws.
+    void recordTimestampCommands(PerImage& pi, PerFrame& pf) {
+        if (!timestampsSupported) return;
+
+        VkCommandBufferInheritanceInfo inheritanceInfo{};
+        inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+        inheritanceInfo.renderPass = renderPass;
+        inheritanceInfo.subpass = 0;
+        inheritanceInfo.framebuffer = pi.framebuffer;
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+        beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+        std::pair<VkCommandBuffer, GpuTimestamp> markers[] = {
+            { pf.voxelEndCommands, timestampVoxelEnd },
+            { pf.raycastEndCommands, timestampRaycastEnd },
+        };
+        for (auto& marker : markers) {
+            if (vkBeginCommandBuffer(marker.first, &beginInfo) != VK_SUCCESS) {
+                throw std::runtime_error("failed to begin recording command buffer!");
+            }
+            writeTimestamp(marker.first, pf, marker.second);
+            if (vkEndCommandBuffer(marker.first) != VK_SUCCESS) {
+                throw std::runtime_error("failed to record command buffer!");
+            }
+        }
+    }
+
+    // Add the times of the frame's timestamps, if written since last
+    // read, to gpuTimeSamples. Only once the frame's fence is waited on,
+    // so that the results are available.
+    void readGpuTimestamps(PerFrame& pf) {
+        if (!timestampsSupported || !pf.timestampsWritten) return;
+        pf.timestampsWritten = false;
+
+        uint64_t ticks[timestampCount];
+        VkResult result = vkGetQueryPoolResults(device, pf.queryPool, 0, timestampCount, sizeof(ticks), ticks, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+        if (result != VK_SUCCESS) return;
+
+        auto ms = [this, &ticks] (GpuTimestamp begin, GpuTimestamp end) {
+            return double((ticks[end] - ticks[begin]) & timestampMask) * timestampPeriod * 1e-6;
+        };
+        GpuTimeStats sample;
+        sample.frameMs = ms(timestampFrameBegin, timestampFrameEnd);
+        sample.computeMs = ms(timestampComputeBegin, timestampComputeEnd);
+        sample.quadsMs = ms(timestampQuadsBegin, timestampQuadsEnd);
+        sample.voxelMs = ms(timestampQuadsEnd, timestampVoxelEnd);
+        sample.raycastMs = ms(timestampVoxelEnd, timestampRaycastEnd);
+        sample.frames = 1;
+
+        if (gpuTimeSamples.size() < gpuTimeSampleCount) gpuTimeSamples.push_back(sample);
+        else gpuTimeSamples[gpuTimeSampleIndex] = sample;
+        gpuTimeSampleIndex = (gpuTimeSampleIndex + 1) % gpuTimeSampleCount;
+    }
+
+    GpuTimeStats getGpuTimeStats() const {
+        GpuTimeStats stats;
+        for (const GpuTimeStats& sample : gpuTimeSamples) {
+            stats.frameMs += sample.frameMs;
+            stats.computeMs += sample.computeMs;
+            stats.quadsMs += sample.quadsMs;
+            stats.voxelMs += sample.voxelMs;
+            stats.raycastMs += sample.raycastMs;
+            stats.frames += sample.frames;
+        }
+        if (stats.frames != 0) {
+            stats.frameMs /= stats.frames;
+            stats.computeMs /= stats.frames;
+            stats.quadsMs /= stats.frames;
+            stats.voxelMs /= stats.frames;
+            stats.raycastMs /= stats.frames;
+        }
+        return stats;
+    }
+
     glm::mat4 getMVP() {
         static auto startTime = std::chrono::high_resolution_clock::now();
 
@@ -1455,7 +4399,260 @@ class Renderer {
         return proj * view * model;
     }
 
-    void recordOneTimeFrameCommandBuffer(PerImage& pi) {
+    // Set the (dynamic) viewport and scissor to the whole swap chain
+    // image. Secondary command buffers don't inherit them, so each sets
+    // its own.
+    void recordViewport(VkCommandBuffer commandBuffer) {
+        VkViewport viewport{};
+        viewport.width = (float) swapChainExtent.width;
+        viewport.height = (float) swapChainExtent.height;
+        viewport.minDepth = 0.0f;
+        viewport.maxDepth = 1.0f;
+        vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+        VkRect2D scissor{};
+        scissor.offset = {0, 0};
+        scissor.extent = swapChainExtent;
+        vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+    }
+
+    // Update the camera uniform for this frame (outside the render
+    // pass), after the previous frame's shaders are done reading it.
+    void recordCameraUpdate(VkCommandBuffer commandBuffer, const glm::mat4& viewProjection) {
+        CameraUniform uniform;
+        uniform.viewProjection = viewProjection;
+        splitEye(camera.get_eye(), &uniform.eyeGroup, &uniform.eyeResidue);
+
+        VkMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+        vkCmdUpdateBuffer(commandBuffer, cameraBuffer, 0, sizeof(CameraUniform), &uniform);
+
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_UNIFORM_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+    }
+
+    // Record the group's draw command buffer anew, with the given
+    // pipeline and instance (or index) count, from the worker's pool;
+    // the one it replaces goes to the range's retired draws. It depends
+    // only on the group's buffers and the swap chain (the camera is in
+    // the uniform), so it is reused until one of them changes.
+    void recordGroupDraw(GroupBuffer& gb, VkPipeline pipeline, uint32_t count, int worker, DrawRange& range) {
+        if (gb.drawCommands != VK_NULL_HANDLE) {
+            RetiredBuffer retired;
+            retired.drawCommands = gb.drawCommands;
+            retired.drawPool = gb.drawPool;
+            range.retired.push_back(retired);
+        }
+
+        VkCommandBufferAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        allocInfo.commandPool = drawCommandPools[worker];
+        allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+        allocInfo.commandBufferCount = 1;
+        if (vkAllocateCommandBuffers(device, &allocInfo, &gb.drawCommands) != VK_SUCCESS) {
+            throw std::runtime_error("failed to allocate command buffers!");
+        }
+        gb.drawPool = worker;
+
+        // Any framebuffer of the render pass; several frames in flight
+        // may execute it at once.
+        VkCommandBufferInheritanceInfo inheritanceInfo{};
+        inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+        inheritanceInfo.renderPass = renderPass;
+        inheritanceInfo.subpass = 0;
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+        beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+        VkCommandBuffer commandBuffer = gb.drawCommands;
+        if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+            throw std::runtime_error("failed to begin recording command buffer!");
+        }
+        recordViewport(commandBuffer);
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+
+        glm::ivec4 group(gb.coord.x, gb.coord.y, gb.coord.z, gb.lodLevel);
+        VkDeviceSize offsets[] = {0};
+        if (pipeline == raycastPipeline) {
+            // Just the volume's bounding box.
+            VkDescriptorSet descriptorSets[] = {cameraDescriptorSet, gb.volumeDescriptorSet};
+            RaycastPushConstant pushConstant { group, gb.volumeBoxMin, gb.volumeBoxMax };
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, raycastPipelineLayout, 0, 2, descriptorSets, 0, nullptr);
+            vkCmdPushConstants(commandBuffer, raycastPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(RaycastPushConstant), &pushConstant);
+            vkCmdDraw(commandBuffer, 36, 1, 0, 0);
+        }
+        else {
+            GroupPushConstant pushConstant { group };
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, voxelPipelineLayout, 0, 1, &cameraDescriptorSet, 0, nullptr);
+            vkCmdPushConstants(commandBuffer, voxelPipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(GroupPushConstant), &pushConstant);
+            if (pipeline == greedyPipeline) {
+                vkCmdBindVertexBuffers(commandBuffer, 0, 1, &gb.meshVertexBuffer, offsets);
+                vkCmdBindIndexBuffer(commandBuffer, gb.meshIndexBuffer, 0, VK_INDEX_TYPE_UINT32);
+                vkCmdDrawIndexed(commandBuffer, count, 1, 0, 0, 0);
+            }
+            else {
+                // Box records draw 36 vertices each (hidden faces
+                // degenerate); face records draw 6, so hidden faces
+                // cost nothing.
+                uint32_t vertexCount = static_cast<uint32_t>(myricube::vertices_per_record(voxelLayout));
+                vkCmdBindVertexBuffers(commandBuffer, 0, 1, &gb.buffer, offsets);
+                vkCmdDraw(commandBuffer, vertexCount, count, 0, 0);
+            }
+        }
+
+        if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("failed to record command buffer!");
+        }
+        gb.drawPipeline = pipeline;
+        gb.drawCount = count;
+        ++range.recordedGroups;
+    }
+
+    // Add the jobs gathering the draws of the visible groups, one per
+    // range of drawRangeSize groups, recording those that are missing
+    // or out of date (see gatherGroupDraws). With GPU culling the
+    // instanced groups are drawn indirectly instead.
+    void addGroupDrawJobs(bool gpuDriven) {
+        size_t rangeCount = (visibleGroups.size() + drawRangeSize - 1) / drawRangeSize;
+        drawRanges.resize(rangeCount);
+
+        frameJobs.add_range("record draws", visibleGroups.size(), drawRangeSize, [this, gpuDriven] (size_t begin, size_t end, int worker) {
+            DrawRange& range = drawRanges[begin / drawRangeSize];
+            for (auto& commands : range.commands) commands.clear();
+            range.retired.clear();
+            range.vertexCount = 0;
+            range.recordedGroups = 0;
+
+            VkPipeline instancePipeline = voxelLayout == VoxelLayout::box ? voxelPipeline : faceVoxelPipeline;
+            uint32_t vertexCount = static_cast<uint32_t>(myricube::vertices_per_record(voxelLayout));
+            for (size_t v = begin; v < end; ++v) {
+                GroupBuffer& gb = *cullGroups[visibleGroups[v]];
+                VkPipeline pipeline;
+                uint32_t count;
+                int order;
+                if (gb.raycast) {
+                    if (gb.volumeDescriptorSet == VK_NULL_HANDLE) continue;
+                    pipeline = raycastPipeline;
+                    count = 36;
+                    order = 2;
+                }
+                else if (gb.greedy) {
+                    if (gb.meshIndexCount == 0) continue;
+                    pipeline = greedyPipeline;
+                    count = gb.meshIndexCount;
+                    order = 1;
+                }
+                else {
+                    if (gpuDriven || gb.instances.size() == 0) continue;
+                    pipeline = instancePipeline;
+                    count = static_cast<uint32_t>(gb.instances.size());
+                    order = 0;
+                }
+
+                // Counting indices as vertices.
+                range.vertexCount += order == 0 ? uint64_t(vertexCount) * count : count;
+                if (gb.drawCommands == VK_NULL_HANDLE || gb.drawPipeline != pipeline || gb.drawCount != count) {
+                    recordGroupDraw(gb, pipeline, count, worker, range);
+                }
+                range.commands[order].push_back(gb.drawCommands);
+            }
+        });
+    }
+
+    // Once the jobs of addGroupDrawJobs ran: concatenate the ranges'
+    // draws into groupDrawCommands, retire the draws they replaced,
+    // and add up their statistics.
+    void gatherGroupDraws() {
+        groupDrawCommands.clear();
+        drawStats.recordedGroups = 0;
+        for (int order = 0; order < 3; ++order) {
+            if (order == 2) raycastDrawBegin = groupDrawCommands.size();
+            for (const DrawRange& range : drawRanges) {
+                groupDrawCommands.insert(groupDrawCommands.end(), range.commands[order].begin(), range.commands[order].end());
+            }
+        }
+        for (const DrawRange& range : drawRanges) {
+            retiredBuffers.insert(retiredBuffers.end(), range.retired.begin(), range.retired.end());
+            voxelVertexCount += range.vertexCount;
+            drawStats.recordedGroups += range.recordedGroups;
+        }
+        drawStats.drawnGroups = groupDrawCommands.size();
+    }
+
+    // Record the frame's secondary command buffer (the draws that aren't
+    // per group), and return the vertex count of its voxel draws.
+    uint64_t recordFrameCommands(PerImage& pi, PerFrame& pf, bool gpuDriven, const glm::vec4& color) {
+        VkCommandBufferInheritanceInfo inheritanceInfo{};
+        inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+        inheritanceInfo.renderPass = renderPass;
+        inheritanceInfo.subpass = 0;
+        inheritanceInfo.framebuffer = pi.framebuffer;
+
+        VkCommandBufferBeginInfo frameBeginInfo{};
+        frameBeginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        frameBeginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+        frameBeginInfo.pInheritanceInfo = &inheritanceInfo;
+
+        VkCommandBuffer frameCommands = pf.frameCommands;
+        if (vkBeginCommandBuffer(frameCommands, &frameBeginInfo) != VK_SUCCESS) {
+            throw std::runtime_error("failed to begin recording command buffer!");
+        }
+        recordViewport(frameCommands);
+        writeTimestamp(frameCommands, pf, timestampQuadsBegin);
+
+        // Tutorial textured stuff.
+        vkCmdBindPipeline(frameCommands, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
+
+        VkBuffer vertexBuffers[] = {vertexBuffer};
+        VkDeviceSize offsets[] = {0};
+        vkCmdBindVertexBuffers(frameCommands, 0, 1, vertexBuffers, offsets);
+
+        vkCmdBindIndexBuffer(frameCommands, indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+
+        PushConstant pushConstant { getMVP(), color };
+        vkCmdBindDescriptorSets(frameCommands, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &pi.faceDescriptorSet, 0, nullptr);
+        vkCmdPushConstants(frameCommands, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushConstant), &pushConstant);
+        vkCmdDrawIndexed(frameCommands, static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+
+        auto model = glm::translate(glm::mat4(1), glm::vec3(0, 0, 2));
+        auto view = camera.get_view();
+        auto proj = camera.get_projection();
+        proj[1][1] *= -1;
+
+        vkCmdBindDescriptorSets(frameCommands, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &pi.endivesDescriptorSet, 0, nullptr);
+        pushConstant = PushConstant { proj * view * model, glm::vec4(1, 1, 1, 1) };
+        vkCmdPushConstants(frameCommands, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushConstant), &pushConstant);
+        vkCmdDrawIndexed(frameCommands, static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+        writeTimestamp(frameCommands, pf, timestampQuadsEnd);
+
+        uint64_t indirectVertexCount = 0;
+        if (gpuDriven) {
+            // One draw for all visible face layout groups. The vertex
+            // count is as the CPU culling sees it.
+            vkCmdBindPipeline(frameCommands, VK_PIPELINE_BIND_POINT_GRAPHICS, indirectFacePipeline);
+            VkDescriptorSet descriptorSets[] = {cameraDescriptorSet, gpuCullDescriptorSet};
+            vkCmdBindDescriptorSets(frameCommands, VK_PIPELINE_BIND_POINT_GRAPHICS, indirectFacePipelineLayout, 0, 2, descriptorSets, 0, nullptr);
+            vkCmdDrawIndirectCount(frameCommands, gpuDrawBuffer, 0, gpuCountBuffer, 0, static_cast<uint32_t>(gpuRecords.size()), sizeof(GpuDraw));
+            uint32_t vertexCount = static_cast<uint32_t>(myricube::vertices_per_record(voxelLayout));
+            for (uint32_t i : visibleGroups) {
+                indirectVertexCount += uint64_t(vertexCount) * cullGroups[i]->instances.size();
+            }
+        }
+
+        if (vkEndCommandBuffer(frameCommands) != VK_SUCCESS) {
+            throw std::runtime_error("failed to record command buffer!");
+        }
+        return indirectVertexCount;
+    }
+
+    void recordOneTimeFrameCommandBuffer(PerImage& pi, PerFrame& pf) {
         static auto startTime = std::chrono::high_resolution_clock::now();
 
         auto currentTime = std::chrono::high_resolution_clock::now();
@@ -1474,6 +4671,8 @@ class Renderer {
         if (vkBeginCommandBuffer(pi.commandBuffer, &beginInfo) != VK_SUCCESS) {
             throw std::runtime_error("failed to begin recording command buffer!");
         }
+        if (timestampsSupported) vkCmdResetQueryPool(pi.commandBuffer, pf.queryPool, 0, timestampCount);
+        writeTimestamp(pi.commandBuffer, pf, timestampFrameBegin);
 
         VkRenderPassBeginInfo renderPassInfo{};
         renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
@@ -1489,39 +4688,72 @@ class Renderer {
         renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
         renderPassInfo.pClearValues = clearValues.data();
 
-        vkCmdBeginRenderPass(pi.commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-            // Tutorial textured stuff.
-            vkCmdBindPipeline(pi.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipeline);
-
-            VkBuffer vertexBuffers[] = {vertexBuffer};
-            VkDeviceSize offsets[] = {0};
-            vkCmdBindVertexBuffers(pi.commandBuffer, 0, 1, vertexBuffers, offsets);
-
-            vkCmdBindIndexBuffer(pi.commandBuffer, indexBuffer, 0, VK_INDEX_TYPE_UINT16);
-
-            PushConstant pushConstant { getMVP(), color };
-            vkCmdBindDescriptorSets(pi.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &pi.faceDescriptorSet, 0, nullptr);
-            vkCmdPushConstants(pi.commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushConstant), &pushConstant);
-            vkCmdDrawIndexed(pi.commandBuffer, static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
-
-            auto model = glm::translate(glm::mat4(1), glm::vec3(0, 0, 2));
-            auto view = camera.get_view();
-            auto proj = camera.get_projection();
-            proj[1][1] *= -1;
-
-            vkCmdBindDescriptorSets(pi.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1, &pi.endivesDescriptorSet, 0, nullptr);
-            pushConstant = PushConstant { proj * view * model, glm::vec4(1, 1, 1, 1) };
-            vkCmdPushConstants(pi.commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushConstant), &pushConstant);
-            vkCmdDrawIndexed(pi.commandBuffer, static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
+        jobStats.clear();
+        streamChunkGroups();
+        updateRaycastGroups();
+        updateGroupLods();
+        recordVoxelPatches(pi.commandBuffer);
+        lodStats.updatedChunks = lodUpdatedChunks.exchange(0);
+        streamStats.uploadBytes = frameUploadBytes;
+        streamStats.stagingStalls = stagingStalls;
+        frameUploadBytes = 0;
+        stagingStalls = 0;
+
+        // Culled groups record no draws below.
+        rebaseCullBoxes();
+        CullFrustum frustum = myricube::make_cull_frustum(camera.get_projection(), camera.get_view(), camera.get_eye(), float(camera.get_far_plane()));
+        cullVisibleGroups(frustum);
+
+        // Face layout groups are culled again on the GPU and drawn
+        // indirectly; the CPU culling above (including occlusion) still
+        // serves the greedy and raycast groups, and the statistics.
+        bool gpuDriven = gpuCulling && voxelLayout == VoxelLayout::face && !gpuRecords.empty();
+        writeTimestamp(pi.commandBuffer, pf, timestampComputeBegin);
+        if (gpuDriven) recordGpuCulling(pi.commandBuffer, frustum);
+        writeTimestamp(pi.commandBuffer, pf, timestampComputeEnd);
+
+        // Eye-relative view-projection, for the camera uniform (and the
+        // next frame's Hi-Z pyramid).
+        auto view = camera.get_view();
+        auto proj = camera.get_projection();
+        proj[1][1] *= -1;
+        glm::mat4 rotation = view;
+        rotation[3] = glm::vec4(0, 0, 0, 1);
+        recordCameraUpdate(pi.commandBuffer, proj * rotation);
+
+        // The frame's own draws go in its secondary command buffer,
+        // recorded by a job while the others gather (and record) the
+        // groups' draws in theirs.
+        uint64_t frameVertexCount = 0;
+        frameJobs.add("record frame", [&] (int) {
+            frameVertexCount = recordFrameCommands(pi, pf, gpuDriven, color);
+        });
+        addGroupDrawJobs(gpuDriven);
+        runJobs();
+        voxelVertexCount = frameVertexCount;
+        gatherGroupDraws();
+        recordTimestampCommands(pi, pf);
+
+        // The frame's draws, the voxel groups', then the raycast groups'.
+        vkCmdBeginRenderPass(pi.commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+        vkCmdExecuteCommands(pi.commandBuffer, 1, &pf.frameCommands);
+        if (raycastDrawBegin != 0) {
+            vkCmdExecuteCommands(pi.commandBuffer, static_cast<uint32_t>(raycastDrawBegin), groupDrawCommands.data());
+        }
+        if (timestampsSupported) vkCmdExecuteCommands(pi.commandBuffer, 1, &pf.voxelEndCommands);
+        if (groupDrawCommands.size() != raycastDrawBegin) {
+            vkCmdExecuteCommands(pi.commandBuffer, static_cast<uint32_t>(groupDrawCommands.size() - raycastDrawBegin), groupDrawCommands.data() + raycastDrawBegin);
+        }
+        if (timestampsSupported) vkCmdExecuteCommands(pi.commandBuffer, 1, &pf.raycastEndCommands);
+        vkCmdEndRenderPass(pi.commandBuffer);
 
-            // Voxel test
-            vkCmdBindPipeline(pi.commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, voxelPipeline);
-            vertexBuffers[0] = voxelVertexBuffer;
-            vkCmdBindVertexBuffers(pi.commandBuffer, 0, 1, vertexBuffers, offsets);
-            vkCmdPushConstants(pi.commandBuffer, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(PushConstant), &pushConstant);
-            vkCmdDraw(pi.commandBuffer, 36, voxels.size(), 0, 0);
+        // The next frame's Hi-Z pyramid is built from this frame's depth.
+        hiZViewProjection = proj * rotation;
+        hiZEye = camera.get_eye();
+        hiZDepthValid = true;
 
-        vkCmdEndRenderPass(pi.commandBuffer);
+        writeTimestamp(pi.commandBuffer, pf, timestampFrameEnd);
+        pf.timestampsWritten = timestampsSupported;
 
         if (vkEndCommandBuffer(pi.commandBuffer) != VK_SUCCESS) {
             throw std::runtime_error("failed to record command buffer!");
@@ -1550,6 +4782,16 @@ class Renderer {
     void drawFrame() {
         PerFrame& pf = perFrame.at(currentFrame);
         vkWaitForFences(device, 1, &pf.inFlightFence, VK_TRUE, UINT64_MAX);
+        readGpuTimestamps(pf);
+        destroyRetiredBuffers(pf.retiredBuffers);
+        destroyRetiredSwapChains(pf.retiredSwapChains);
+        pollTransfers();
+        vkResetCommandPool(device, pf.commandPool, 0);
+
+        if (presentModeChanged) {
+            presentModeChanged = false;
+            recreateSwapChain();
+        }
 
         uint32_t imageIndex;
         VkResult result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX, pf.imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
@@ -1567,16 +4809,27 @@ class Renderer {
         }
         imageFenceRef = pf.inFlightFence;
 
+        // The frame's uploads go first; it waits for them (and all
+        // earlier ones) to be done.
+        recordOneTimeFrameCommandBuffer(perImage[imageIndex], pf);
+        flushTransfers();
+
         VkSubmitInfo submitInfo{};
         submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-        VkSemaphore waitSemaphores[] = {pf.imageAvailableSemaphore};
-        VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-        submitInfo.waitSemaphoreCount = 1;
+        VkSemaphore waitSemaphores[] = {pf.imageAvailableSemaphore, transferTimeline};
+        VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT};
+        uint64_t waitValues[] = {0, transferValue};
+        submitInfo.waitSemaphoreCount = timelineSupported ? 2 : 1;
         submitInfo.pWaitSemaphores = waitSemaphores;
         submitInfo.pWaitDstStageMask = waitStages;
 
-        recordOneTimeFrameCommandBuffer(perImage[imageIndex]);
+        VkTimelineSemaphoreSubmitInfo timelineInfo{};
+        timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+        timelineInfo.waitSemaphoreValueCount = 2;
+        timelineInfo.pWaitSemaphoreValues = waitValues;
+        if (timelineSupported) submitInfo.pNext = &timelineInfo;
+
         submitInfo.commandBufferCount = 1;
         submitInfo.pCommandBuffers = &perImage[imageIndex].commandBuffer;
 
@@ -1586,9 +4839,13 @@ class Renderer {
 
         vkResetFences(device, 1, &pf.inFlightFence);
 
+        // The buffers and swap chains retired until now are done with
+        // once this is.
         if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, pf.inFlightFence) != VK_SUCCESS) {
             throw std::runtime_error("failed to submit draw command buffer!");
         }
+        pf.retiredBuffers.swap(retiredBuffers);
+        pf.retiredSwapChains.swap(retiredSwapChains);
 
         VkPresentInfoKHR presentInfo{};
         presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -1638,8 +4895,14 @@ class Renderer {
     }
 
     VkPresentModeKHR chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes) {
+        VkPresentModeKHR requested = VK_PRESENT_MODE_FIFO_KHR;
+        switch (presentMode) {
+            case PresentMode::fifo: requested = VK_PRESENT_MODE_FIFO_KHR; break;
+            case PresentMode::mailbox: requested = VK_PRESENT_MODE_MAILBOX_KHR; break;
+            case PresentMode::immediate: requested = VK_PRESENT_MODE_IMMEDIATE_KHR; break;
+        }
         for (const auto& availablePresentMode : availablePresentModes) {
-            if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR) {
+            if (availablePresentMode == requested) {
                 return availablePresentMode;
             }
         }
@@ -1752,6 +5015,16 @@ class Renderer {
             i++;
         }
 
+        // Prefer a pure transfer family to one that can also compute.
+        // Texture copies need a granularity of single texels.
+        for (uint32_t j = 0; j < queueFamilyCount; ++j) {
+            VkQueueFlags flags = queueFamilies[j].queueFlags;
+            VkExtent3D granularity = queueFamilies[j].minImageTransferGranularity;
+            if (!(flags & VK_QUEUE_TRANSFER_BIT) || (flags & VK_QUEUE_GRAPHICS_BIT)) continue;
+            if (granularity.width != 1 || granularity.height != 1 || granularity.depth != 1) continue;
+            if (!indices.transferFamily.has_value() || !(flags & VK_QUEUE_COMPUTE_BIT)) indices.transferFamily = j;
+        }
+
         return indices;
     }
 
@@ -1819,9 +5092,9 @@ class Renderer {
     }
 };
 
-Renderer* new_renderer(Window& w)
+Renderer* new_renderer(Window& w, VoxelWorld& world)
 {
-    return new Renderer(w);
+    return new Renderer(w, world);
 }
 
 void delete_renderer(Renderer* renderer)
@@ -1829,6 +5102,109 @@ void delete_renderer(Renderer* renderer)
     delete renderer;
 }
 
+void set_voxel(Renderer* renderer, int32_t x, int32_t y, int32_t z, Voxel v)
+{
+    renderer->setVoxel(x, y, z, v);
+}
+
+void set_voxel_layout(Renderer* renderer, VoxelLayout layout)
+{
+    renderer->setVoxelLayout(layout);
+}
+
+VoxelLayout get_voxel_layout(const Renderer* renderer)
+{
+    return renderer->voxelLayout;
+}
+
+void set_present_mode(Renderer* renderer, PresentMode mode)
+{
+    if (mode == renderer->presentMode) return;
+    renderer->presentMode = mode;
+    renderer->presentModeChanged = true;
+}
+
+PresentMode get_present_mode(const Renderer* renderer)
+{
+    return renderer->presentMode;
+}
+
+uint64_t get_voxel_vertex_count(const Renderer* renderer)
+{
+    return renderer->voxelVertexCount;
+}
+
+void set_group_greedy(Renderer* renderer, GroupCoord coord, bool greedy)
+{
+    renderer->setGroupGreedy(coord, greedy);
+}
+
+StreamStats get_stream_stats(const Renderer* renderer)
+{
+    return renderer->streamStats;
+}
+
+std::vector<JobStats> get_job_stats(const Renderer* renderer)
+{
+    return renderer->jobStats;
+}
+
+int get_job_threads(const Renderer* renderer)
+{
+    return renderer->jobSystem.thread_count();
+}
+
+LodStats get_lod_stats(const Renderer* renderer)
+{
+    return renderer->lodStats;
+}
+
+MemoryStats get_memory_stats(const Renderer* renderer)
+{
+    return renderer->getMemoryStats();
+}
+
+CullStats get_cull_stats(const Renderer* renderer)
+{
+    return renderer->cullStats;
+}
+
+DrawStats get_draw_stats(const Renderer* renderer)
+{
+    return renderer->drawStats;
+}
+
+GpuTimeStats get_gpu_time_stats(const Renderer* renderer)
+{
+    return renderer->getGpuTimeStats();
+}
+
+void set_gpu_culling(Renderer* renderer, bool enabled)
+{
+    renderer->gpuCulling = enabled && renderer->gpuCullingSupported;
+}
+
+bool get_gpu_culling(const Renderer* renderer)
+{
+    return renderer->gpuCulling;
+}
+
+void set_hiz_culling(Renderer* renderer, bool enabled)
+{
+    renderer->hiZCulling = enabled && renderer->hiZSupported;
+}
+
+bool get_hiz_culling(const Renderer* renderer)
+{
+    return renderer->hiZCulling;
+}
+
+bool get_group_greedy(const Renderer* renderer, GroupCoord coord)
+{
+    auto it = renderer->groupBuffers.find(coord);
+    return it != renderer->groupBuffers.end() && it->second.greedy;
+}
+
 void draw_frame(Renderer* renderer, const Camera& camera)
 {
     renderer->camera = camera;
@@ -1,9 +1,224 @@
+#include <vector>
+
 #include "camera.hh"
+#include "chunk.hh"
+#include "faces.hh"
+#include "lod.hh"
 #include "window.hh"
 
 class Renderer;
 
-Renderer* new_renderer(myricube::Window&);
+// Present modes of the swap chain (see set_present_mode).
+enum class PresentMode
+{
+    // Wait for the display's vertical blank: presentation paces the
+    // frames, at the refresh rate. Always supported.
+    fifo,
+
+    // Replace the image waiting for the vertical blank: no tearing,
+    // and frames aren't paced.
+    mailbox,
+
+    // Present at once, even mid-refresh (may tear).
+    immediate,
+};
+
+// Chunk group streaming statistics of the last frame drawn.
+struct StreamStats
+{
+    // Chunk groups in the world within the far plane still waiting to
+    // be uploaded.
+    size_t queueDepth = 0;
+
+    // Chunk groups uploaded (at most the camera's
+    // max_frame_new_chunk_groups).
+    int newGroups = 0;
+
+    // Chunk groups evicted from the GPU for being too far from the
+    // eye, the last time it moved to another chunk group.
+    int evictedGroups = 0;
+
+    // Bytes copied to GPU memory, including edits and rebuilds.
+    uint64_t uploadBytes = 0;
+
+    // Uploads that had to wait for the GPU to finish earlier transfers
+    // (to free up staging memory).
+    int stagingStalls = 0;
+};
+
+// Chunk group culling statistics of the last frame drawn.
+struct CullStats
+{
+    // Uploaded chunk groups that were drawn.
+    size_t visible = 0;
+
+    // Uploaded chunk groups outside the view frustum or beyond the far
+    // plane, which recorded no draw commands.
+    size_t culled = 0;
+
+    // Uploaded chunk groups inside the frustum but hidden behind the
+    // fully solid chunks of nearer groups (not counted in visible).
+    // With GPU culling, face layout groups are drawn even so (though
+    // the Hi-Z test may drop them, see set_hiz_culling).
+    size_t occluded = 0;
+};
+
+// Draw command statistics of the last frame drawn.
+struct DrawStats
+{
+    // Chunk groups drawn by their own secondary command buffer (all the
+    // visible ones, but for those drawn indirectly with GPU culling).
+    size_t drawnGroups = 0;
+
+    // Of those, the ones whose command buffer was recorded this frame
+    // (new, edited, or switched pipeline); the others were reused.
+    int recordedGroups = 0;
+};
+
+// GPU time of the parts of a frame, in milliseconds, averaged over the
+// last frames read back (see get_gpu_time_stats).
+struct GpuTimeStats
+{
+    // The whole frame, including uploads recorded with it.
+    double frameMs = 0;
+
+    // GPU culling and the Hi-Z pyramid (compute shaders).
+    double computeMs = 0;
+
+    // The tutorial textured quads.
+    double quadsMs = 0;
+
+    // Instanced and greedy meshed chunk groups, and the GPU culling
+    // path's indirect draw.
+    double voxelMs = 0;
+
+    // Raycast chunk groups.
+    double raycastMs = 0;
+
+    // Frames averaged; 0 if timestamps are unsupported.
+    int frames = 0;
+};
+
+// Level of detail statistics of the last frame drawn.
+struct LodStats
+{
+    // Uploaded chunk groups drawn at each level of detail (see lod.hh).
+    size_t groups[myricube::max_lod_level + 1] = {};
+
+    // Chunks of coarser levels regenerated, after edits or for groups
+    // switching level.
+    int updatedChunks = 0;
+};
+
+// Device memory statistics (see get_memory_stats).
+struct MemoryStats
+{
+    // Blocks of device memory that buffers and images are suballocated
+    // from, and their total size.
+    size_t blocks = 0;
+    uint64_t blockBytes = 0;
+
+    // Buffers and images in the blocks, the bytes they need, and the
+    // bytes set aside for them (rounded up to powers of two).
+    size_t suballocations = 0;
+    uint64_t requestedBytes = 0;
+    uint64_t usedBytes = 0;
+
+    // Buffers and images too large for the blocks, which have device
+    // memory of their own, and its total size.
+    size_t dedicatedAllocations = 0;
+    uint64_t dedicatedBytes = 0;
+
+    // Fraction of the blocks' free bytes outside the largest free range
+    // of their block: 0 when each block's free space is in one piece.
+    double fragmentation = 0;
+};
+
+// Time spent in one kind of job (see jobs.hh) in the last frame drawn.
+struct JobStats
+{
+    const char* name = "";
+
+    // Jobs run, and the sum and maximum of their times.
+    size_t count = 0;
+    double totalMs = 0;
+    double maxMs = 0;
+
+    // Time from the first of them starting to the last one ending (per
+    // job graph, summed); totalMs / wallMs is the parallel speedup.
+    double wallMs = 0;
+};
+
+Renderer* new_renderer(myricube::Window&, myricube::VoxelWorld&);
 void delete_renderer(Renderer*);
 void draw_frame(Renderer*, const myricube::Camera&);
 
+// Edit a voxel of the world passed to new_renderer. Only the edited
+// voxel's (and its neighbors') instances are re-uploaded.
+void set_voxel(Renderer*, int32_t x, int32_t y, int32_t z, myricube::Voxel);
+
+// Switch the instance layout used to draw voxels (regenerates all
+// instance buffers), and query it. Defaults to VoxelLayout::face.
+void set_voxel_layout(Renderer*, myricube::VoxelLayout);
+myricube::VoxelLayout get_voxel_layout(const Renderer*);
+
+// Switch the present mode (the swap chain is recreated on the next
+// frame; FIFO is used instead of unsupported modes), and query the
+// mode asked for. Defaults to PresentMode::fifo.
+void set_present_mode(Renderer*, PresentMode);
+PresentMode get_present_mode(const Renderer*);
+
+// Vertex shader invocations of the voxel draws in the last frame.
+uint64_t get_voxel_vertex_count(const Renderer*);
+
+// Draw the given chunk group from a greedy mesh (merged same-color
+// faces, see greedy.hh) instead of voxel instances, or switch it back.
+// Edits to greedy groups re-mesh the whole group, so this is meant for
+// near, mostly static groups.
+void set_group_greedy(Renderer*, myricube::GroupCoord, bool greedy);
+bool get_group_greedy(const Renderer*, myricube::GroupCoord);
+
+// Chunk groups are uploaded gradually, nearest first, at most
+// Camera::max_frame_new_chunk_groups per frame.
+StreamStats get_stream_stats(const Renderer*);
+CullStats get_cull_stats(const Renderer*);
+
+// Each chunk group's draw is recorded once into a command buffer of
+// its own and reused by the frames it is visible in, until it changes.
+// The visible groups' draws are gathered and recorded by jobs (see
+// get_job_stats), in ranges.
+DrawStats get_draw_stats(const Renderer*);
+
+// Each frame's commands write GPU timestamps around its parts, read
+// back a few frames later (never waiting for the GPU); their times
+// averaged over the last 60 frames.
+GpuTimeStats get_gpu_time_stats(const Renderer*);
+
+// Chunk groups are drawn at coarser levels of detail the farther they
+// are from the eye (see Camera::lod_distance).
+LodStats get_lod_stats(const Renderer*);
+
+// Device memory is allocated in large blocks, shared by many buffers
+// and images; the current usage.
+MemoryStats get_memory_stats(const Renderer*);
+
+// Loading, meshing and culling of chunk groups run as jobs on all
+// cores; the statistics of the last frame's jobs, and the number of
+// threads running them.
+std::vector<JobStats> get_job_stats(const Renderer*);
+int get_job_threads(const Renderer*);
+
+// Cull and draw the VoxelLayout::face chunk groups on the GPU (one
+// compute dispatch and one vkCmdDrawIndirectCount) instead of one draw
+// per group. Off by default, as it is not yet validated; only
+// supported with Vulkan 1.2 and buffer device addresses, and
+// set_gpu_culling can't enable it elsewhere.
+void set_gpu_culling(Renderer*, bool);
+bool get_gpu_culling(const Renderer*);
+
+// With GPU culling, also drop the groups hidden behind the previous
+// frame's depth (tested against a min/max depth pyramid built from
+// it on the GPU). Off by default, as it is not yet validated; only
+// supported where the depth format can be sampled.
+void set_hiz_culling(Renderer*, bool);
+bool get_hiz_culling(const Renderer*);
@@ -0,0 +1,46 @@
+#include "volume.hh"
+
+#include <algorithm>
+#include <string.h>
+
+namespace myricube {
+
+static_assert(sizeof(Voxel) == sizeof(uint32_t), "bricks copy voxels as-is");
+
+void make_raycast_volume(const ChunkGroup& group, RaycastVolume* out)
+{
+    out->words.assign(chunk_table_words, empty_brick);
+    for (int i = 0; i < 3; ++i) {
+        out->box_min[i] = group_size;
+        out->box_max[i] = 0;
+    }
+
+    uint32_t brick = 0;
+    Voxel voxels[chunk_voxels];
+    for (int cz = 0; cz < edge_chunks; ++cz) {
+        for (int cy = 0; cy < edge_chunks; ++cy) {
+            for (int cx = 0; cx < edge_chunks; ++cx) {
+                const Chunk* chunk = group.get_chunk(cx, cy, cz);
+                if (chunk == nullptr) continue;
+
+                out->words[(cz * edge_chunks + cy) * edge_chunks + cx] = brick++;
+                size_t offset = out->words.size();
+                out->words.resize(offset + brick_words);
+                chunk->decode(voxels);
+                memcpy(&out->words[offset], voxels, brick_words * sizeof(uint32_t));
+
+                const int c[3] = { cx, cy, cz };
+                for (int i = 0; i < 3; ++i) {
+                    out->box_min[i] = std::min(out->box_min[i], c[i] * chunk_size);
+                    out->box_max[i] = std::max(out->box_max[i], (c[i] + 1) * chunk_size);
+                }
+            }
+        }
+    }
+
+    if (brick == 0) {
+        for (int i = 0; i < 3; ++i) out->box_min[i] = out->box_max[i] = 0;
+    }
+}
+
+} // end namespace
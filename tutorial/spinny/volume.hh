@@ -0,0 +1,58 @@
+// Raycast volumes. Far-away chunk groups are not meshed; instead they
+// are uploaded as a two-level voxel volume that raycast.frag traverses
+// with a DDA (first over chunks, skipping empty ones, then over the
+// voxels of non-empty chunks).
+#ifndef MYRICUBE_VOLUME_HH_
+#define MYRICUBE_VOLUME_HH_
+
+#include <stdint.h>
+#include <vector>
+
+#include "chunk.hh"
+
+namespace myricube {
+
+// Layout of RaycastVolume::words. Keep in sync with raycast.frag.
+//
+// The first chunk_table_words words are indexed by chunk coordinates
+// [cz][cy][cx] and hold the brick index of the chunk, or empty_brick.
+// Brick b follows at chunk_table_words + b * brick_words, and is the
+// chunk's voxels' packed_color indexed [z][y][x] (0 if invisible).
+constexpr uint32_t empty_brick = 0xFFFFFFFF;
+constexpr uint32_t chunk_table_words = edge_chunks * edge_chunks * edge_chunks;
+constexpr uint32_t brick_words = chunk_size * chunk_size * chunk_size;
+
+struct RaycastVolume
+{
+    std::vector<uint32_t> words;
+
+    // Bounding box of the non-empty chunks, in residue coordinates
+    // (box_max is exclusive). Empty box (min == max) if no chunks.
+    int32_t box_min[3] = { 0, 0, 0 };
+    int32_t box_max[3] = { 0, 0, 0 };
+
+    bool empty() const
+    {
+        return box_min[0] == box_max[0];
+    }
+
+    size_t brick_count() const
+    {
+        return words.empty() ? 0 : (words.size() - chunk_table_words) / brick_words;
+    }
+
+    // Look up a voxel's packed color (0 if invisible).
+    uint32_t get(int x, int y, int z) const
+    {
+        uint32_t brick = words[((z / chunk_size) * edge_chunks + y / chunk_size) * edge_chunks + x / chunk_size];
+        if (brick == empty_brick) return 0;
+        uint32_t local = ((z % chunk_size) * chunk_size + y % chunk_size) * chunk_size + x % chunk_size;
+        return words[chunk_table_words + brick * brick_words + local];
+    }
+};
+
+// Replace *out with the volume of the chunk group.
+void make_raycast_volume(const ChunkGroup& group, RaycastVolume* out);
+
+} // end namespace
+#endif /* !MYRICUBE_VOLUME_HH_ */
@@ -7,11 +7,6 @@
 #define BORDER_DIST_LOW  100
 #define BORDER_DIST_HIGH 350
 
-layout(push_constant) uniform PushConstantBlock {
-    mat4 mvp;
-    vec4 color;
-} PushConstant;
-
 layout(location=0) in vec3 v_color;
 layout(location=1) in vec3 v_residue_coord;
 layout(location=2) in vec2 v_uv;
@@ -16,11 +16,27 @@
 #define GREEN_SHIFT 16
 #define BLUE_SHIFT 8
 
-layout(push_constant) uniform PushConstantBlock {
-    mat4 mvp;
-    vec4 color;
+#define GROUP_SIZE 256
+
+// Camera of the frame (CameraUniform in render.cc), shared by all the
+// chunk groups' draws, which are recorded once and reused.
+layout(set=0, binding=0) uniform CameraBlock {
+    mat4 view_projection;   // Eye-relative (the view without translation).
+    ivec4 eye_group;        // Chunk group the eye is in,
+    vec4 eye_residue;       // and the eye's position within it.
+} camera;
+
+layout(push_constant) uniform GroupPushConstantBlock {
+    ivec4 group;            // Chunk group coordinate; w is its level of detail.
 } push;
 
+// Eye-relative position of a point in residue coordinates of the level
+// of detail the group is drawn at.
+vec3 eye_relative(vec3 residue) {
+    return vec3(push.group.xyz - camera.eye_group.xyz) * GROUP_SIZE
+         + residue * float(1 << push.group.w) - camera.eye_residue.xyz;
+}
+
 // Instanced inputs:
 // Residue coordinates and bitfield of visible +/- x,y,z faces.
 layout(location=0) in uint packed_residue_face_bits;
@@ -117,9 +133,8 @@ void main() {
     vec4 model_space_position = vec4(x, y, z, 1);
     v_residue_coord = model_space_position.xyz;
 
-    // Perspective transformation. Note that the location of the chunk
-    // group we're in is taken care of by the 'm' in mvp.
-    gl_Position = push.mvp * model_space_position;
+    // Perspective transformation, relative to the eye.
+    gl_Position = camera.view_projection * vec4(eye_relative(model_space_position.xyz), 1);
 
     // Unpack the color.
     float red   = ((packed_color >> RED_SHIFT) & 255) * (1./255.);
@@ -1,13 +1,24 @@
 #include "window.hh"
 
 #include <atomic>
+#include <chrono>
 #include <ctype.h>
 #include <stdexcept>
 #include <stdio.h>
+#include <thread>
 #include <unordered_map>
 
 static constexpr double fps_report_interval = 0.5;
 
+// Sleeps can overshoot (by tens of microseconds to a millisecond or
+// so, depending on the OS), so frames paced to a target FPS sleep until
+// this long before they're due, and spin (yielding) the rest. Kept
+// short, as the spin costs CPU every frame.
+static constexpr double frame_spin_seconds = 0.0002;
+
+// How often to check for events while minimized.
+static constexpr double iconified_poll_seconds = 0.25;
+
 namespace myricube {
 
 // For now I'm just indicating mouse buttons with negative numbers.
@@ -61,6 +72,10 @@ Window::Window(OnWindowResize on_window_resize_)
     glfwSetMouseButtonCallback(window, mouse_button_callback);
     glfwSetScrollCallback(window, scroll_callback);
 
+    GLFWmonitor* monitor = glfwGetPrimaryMonitor();
+    const GLFWvidmode* mode = monitor ? glfwGetVideoMode(monitor) : nullptr;
+    if (mode != nullptr && mode->refreshRate > 0) target_fps = mode->refreshRate;
+
     if (on_window_resize) on_window_resize(window_x, window_y);
 }
 
@@ -80,14 +95,34 @@ void Window::set_title(const char* title)
     glfwSetWindowTitle(window, title);
 }
 
+// Wait until the next frame is due, per the frame pacing: while the
+// window is minimized, until it's restored (handling events); while it
+// isn't focused, per background_fps; otherwise per target_fps if
+// pacing to it. Frames are due 1/fps seconds after the previous one.
+void Window::wait_for_frame()
+{
+    while (glfwGetWindowAttrib(window, GLFW_ICONIFIED) && !glfwWindowShouldClose(window)) {
+        glfwWaitEventsTimeout(iconified_poll_seconds);
+    }
+
+    double fps = 0;
+    if (!glfwGetWindowAttrib(window, GLFW_FOCUSED)) fps = background_fps;
+    else if (frame_pacing == FramePacing::target_fps) fps = target_fps;
+    if (fps <= 0) return;
+
+    double due = previous_update + 1.0 / fps;
+    double sleep_seconds = due - glfwGetTime() - frame_spin_seconds;
+    if (sleep_seconds > 0) {
+        std::this_thread::sleep_for(std::chrono::duration<double>(sleep_seconds));
+    }
+    while (glfwGetTime() < due) std::this_thread::yield();
+}
+
 bool Window::frame_update(float* out_dt)
 {
-    double now, dt;
-    // Calculate dt and throttle to 1000 FPS.
-    do {
-        now = glfwGetTime();
-        dt = now - previous_update;
-    } while (dt < 0.001);
+    wait_for_frame();
+    double now = glfwGetTime();
+    double dt = now - previous_update;
     previous_update = now;
     if (out_dt) *out_dt = dt;
 
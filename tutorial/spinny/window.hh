@@ -18,6 +18,21 @@ namespace myricube {
 
 constexpr float max_dt = 1/15.f;
 
+// How frame_update paces the frames.
+enum class FramePacing
+{
+    // Return at once: frames are drawn as fast as the renderer goes.
+    uncapped,
+
+    // Return when the frame is due at the target FPS (see
+    // set_target_fps), sleeping until shortly before.
+    target_fps,
+
+    // Return at once, and leave the pacing to presentation: with a
+    // FIFO present mode, the renderer waits for the display's refresh.
+    present,
+};
+
 // Callback type of window resize handler (takes x,y of new window size).
 using OnWindowResize = std::function<void(int,int)>;
 
@@ -101,6 +116,12 @@ class Window
     double frame_time = 0;
     double next_frame_time = 0;
 
+    // Frame pacing (see wait_for_frame). target_fps is set to the
+    // primary monitor's refresh rate when the window is created.
+    FramePacing frame_pacing = FramePacing::present;
+    double target_fps = 60;
+    double background_fps = 10;
+
     // Current cursor position; negative if not yet set.
     double cursor_x = -1;
     double cursor_y = -1;
@@ -159,12 +180,49 @@ class Window
         return int(frame_time * 1000);
     }
 
+    // Frame pacing of frame_update. Defaults to FramePacing::present.
+    void set_frame_pacing(FramePacing pacing)
+    {
+        frame_pacing = pacing;
+    }
+
+    FramePacing get_frame_pacing() const
+    {
+        return frame_pacing;
+    }
+
+    // Target FPS of FramePacing::target_fps. Defaults to the primary
+    // monitor's refresh rate (or 60 if that's unknown).
+    void set_target_fps(double fps)
+    {
+        target_fps = fps;
+    }
+
+    double get_target_fps() const
+    {
+        return target_fps;
+    }
+
+    // FPS cap while the window isn't focused, whatever the frame
+    // pacing (0 for none). Defaults to 10. While minimized, no frames
+    // are drawn at all.
+    void set_background_fps(double fps)
+    {
+        background_fps = fps;
+    }
+
+    double get_background_fps() const
+    {
+        return background_fps;
+    }
+
     void set_on_window_resize(OnWindowResize on_window_resize_)
     {
         on_window_resize = std::move(on_window_resize_);
     }
 
   private:
+    void wait_for_frame();
     void handle_down(int, float);
     void handle_up(int);
 